@@ -6,8 +6,11 @@
 #include <vector>
 #include <unordered_map>
 #include "koopa.h"
+#include "opt/ir.h"
+#include "opt/out_of_ssa.h"
+#include "opt/alias.h"
 
-#define IN_IMM12(x) (((x) >= -2048) && ((x) <= 2047)) 
+#define IN_IMM12(x) (((x) >= -2048) && ((x) <= 2047))
 #define ALIGN_TO_16(x) (((x) + 15) & (~15))
 #define max(a,b) (((a) > (b)) ? (a) : (b))
 
@@ -19,11 +22,18 @@ static int sf_index = 0;
 // 函数是否需要保存ra
 static int save_ra = 0;
 
-// 数组或指针的维度长度
-static std::unordered_map<koopa_raw_value_t, std::vector<int>> array_dims;
-// 每个value对应的维度区间
-typedef std::pair<std::vector<int>::iterator, std::vector<int>::iterator> range_t;
-static std::unordered_map<koopa_raw_value_t, range_t> array_ranges;
+// 当前函数的入口基本块
+static koopa_raw_basic_block_t entry_bb = nullptr;
+// 下一个输出的基本块, 跳转到它时可以省略跳转指令
+static koopa_raw_basic_block_t next_bb = nullptr;
+
+// jump上实参到目标块参数的一次复制
+struct Move {
+  int dst;
+  koopa_raw_value_t src;
+  int src_slot;   // src不在栈槽中时为-1
+  bool in_scratch;
+};
 
 // 访问raw program
 void Visit(const koopa_raw_program_t& program);
@@ -37,8 +47,6 @@ void Visit(const koopa_raw_basic_block_t &bb);
 void Visit(const koopa_raw_value_t &value);
 // 访问 integer 指令
 void Visit(const koopa_raw_integer_t &integer);
-// 访问 alloc 指令
-void VisitAlloc(const koopa_raw_value_t &alloc);
 // 访问 global_alloc 指令
 void Visit(const koopa_raw_global_alloc_t &global_alloc, const koopa_raw_value_t &value);
 // 访问 load 指令
@@ -61,26 +69,37 @@ void Visit(const koopa_raw_call_t &call, const koopa_raw_value_t &value);
 void Visit(const koopa_raw_return_t &ret);
 
 // utilities
-// 将栈帧中value的值写到寄存器reg_name中
+// 为函数中的值分配栈帧位置, 计算栈帧大小
+void layout_frame(const koopa_raw_function_t &func);
+// 将value的值写到寄存器reg_name中, alloc和全局变量的值是它们的地址
 void write_reg(const koopa_raw_value_t &value, const std::string &reg_name);
 // 将寄存器reg_name的值储存到栈帧中的value
 void save_reg(const koopa_raw_value_t &value, const std::string &reg_name);
-// 将value的地址写到reg_name中
-void write_addr_reg(const koopa_raw_value_t &value, const std::string &reg_name);
-// value是否是一个*...
-int isPointer(const koopa_raw_value_t &value);
+// 以sp为基址访问栈帧, 处理偏移量超出imm12的情况
+void sp_access(const std::string &op, const std::string &reg_name, int offset);
+// 计算 ptr + index * size, 结果在t0中
+void pointer_add(const koopa_raw_value_t &ptr, const koopa_raw_value_t &index, int size);
+// 计算 c * x (x在寄存器x中), 结果写到寄存器a, tmp为临时寄存器, 返回结果所在的寄存器 (c为1时就是x)
+std::string mul_by_const(int c, const std::string &x, const std::string &a, const std::string &tmp);
+// 有符号除以常量d (d不为0) 的magic number: q = (mulh(x, m) (+/- x)) >> s, 再对负数的商加1
+void signed_magic(int d, int &m, int &s);
+// t0除以常量d (d不为0) 的商或余数 (rem为true时), 结果在t0中
+void div_by_const(int d, bool rem);
 // 全局数组初始化
 void global_array_init(const koopa_raw_value_t &value);
-// base type的大小
-int base_size(const range_t& se);
+// jump需要执行的复制, 栈槽相同的复制被省略
+std::vector<Move> jump_moves(const koopa_raw_jump_t &jump);
+// 拆分关键边得到的基本块若不需要任何复制, 让branch直接跳到它的目标
+void skip_trivial_splits(const koopa_raw_function_t &func);
+// 基本块末尾可以作为兄弟调用的call, 没有时返回nullptr
+koopa_raw_value_t sibling_call(const koopa_raw_basic_block_t &bb);
+// 释放栈帧后跳到被调用的函数, 由它直接返回到本函数的调用者
+void tail_call(const koopa_raw_call_t &call);
+// 恢复ra并释放栈帧
+void epilogue();
 
 // 访问 raw program
 void Visit(const koopa_raw_program_t &program) {
-  // 执行一些其他的必要操作
-  // ...
-  array_dims.clear();
-  array_ranges.clear();
-
   // 访问所有全局变量
   Visit(program.values);
   // 访问所有函数
@@ -118,82 +137,136 @@ void Visit(const koopa_raw_function_t &func) {
     return;
   }
 
+  // 基本块参数: 拆分关键边, 让实参只出现在jump上
+  split_critical_edges(func);
+
   // 执行一些其他的必要操作
   std::cout << "  .text" << std::endl;
   std::cout << "  .globl " << func->name + 1 << std::endl;
   std::cout << func->name + 1 << ":" << std::endl;
 
+  // 计算该函数的栈帧
+  layout_frame(func);
+  skip_trivial_splits(func);
+  entry_bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[0]);
+
+  // 分配栈帧空间
+  if(sf_size > 0 && sf_size <= 2048) {
+    std::cout << "  addi sp, sp, -" << sf_size << std::endl;
+  } else if (sf_size > 2048) {
+    std::cout << "  li t0, " << -sf_size << std::endl;
+    std::cout << "  add sp, sp, t0" << std::endl;
+  }
+
+  if(save_ra) {
+    if(sf_size - 4 <= 2047) {
+      std::cout << "  sw ra, " << sf_size - 4 << "(sp)" << std::endl;
+    } else {
+      std::cout << "  li t0, " << sf_size - 4 << std::endl;
+      std::cout << "  add t0, t0, sp" << std::endl;
+      std::cout << "  sw ra, 0(t0)" << std::endl;
+    }
+  }
+
+  // 函数中有call时, a0~a7会被覆盖, 需要先把寄存器参数保存到栈帧中
+  for(size_t i = 0; i < func->params.len && i < 8; ++i) {
+    auto param = reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i]);
+    if(stack_frame.count(param)) {
+      sp_access("sw", "a" + std::to_string(i), stack_frame[param]);
+    }
+  }
+
+  // 访问所有基本块
+  for(size_t i = 0; i < func->bbs.len; ++i) {
+    next_bb = i + 1 < func->bbs.len ? reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i + 1]) : nullptr;
+    Visit(reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]));
+  }
+  std::cout << std::endl;
+}
+
+// 计算栈帧: [0, A) 为调用其他函数时超出8个的参数, 之后是局部变量和临时值, 最高的4字节保存ra
+void layout_frame(const koopa_raw_function_t &func) {
   // 清空栈帧
   sf_size = sf_index = 0;
   stack_frame.clear();
 
-  int S = 0, R = 0, A = 0;
-
-  // 计算该函数的栈帧大小
+  // 只有兄弟调用时不需要保存ra, 但寄存器参数仍要保存, 传参时才不会互相覆盖
+  int R = 0, A = 0;
+  bool has_call = false;
   for(size_t i = 0; i < func->bbs.len; ++i) {
     auto block = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
-    S += 4 * (block->insts.len);
+    auto sibling = sibling_call(block);
     for(size_t j = 0; j < block->insts.len; ++j) {
       auto inst = reinterpret_cast<koopa_raw_value_t>(block->insts.buffer[j]);
-      if(inst->ty->tag == KOOPA_RTT_UNIT) {
-        S -= 4;
-      } 
       if(inst->kind.tag == KOOPA_RVT_CALL) {
+        has_call = true;
+        if(inst == sibling) continue;
         R = 4;
         A = max(A, 4 * max(0, int(inst->kind.data.call.args.len) - 8));
-      } else if(inst->kind.tag == KOOPA_RVT_ALLOC && inst->ty->data.pointer.base->tag == KOOPA_RTT_ARRAY) {
-        S -= 4;
-        int cur_sz = 4;
-        auto base = inst->ty->data.pointer.base;
-        while(base->tag == KOOPA_RTT_ARRAY) {
-          cur_sz *= base->data.array.len; 
-          base = base->data.array.base;
-        }
-        S += cur_sz; 
       }
     }
   }
 
-  sf_size = ALIGN_TO_16(S + R + A);
   // sf_index要从函数参数后开始
   sf_index = A;
 
-  // 分配栈帧空间
-  if(sf_size > 0 && sf_size <= 2048) {
-    std::cout << "  addi sp, sp, -" << sf_size << std::endl;
-  } else if (sf_size > 2048) {
-    std::cout << "  li t0, " << -sf_size << std::endl;
-    std::cout << "  add sp, sp, t0" << std::endl;
+  if(has_call) {
+    for(size_t i = 0; i < func->params.len && i < 8; ++i) {
+      stack_frame[reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i])] = sf_index;
+      sf_index += 4;
+    }
   }
 
-  save_ra = 0;
-  if(R > 0) {
-    save_ra = 1;
-    if(sf_size - 4 <= 2047) {
-      std::cout << "  sw ra, " << sf_size - 4 << "(sp)" << std::endl; 
+  // 合并后同一类的值共用一个栈槽
+  CopyCoalescer coalescer(func);
+  auto assign = [&](koopa_raw_value_t value) {
+    auto rep = coalescer.find(value);
+    auto it = stack_frame.find(rep);
+    if(it != stack_frame.end()) {
+      stack_frame[value] = it->second;
     } else {
-      std::cout << "  li t0, " << sf_size - 4 << std::endl;
-      std::cout << "  add t0, t0, sp" << std::endl;
-      std::cout << "  sw ra, 0(t0)" << std::endl;
+      stack_frame[rep] = stack_frame[value] = sf_index;
+      sf_index += 4;
+    }
+  };
+  for(size_t i = 0; i < func->bbs.len; ++i) {
+    auto block = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    for(size_t j = 0; j < block->params.len; ++j) {
+      assign(reinterpret_cast<koopa_raw_value_t>(block->params.buffer[j]));
+    }
+    for(size_t j = 0; j < block->insts.len; ++j) {
+      auto inst = reinterpret_cast<koopa_raw_value_t>(block->insts.buffer[j]);
+      if(inst->kind.tag == KOOPA_RVT_ALLOC) {
+        stack_frame[inst] = sf_index;
+        sf_index += type_size(inst->ty->data.pointer.base);
+      } else if(inst->ty->tag != KOOPA_RTT_UNIT) {
+        assign(inst);
+      }
     }
   }
 
-
-  // 访问所有基本块
-  Visit(func->bbs);
-  std::cout << std::endl;
+  sf_size = ALIGN_TO_16(sf_index + R);
+  save_ra = R > 0;
 }
 
 // 访问基本块
 void Visit(const koopa_raw_basic_block_t &bb) {
   // 执行一些其他的必要操作
-  // 打印基本块入口
-  if(strncmp(bb->name + 1, "LHR_entry", 9) != 0) {
+  // 打印基本块入口, 函数的入口块紧跟在函数名之后, 不需要标号
+  if(bb != entry_bb) {
     std::cout << bb->name + 1 << ":" << std::endl;
   }
 
-  // 访问所有指令
-  Visit(bb->insts);
+  // 访问所有指令, 末尾的兄弟调用和ret一起处理
+  auto call = sibling_call(bb);
+  if(call == nullptr) {
+    Visit(bb->insts);
+  } else {
+    for(size_t i = 0; i + 2 < bb->insts.len; ++i) {
+      Visit(reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[i]));
+    }
+    tail_call(call->kind.data.call);
+  }
 
   std::cout << std::endl;
 }
@@ -219,7 +292,7 @@ void Visit(const koopa_raw_value_t &value) {
       Visit(kind.data.integer);
       break;
     case KOOPA_RVT_ALLOC:
-      VisitAlloc(value);
+      // 栈帧位置已经在layout_frame中分配
       break;
     case KOOPA_RVT_GLOBAL_ALLOC:
       Visit(kind.data.global_alloc, value);
@@ -261,40 +334,6 @@ void Visit(const koopa_raw_value_t &value) {
 void Visit(const koopa_raw_integer_t &integer) {
   int32_t int_val = integer.value;
   std::cout << "  li a0, " << int_val << "\n";
-} 
-
-// alloc
-void VisitAlloc(const koopa_raw_value_t &alloc) {
-  auto base = alloc->ty->data.pointer.base;
-  if(base->tag == KOOPA_RTT_INT32) {
-    stack_frame[alloc] = sf_index;
-    sf_index += 4;
-  } else if(base->tag == KOOPA_RTT_ARRAY ){
-    int cur_sz = 4;
-    for(int i: array_dims[alloc]) {std::cout << i << std::endl;}
-    while(base->tag == KOOPA_RTT_ARRAY) {
-      //std::cout << "len is " << base->data.array.len << std::endl;
-      array_dims[alloc].push_back(base->data.array.len);
-      cur_sz *= base->data.array.len;
-      base = base->data.array.base;
-    }
-    array_ranges[alloc] = std::make_pair(array_dims[alloc].begin(), array_dims[alloc].end());
-    stack_frame[alloc] = sf_index;
-    sf_index += cur_sz;
-    //for(int i: array_dims[alloc]) {std::cout << i << std::endl;}
-  } else if(base->tag == KOOPA_RTT_POINTER) {
-    while(base->tag == KOOPA_RTT_POINTER) {
-      array_dims[alloc].push_back(0);
-      base = base->data.array.base;
-    }
-    while(base->tag == KOOPA_RTT_ARRAY) {
-      array_dims[alloc].push_back(base->data.array.len);
-      base = base->data.array.base;
-    }
-    array_ranges[alloc] = std::make_pair(array_dims[alloc].begin(), array_dims[alloc].end());
-    stack_frame[alloc] = sf_index;
-    sf_index += 4;
-  }
 }
 
 // global_alloc
@@ -303,35 +342,15 @@ void Visit(const koopa_raw_global_alloc_t &global_alloc, const koopa_raw_value_t
   std::cout << "  .globl " << value->name + 1 << std::endl;
   std::cout << value->name + 1 << ":" << std::endl;
   switch(global_alloc.init->kind.tag) {
-    case KOOPA_RVT_ZERO_INIT: {
-      auto base = value->ty->data.pointer.base;
-      int cur_sz = 4;
-      bool is_array = 0;
-      while(base->tag == KOOPA_RTT_ARRAY) {
-        is_array = 1;
-        array_dims[value].push_back(base->data.array.len);
-        cur_sz *= base->data.array.len;
-        base = base->data.array.base;
-      }
-      if(is_array) {
-        array_ranges[value] = std::make_pair(array_dims[value].begin(), array_dims[value].end());
-      }
-      std::cout << "  .zero " << cur_sz << std::endl;
+    case KOOPA_RVT_ZERO_INIT:
+      std::cout << "  .zero " << type_size(value->ty->data.pointer.base) << std::endl;
       break;
-    }
     case KOOPA_RVT_INTEGER:
       std::cout << "  .word " << global_alloc.init->kind.data.integer.value << std::endl;
       break;
-    case KOOPA_RVT_AGGREGATE: {
-      auto base = value->ty->data.pointer.base;
-      while(base->tag == KOOPA_RTT_ARRAY) {
-        array_dims[value].push_back(base->data.array.len);
-        base = base->data.array.base;
-      }
-      array_ranges[value] = std::make_pair(array_dims[value].begin(), array_dims[value].end());
+    case KOOPA_RVT_AGGREGATE:
       global_array_init(global_alloc.init);
       break;
-    }
     default:
       // 其他类型暂时遇不到
       assert(false);
@@ -341,74 +360,255 @@ void Visit(const koopa_raw_global_alloc_t &global_alloc, const koopa_raw_value_t
 
 
 // 访问load
-// 处理imm12, 若越界则
-// li t3, imm12
-// add t3, sp, t3
-// sw dest, t3
+// alloc直接用sp加偏移量访问, 全局变量先la, 其他情况src的值就是地址
 void Visit(const koopa_raw_load_t &load, const koopa_raw_value_t &dest) {
-  write_reg(load.src, "t0");
-  if(isPointer(load.src)) {
+  if(load.src->kind.tag == KOOPA_RVT_ALLOC) {
+    sp_access("lw", "t0", stack_frame[load.src]);
+  } else {
+    write_reg(load.src, "t0");
     std::cout << "  lw t0, 0(t0)" << std::endl;
   }
-  if(array_ranges.find(load.src) != array_ranges.end()) {
-    array_ranges[dest] = array_ranges[load.src];
-  }
-  stack_frame[dest] = sf_index; 
-  sf_index += 4;
   save_reg(dest, "t0");
 }
 
 // 访问store
 void Visit(const koopa_raw_store_t &store) {
   write_reg(store.value, "t0");
-  if(isPointer(store.value)) {
-    std::cout << "  lw t0, 0(t0)" << std::endl;
-  }
-  write_addr_reg(store.dest, "t3");
-  if(isPointer(store.dest)) {
-    std::cout << "  lw t3, 0(t3)" << std::endl;
+  if(store.dest->kind.tag == KOOPA_RVT_ALLOC) {
+    sp_access("sw", "t0", stack_frame[store.dest]);
+  } else {
+    write_reg(store.dest, "t3");
+    std::cout << "  sw t0, 0(t3)" << std::endl;
   }
-  std::cout << "  sw t0, 0(t3)" << std::endl;
 }
 
-// 访问 getptr 
+// 访问 getptr, 步长为src所指类型的大小
 void Visit(const koopa_raw_get_ptr_t &getptr, const koopa_raw_value_t& dest) {
-  write_addr_reg(getptr.src, "t0");
-  if(isPointer(getptr.src)) {
-    std::cout << "  lw t0, 0(t0)" << std::endl;
-  }
-  write_reg(getptr.index, "t1");
-  std::cout << "  li t2, " << base_size(array_ranges[getptr.src]) << std::endl;
-  std::cout << "  mul t1, t1, t2" << std::endl;
-  std::cout << "  add t0, t0, t1" << std::endl;
-  auto se = array_ranges[getptr.src];
-  auto s = se.first; ++s;
-  array_ranges[dest] = std::make_pair(s, se.second);
-  stack_frame[dest] = sf_index;
-  sf_index += 4;
+  pointer_add(getptr.src, getptr.index, type_size(getptr.src->ty->data.pointer.base));
   save_reg(dest, "t0");
 }
 
-// 访问 getelemptr 
+// 访问 getelemptr, 步长为src所指数组的元素大小
 void Visit(const koopa_raw_get_elem_ptr_t &getelemptr, const koopa_raw_value_t& dest) {
-  write_addr_reg(getelemptr.src, "t0");
-  if(isPointer(getelemptr.src)) {
-    std::cout << "  lw t0, 0(t0)" << std::endl;
-  }
-  write_reg(getelemptr.index, "t1");
-  std::cout << "  li t2, " << base_size(array_ranges[getelemptr.src]) << std::endl;
-  std::cout << "  mul t1, t1, t2" << std::endl;
-  std::cout << "  add t0, t0, t1" << std::endl;
-  auto se = array_ranges[getelemptr.src];
-  auto s = se.first; ++s;
-  array_ranges[dest] = std::make_pair(s, se.second);
-  stack_frame[dest] = sf_index;
-  sf_index += 4;
+  pointer_add(getelemptr.src, getelemptr.index,
+              type_size(getelemptr.src->ty->data.pointer.base->data.array.base));
   save_reg(dest, "t0");
 }
 
+// 下标是常量时直接加上偏移量, 否则下标乘以元素大小 (见mul_by_const)
+void pointer_add(const koopa_raw_value_t &ptr, const koopa_raw_value_t &index, int size) {
+  write_reg(ptr, "t0");
+  if(index->kind.tag == KOOPA_RVT_INTEGER) {
+    int offset = index->kind.data.integer.value * size;
+    if(offset == 0) {
+      return;
+    } else if(IN_IMM12(offset)) {
+      std::cout << "  addi t0, t0, " << offset << std::endl;
+    } else {
+      std::cout << "  li t1, " << offset << std::endl;
+      std::cout << "  add t0, t0, t1" << std::endl;
+    }
+    return;
+  }
+  write_reg(index, "t1");
+  auto offset = mul_by_const(size, "t1", "t2", "t3");
+  std::cout << "  add t0, t0, " << offset << std::endl;
+}
+
+// 常量乘法的代价, 按顺序单发射的核计算: 移位和加减都是1个周期,
+// 乘法的结果在kMulLatency个周期后才能被下一条指令使用
+static const int kMulLatency = 3;
+
+// 乘以常量的一步, 累加器A的初值为被乘数x
+// '<': A <<= k, '+': A += x, '-': A -= x, 'r': A = x - A, 'n': A = -A, 'a': A += A << k, 's': A = (A << k) - A
+struct MulStep {
+  char op;
+  int k;
+};
+
+static int mul_step_cost(const MulStep &step) {
+  return step.op == 'a' || step.op == 's' ? 2 : 1;
+}
+
+// 在代价budget之内用移位和加减得到 c * x (按2^32取模), 成功时把步骤追加到plan
+static bool find_mul_plan(int64_t c, int budget, std::vector<MulStep> &plan) {
+  if(c == 1) return true;
+  if(budget <= 0) return false;
+  auto attempt = [&](int64_t m, MulStep step) {
+    if(mul_step_cost(step) > budget) return false;
+    size_t len = plan.size();
+    if(find_mul_plan(m, budget - mul_step_cost(step), plan)) {
+      plan.push_back(step);
+      return true;
+    }
+    plan.resize(len);
+    return false;
+  };
+  if(c < 0) return attempt(-c, {'n', 0}) || attempt(1 - c, {'r', 0});
+  if(c % 2 == 0) {
+    int z = __builtin_ctzll(c);
+    return attempt(c >> z, {'<', z});
+  }
+  if(attempt(c - 1, {'+', 0}) || attempt(c + 1, {'-', 0})) return true;
+  // 因子 2^k + 1 和 2^k - 1
+  for(int k = 1; k < 31 && (int64_t(1) << k) - 1 <= c; ++k) {
+    int64_t f = (int64_t(1) << k) + 1, g = (int64_t(1) << k) - 1;
+    if(c % f == 0 && attempt(c / f, {'a', k})) return true;
+    if(g > 1 && c % g == 0 && attempt(c / g, {'s', k})) return true;
+  }
+  return false;
+}
+
+// 代价最小的分解 (逐步放宽代价), 不比 li + mul 便宜时使用乘法
+std::string mul_by_const(int c, const std::string &x, const std::string &a, const std::string &tmp) {
+  if(c == 0) {
+    std::cout << "  li " << a << ", 0" << std::endl;
+    return a;
+  }
+  int li_cost = IN_IMM12(c) || (c & 0xfff) == 0 ? 1 : 2;
+  std::vector<MulStep> plan;
+  bool found = false;
+  for(int budget = 0; budget < li_cost + kMulLatency && !found; ++budget) {
+    plan.clear();
+    found = find_mul_plan(c, budget, plan);
+  }
+  if(!found) {
+    std::cout << "  li " << a << ", " << c << std::endl;
+    std::cout << "  mul " << a << ", " << x << ", " << a << std::endl;
+    return a;
+  }
+  std::string cur = x;
+  for(const auto &step : plan) {
+    switch(step.op) {
+      case '<':
+        std::cout << "  slli " << a << ", " << cur << ", " << step.k << std::endl;
+        break;
+      case '+':
+        std::cout << "  add " << a << ", " << cur << ", " << x << std::endl;
+        break;
+      case '-':
+        std::cout << "  sub " << a << ", " << cur << ", " << x << std::endl;
+        break;
+      case 'r':
+        std::cout << "  sub " << a << ", " << x << ", " << cur << std::endl;
+        break;
+      case 'n':
+        std::cout << "  neg " << a << ", " << cur << std::endl;
+        break;
+      case 'a':
+        std::cout << "  slli " << tmp << ", " << cur << ", " << step.k << std::endl;
+        std::cout << "  add " << a << ", " << cur << ", " << tmp << std::endl;
+        break;
+      case 's':
+        std::cout << "  slli " << tmp << ", " << cur << ", " << step.k << std::endl;
+        std::cout << "  sub " << a << ", " << tmp << ", " << cur << std::endl;
+        break;
+    }
+    cur = a;
+  }
+  return cur;
+}
+
+// 有符号除法的magic number (Granlund-Montgomery, 见Hacker's Delight 10-1), |d| >= 2
+void signed_magic(int d, int &m, int &s) {
+  const uint32_t two31 = 0x80000000u;
+  uint32_t ad = d < 0 ? -uint32_t(d) : uint32_t(d);
+  uint32_t t = two31 + (uint32_t(d) >> 31);
+  uint32_t anc = t - 1 - t % ad;
+  uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+  uint32_t q2 = two31 / ad, r2 = two31 - q2 * ad;
+  int p = 31;
+  uint32_t delta;
+  do {
+    ++p;
+    q1 = 2 * q1; r1 = 2 * r1;
+    if(r1 >= anc) { ++q1; r1 -= anc; }
+    q2 = 2 * q2; r2 = 2 * r2;
+    if(r2 >= ad) { ++q2; r2 -= ad; }
+    delta = ad - r2;
+  } while(q1 < delta || (q1 == delta && r1 == 0));
+  m = int32_t(q2 + 1);
+  if(d < 0) m = -m;
+  s = p - 32;
+}
+
+// 除数是常量时不用div/rem (需要几十个周期):
+// |d|是2的幂时, 负数先加上 |d|-1 使移位向0取整; 其他除数用mulh乘以magic number;
+// 余数为 x - q * d. 除以-1的商用neg得到, INT_MIN / -1 与div一样回绕为INT_MIN
+void div_by_const(int d, bool rem) {
+  if(d == 1 || d == -1) {
+    if(rem) {
+      std::cout << "  li t0, 0" << std::endl;
+    } else if(d == -1) {
+      std::cout << "  neg t0, t0" << std::endl;
+    }
+    return;
+  }
+  uint32_t ad = d < 0 ? -uint32_t(d) : uint32_t(d);
+  if((ad & (ad - 1)) == 0) {
+    int k = __builtin_ctz(ad);
+    // t1 = x + (x < 0 ? |d|-1 : 0)
+    std::cout << "  srai t1, t0, 31" << std::endl;
+    std::cout << "  srli t1, t1, " << 32 - k << std::endl;
+    std::cout << "  add t1, t0, t1" << std::endl;
+    if(rem) {
+      // 余数的符号与被除数相同, 与除数的符号无关
+      if(IN_IMM12(-int64_t(ad))) {
+        std::cout << "  andi t1, t1, " << -int64_t(ad) << std::endl;
+      } else {
+        std::cout << "  srai t1, t1, " << k << std::endl;
+        std::cout << "  slli t1, t1, " << k << std::endl;
+      }
+      std::cout << "  sub t0, t0, t1" << std::endl;
+    } else {
+      std::cout << "  srai t0, t1, " << k << std::endl;
+      if(d < 0) std::cout << "  neg t0, t0" << std::endl;
+    }
+    return;
+  }
+  int m, s;
+  signed_magic(d, m, s);
+  std::cout << "  li t1, " << m << std::endl;
+  std::cout << "  mulh t1, t0, t1" << std::endl;
+  if(d > 0 && m < 0) std::cout << "  add t1, t1, t0" << std::endl;
+  if(d < 0 && m > 0) std::cout << "  sub t1, t1, t0" << std::endl;
+  if(s > 0) std::cout << "  srai t1, t1, " << s << std::endl;
+  std::cout << "  srli t2, t1, 31" << std::endl;
+  if(rem) {
+    std::cout << "  add t1, t1, t2" << std::endl;
+    auto product = mul_by_const(d, "t1", "t2", "t3");
+    std::cout << "  sub t0, t0, " << product << std::endl;
+  } else {
+    std::cout << "  add t0, t1, t2" << std::endl;
+  }
+}
+
 // 访问binary
 void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &dest) {
+  if((binary.op == KOOPA_RBO_DIV || binary.op == KOOPA_RBO_MOD) && binary.rhs->kind.tag == KOOPA_RVT_INTEGER &&
+     binary.rhs->kind.data.integer.value != 0) {
+    write_reg(binary.lhs, "t0");
+    div_by_const(binary.rhs->kind.data.integer.value, binary.op == KOOPA_RBO_MOD);
+    save_reg(dest, "t0");
+    return;
+  }
+  // 乘以常量用移位和加减, 常量的移位量用立即数形式
+  if(binary.rhs->kind.tag == KOOPA_RVT_INTEGER) {
+    int c = binary.rhs->kind.data.integer.value;
+    const char *shift = binary.op == KOOPA_RBO_SHL ? "slli" : binary.op == KOOPA_RBO_SHR ? "srli" :
+                        binary.op == KOOPA_RBO_SAR ? "srai" : nullptr;
+    if(binary.op == KOOPA_RBO_MUL) {
+      write_reg(binary.lhs, "t0");
+      save_reg(dest, mul_by_const(c, "t0", "t1", "t2"));
+      return;
+    }
+    if(shift != nullptr) {
+      write_reg(binary.lhs, "t0");
+      std::cout << "  " << shift << " t0, t0, " << (c & 31) << std::endl;
+      save_reg(dest, "t0");
+      return;
+    }
+  }
   write_reg(binary.lhs, "t0"); write_reg(binary.rhs, "t1");
   switch(binary.op) {
     /// Not equal to. (xor, snez)
@@ -426,26 +626,26 @@ void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &dest) {
       std::cout << "  sgt t0, t0, t1" << std::endl;
       break;
   /// Less than. (slt)
-    case KOOPA_RBO_LT: 
+    case KOOPA_RBO_LT:
       std::cout << "  slt t0, t0, t1" << std::endl;
       break;
   /// Greater than or equal to. (slt, seqz)
     case KOOPA_RBO_GE:
       std::cout << "  slt t0, t0, t1" << std::endl;
       std::cout << "  seqz t0, t0" << std::endl;
-      break;      
+      break;
   /// Less than or equal to. (sgt, seqz)
     case KOOPA_RBO_LE:
       std::cout << "  sgt t0, t0, t1" << std::endl;
       std::cout << "  seqz t0, t0" << std::endl;
-      break;     
+      break;
   /// Addition. (add/addi)
     case KOOPA_RBO_ADD:
       std::cout << "  add t0, t0, t1" << std::endl;
       break;
   /// Subtraction. (sub)
     case KOOPA_RBO_SUB:
-      std::cout << "  sub t0, t0, t1" << std::endl;  
+      std::cout << "  sub t0, t0, t1" << std::endl;
       break;
   /// Multiplication. (mul)
     case KOOPA_RBO_MUL:
@@ -462,39 +662,127 @@ void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &dest) {
   /// Bitwise AND. (and/andi)
     case KOOPA_RBO_AND:
       std::cout << "  and t0, t0, t1" << std::endl;
-      break;    
+      break;
   /// Bitwise OR. (or/ori)
     case KOOPA_RBO_OR:
       std::cout << "  or t0, t0, t1" << std::endl;
-      break;      
+      break;
   /// Bitwise XOR. (xor/xori)
     case KOOPA_RBO_XOR:
       std::cout << "  xor t0, t0, t1" << std::endl;
       break;
   /// Shift left logical (sll)
     case KOOPA_RBO_SHL:
-      assert(0); break;
+      std::cout << "  sll t0, t0, t1" << std::endl;
+      break;
   /// Shift right logical. (srl)
     case KOOPA_RBO_SHR:
-      assert(0); break;
+      std::cout << "  srl t0, t0, t1" << std::endl;
+      break;
   /// Shift right arithmetic. (sra)
-    case KOOPA_RBO_SAR: break;
+    case KOOPA_RBO_SAR:
+      std::cout << "  sra t0, t0, t1" << std::endl;
+      break;
     default: break;
   }
-  stack_frame[dest] = sf_index; sf_index += 4;
   save_reg(dest, "t0");
 }
 
 // branch
 void Visit(const koopa_raw_branch_t &branch) {
+  // 带实参的边已经在split_critical_edges中被拆分
+  assert(branch.true_args.len == 0 && branch.false_args.len == 0);
   write_reg(branch.cond, "t0");
+  if(branch.true_bb == next_bb) {
+    std::cout << "  beqz t0, " << branch.false_bb->name + 1 << std::endl;
+    return;
+  }
   std::cout << "  bnez t0, " << branch.true_bb->name + 1 << std::endl;
-  std::cout << "  j " << branch.false_bb->name + 1 << std::endl;
+  if(branch.false_bb != next_bb) {
+    std::cout << "  j " << branch.false_bb->name + 1 << std::endl;
+  }
 }
 
 // jump
+// 实参到目标块参数的复制是并行的: 先做目的栈槽不再被读取的复制,
+// 剩下的都在环上, 把环上一个栈槽的旧值暂存到t4中来打破环
 void Visit(const koopa_raw_jump_t &jump) {
-  std::cout << "  j " << jump.target->name + 1 << std::endl;
+  auto moves = jump_moves(jump);
+  while(!moves.empty()) {
+    size_t k = 0;
+    for(; k < moves.size(); ++k) {
+      bool blocked = false;
+      for(size_t j = 0; j < moves.size(); ++j) {
+        if(j != k && !moves[j].in_scratch && moves[j].src_slot == moves[k].dst) {
+          blocked = true;
+          break;
+        }
+      }
+      if(!blocked) break;
+    }
+    if(k == moves.size()) {
+      // 所有复制都在环上
+      k = 0;
+      sp_access("lw", "t4", moves[0].dst);
+      for(auto &m : moves) {
+        if(m.src_slot == moves[0].dst) m.in_scratch = true;
+      }
+    }
+    if(moves[k].in_scratch) {
+      sp_access("sw", "t4", moves[k].dst);
+    } else {
+      write_reg(moves[k].src, "t0");
+      sp_access("sw", "t0", moves[k].dst);
+    }
+    moves.erase(moves.begin() + k);
+  }
+  if(jump.target != next_bb) {
+    std::cout << "  j " << jump.target->name + 1 << std::endl;
+  }
+}
+
+std::vector<Move> jump_moves(const koopa_raw_jump_t &jump) {
+  std::vector<Move> moves;
+  for(size_t i = 0; i < jump.args.len; ++i) {
+    auto arg = reinterpret_cast<koopa_raw_value_t>(jump.args.buffer[i]);
+    auto param = reinterpret_cast<koopa_raw_value_t>(jump.target->params.buffer[i]);
+    int dst = stack_frame[param];
+    int src_slot = -1;
+    if(arg->kind.tag != KOOPA_RVT_ALLOC && stack_frame.count(arg)) {
+      src_slot = stack_frame[arg];
+    }
+    // 被合并到同一个栈槽的复制不需要指令
+    if(src_slot == dst) continue;
+    bool dup = false;
+    for(auto &m : moves) dup |= m.dst == dst;
+    // 两个参数共用栈槽时它们都已经不再活跃
+    if(dup) continue;
+    moves.push_back({dst, arg, src_slot, false});
+  }
+  return moves;
+}
+
+void skip_trivial_splits(const koopa_raw_function_t &func) {
+  std::unordered_map<koopa_raw_basic_block_t, koopa_raw_basic_block_t> skip;
+  for(auto bb : func_blocks(func)) {
+    if(strncmp(bb->name, "%split", 6) != 0 || bb->insts.len != 1) continue;
+    auto jump = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[0]);
+    if(jump->kind.tag == KOOPA_RVT_JUMP && jump_moves(jump->kind.data.jump).empty()) {
+      skip[bb] = jump->kind.data.jump.target;
+    }
+  }
+  if(skip.empty()) return;
+  std::vector<koopa_raw_basic_block_t> kept;
+  for(auto bb : func_blocks(func)) {
+    if(skip.count(bb)) continue;
+    kept.push_back(bb);
+    auto term = terminator(bb);
+    for(int e = 0; e < edge_count(term); ++e) {
+      auto it = skip.find(edge_target(term, e));
+      if(it != skip.end()) edge_target(term, e) = it->second;
+    }
+  }
+  set_func_blocks(func, kept);
 }
 
 // call
@@ -517,14 +805,38 @@ void Visit(const koopa_raw_call_t &call, const koopa_raw_value_t &value) {
     }
   }
   // call func_name
-  std::cout << "  call " << call.callee->name+1 << std::endl; 
+  std::cout << "  call " << call.callee->name+1 << std::endl;
 
   // 如果有返回值, 将返回值入栈
   if(value->ty->tag != KOOPA_RTT_UNIT) {
-    stack_frame[value] = sf_index;
-    sf_index += 4;
-    save_reg(value, "a0"); 
+    save_reg(value, "a0");
+  }
+}
+
+// 基本块以call和返回call结果的ret结尾 (或者都没有返回值) 时可以作为兄弟调用:
+// 实参不超过8个, 都在寄存器中传递; 指针实参不能指向本函数的栈帧
+koopa_raw_value_t sibling_call(const koopa_raw_basic_block_t &bb) {
+  if(bb->insts.len < 2) return nullptr;
+  auto call = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[bb->insts.len - 2]);
+  auto ret = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[bb->insts.len - 1]);
+  if(call->kind.tag != KOOPA_RVT_CALL || ret->kind.tag != KOOPA_RVT_RETURN || call->kind.data.call.args.len > 8) {
+    return nullptr;
+  }
+  if(ret->kind.data.ret.value != (call->ty->tag == KOOPA_RTT_UNIT ? nullptr : call)) return nullptr;
+  for(auto arg : slice_items<koopa_raw_value_t>(call->kind.data.call.args)) {
+    if(arg->ty->tag != KOOPA_RTT_POINTER) continue;
+    auto base = pointer_base(arg)->kind.tag;
+    if(base != KOOPA_RVT_GLOBAL_ALLOC && base != KOOPA_RVT_FUNC_ARG_REF) return nullptr;
   }
+  return call;
+}
+
+void tail_call(const koopa_raw_call_t &call) {
+  for(size_t i = 0; i < call.args.len; ++i) {
+    write_reg(reinterpret_cast<koopa_raw_value_t>(call.args.buffer[i]), "a" + std::to_string(i));
+  }
+  epilogue();
+  std::cout << "  tail " << call.callee->name + 1 << std::endl;
 }
 
 // 访问return
@@ -533,7 +845,11 @@ void Visit(const koopa_raw_return_t &ret) {
   if(ret.value != nullptr) {
     write_reg(ret.value, "a0");
   }
+  epilogue();
+  std::cout << "  ret\n";
+}
 
+void epilogue() {
   if(save_ra) {
     int offset = sf_size - 4;
     if(IN_IMM12(offset)) {
@@ -549,9 +865,8 @@ void Visit(const koopa_raw_return_t &ret) {
     std::cout << "  addi sp, sp, " << sf_size << std::endl;
   } else if(sf_size > 2048) {
     std::cout << "  li t0, " << sf_size << std::endl;
-    std::cout << "  add sp, sp, t0" << std::endl;  
+    std::cout << "  add sp, sp, t0" << std::endl;
   }
-  std::cout << "  ret\n";
 }
 
 //将value的值写入寄存器
@@ -563,9 +878,14 @@ void write_reg(const koopa_raw_value_t &value, const std::string &reg_name) {
     case KOOPA_RVT_INTEGER:
       std::cout << "  li " << reg_name << ", " << kind.data.integer.value << std::endl;
       break;
+    case KOOPA_RVT_UNDEF:
+      std::cout << "  li " << reg_name << ", 0" << std::endl;
+      break;
     case KOOPA_RVT_FUNC_ARG_REF:
       index = kind.data.func_arg_ref.index;
-      if(index < 8) {
+      if(stack_frame.count(value)) {
+        sp_access("lw", reg_name, stack_frame[value]);
+      } else if(index < 8) {
         std::cout << "  mv " << reg_name << ", a" << index << std::endl;
       } else {
         // 注意这里offset一定要加上 sf_size, 这样才能获取到存放在caller栈帧中的参数
@@ -580,73 +900,36 @@ void write_reg(const koopa_raw_value_t &value, const std::string &reg_name) {
       }
       break;
     case KOOPA_RVT_GLOBAL_ALLOC:
-      std::cout << "  la t3, " << value->name + 1 << std::endl;
-      std::cout << "  lw " << reg_name << ", 0(t3)" << std::endl;
+      std::cout << "  la " << reg_name << ", " << value->name + 1 << std::endl;
       break;
-    default:
+    case KOOPA_RVT_ALLOC:
       offset = stack_frame[value];
       if(IN_IMM12(offset)) {
-        std::cout << "  lw " << reg_name << ", " << offset << "(sp)\n";
+        std::cout << "  addi " << reg_name << ", sp, " << offset << std::endl;
       } else {
-        std::cout << "  li t3, " << offset << std::endl;
-        std::cout << "  add t3, sp, t3" << std::endl;
-        std::cout << "  lw " << reg_name << ", 0(t3)" << std::endl; 
+        std::cout << "  li " << reg_name << ", " << offset << std::endl;
+        std::cout << "  add " << reg_name << ", " << reg_name << ", sp" << std::endl;
       }
       break;
+    default:
+      sp_access("lw", reg_name, stack_frame[value]);
+      break;
   }
-} 
-
-// 将寄存器中的值写入栈帧或全局变量
-void save_reg(const koopa_raw_value_t &value, const std::string &reg_name) {
-  int offset = stack_frame[value];
-  if(value->kind.tag == KOOPA_RVT_GLOBAL_ALLOC) {
-    std::cout << "  la t3, " << value->name + 1 << std::endl;
-    std::cout << "  sw " << reg_name << ", 0(t3)" << std::endl;
-  } else {
-    if(IN_IMM12(offset)) {
-      std::cout << "  sw " << reg_name << ", " << offset << "(sp)\n";
-    } else {
-      std::cout << "  li t3, " << offset << std::endl;
-      std::cout << "  add t3, sp, t3" << std::endl;
-      std::cout << "  sw " << reg_name << ", 0(t3)" << std::endl; 
-    }
-  }
-
 }
 
-// 将value的地址放入名字为reg_name的寄存器中
-void write_addr_reg(const koopa_raw_value_t &value, const std::string &reg_name) {
-  const auto& kind = value->kind;
-  // 全局变量
-  if(kind.tag == KOOPA_RVT_GLOBAL_ALLOC) {
-    std::cout << "  la " << reg_name << ", " << value->name + 1 << std::endl;
-  }
-  // 函数参数 
-  else if(kind.tag == KOOPA_RVT_FUNC_ARG_REF) {
-    size_t index = kind.data.func_arg_ref.index;
-    int offset = sf_size + (index - 8) * 4;
-    std::cout << "  li " << reg_name << ", " << offset << std::endl;
-    std::cout <<  "  add " << reg_name << ", " << reg_name << ", sp" << std::endl;
-  }
-  // 临时变量
-  else {
-    std::cout << "  li " << reg_name << ", " << stack_frame[value] << std::endl;
-    std::cout <<  "  add " << reg_name << ", " << reg_name << ", sp" << std::endl;
-  }
+// 将寄存器中的值写入栈帧
+void save_reg(const koopa_raw_value_t &value, const std::string &reg_name) {
+  sp_access("sw", reg_name, stack_frame[value]);
 }
 
-// 判断value是否是一个指针
-int isPointer(const koopa_raw_value_t &value) {
-  if(value->kind.tag == KOOPA_RVT_GET_PTR || value->kind.tag == KOOPA_RVT_GET_ELEM_PTR) {
-    return 1;
-  }
-  if(value->kind.tag == KOOPA_RVT_LOAD) {
-    const auto& src = value->kind.data.load.src;
-    if(src->kind.tag == KOOPA_RVT_ALLOC && src->ty->data.pointer.base->tag == KOOPA_RTT_POINTER) {
-      return 1;
-    }
+void sp_access(const std::string &op, const std::string &reg_name, int offset) {
+  if(IN_IMM12(offset)) {
+    std::cout << "  " << op << " " << reg_name << ", " << offset << "(sp)\n";
+  } else {
+    std::cout << "  li t3, " << offset << std::endl;
+    std::cout << "  add t3, sp, t3" << std::endl;
+    std::cout << "  " << op << " " << reg_name << ", 0(t3)" << std::endl;
   }
-  return 0;
 }
 
 // 全局数组初始化
@@ -657,6 +940,11 @@ void global_array_init(const koopa_raw_value_t &value) {
     return;
   }
 
+  if(kind.tag == KOOPA_RVT_ZERO_INIT) {
+    std::cout << "  .zero " << type_size(value->ty) << std::endl;
+    return;
+  }
+
   if(kind.tag == KOOPA_RVT_AGGREGATE) {
     const auto& ag = kind.data.aggregate;
     for(int i = 0; i < ag.elems.len; ++i) {
@@ -665,14 +953,3 @@ void global_array_init(const koopa_raw_value_t &value) {
   }
 
 }
-
-// base type的大小
-int base_size(const range_t& se) {
-  auto s = se.first, e = se.second;
-  int sz = 4;
-  ++s;
-  for(; s != e; ++s) {
-    sz *= *(s);
-  }
-  return sz;
-}
@@ -1,4 +1,5 @@
 #include <cassert>
+#include <cstdlib>
 #include <cstdio>
 #include <iostream>
 #include <memory>
@@ -7,6 +8,7 @@
 #include <fstream>
 #include "AST.h"
 #include "RISCV.h"
+#include "opt/optimize.h"
 #include "koopa.h"
 
 using namespace std;
@@ -19,13 +21,62 @@ using namespace std;
 extern FILE *yyin;
 extern int yyparse(unique_ptr<BaseAST> &ast);
 
+// 将Koopa IR文本解析为raw program, 返回的raw program的内存属于builder
+static koopa_raw_program_t build_raw(const string &irStr, koopa_raw_program_builder_t builder) {
+  // 解析字符串 str, 得到 Koopa IR 程序
+  koopa_program_t program;
+  koopa_error_code_t ret = koopa_parse_from_string(irStr.c_str(), &program);
+  assert(ret == KOOPA_EC_SUCCESS);  // 确保解析时没有出错
+  // 将 Koopa IR 程序转换为 raw program
+  koopa_raw_program_t raw = koopa_build_raw_program(builder, program);
+  // 释放 Koopa IR 程序占用的内存
+  koopa_delete_program(program);
+  return raw;
+}
+
+// 将优化后的raw program重新转换为Koopa IR文本
+static string dump_raw(const koopa_raw_program_t &raw) {
+  koopa_program_t program;
+  koopa_error_code_t ret = koopa_generate_raw_to_koopa(&raw, &program);
+  assert(ret == KOOPA_EC_SUCCESS);
+  size_t len = 0;
+  koopa_dump_to_string(program, nullptr, &len);
+  string buffer(len + 1, '\0');
+  koopa_dump_to_string(program, buffer.data(), &len);
+  buffer.resize(len);
+  koopa_delete_program(program);
+  return buffer;
+}
+
 int main(int argc, const char *argv[]) {
   // 解析命令行参数. 测试脚本/评测平台要求你的编译器能接收如下参数:
-  // compiler 模式 输入文件 -o 输出文件
-  assert(argc == 5);
+  // compiler 模式 输入文件 -o 输出文件 [选项]
+  // 选项: -O0/-O1/-O2 优化级别, --opt-report 输出优化统计信息到标准错误,
+  //       --unroll-factor N 循环展开的最大因子 (1表示不展开),
+  //       -fauto-memo 记忆化纯的递归函数 (需要-O1以上)
+  assert(argc >= 5);
   auto mode = argv[1];
   auto input = argv[2];
   auto output = argv[4];
+  // 性能测试默认开启全部优化
+  if(string(mode) == "-perf") {
+    opt_options.level = 2;
+  }
+  for(int i = 5; i < argc; ++i) {
+    string arg = argv[i];
+    if(arg.size() == 3 && arg.compare(0, 2, "-O") == 0 && arg[2] >= '0' && arg[2] <= '2') {
+      opt_options.level = arg[2] - '0';
+    } else if(arg == "--opt-report") {
+      opt_options.report = true;
+    } else if(arg == "-fauto-memo") {
+      opt_options.auto_memo = true;
+    } else if(arg == "--unroll-factor" && i + 1 < argc && atoi(argv[i + 1]) >= 1) {
+      opt_options.unroll_factor = atoi(argv[++i]);
+    } else {
+      cerr << "unknown option: " << arg << endl;
+      return 1;
+    }
+  }
 
   // 打开输入文件, 并且指定 lexer 在解析的时候读取这个文件
   yyin = fopen(input, "r");
@@ -41,81 +92,46 @@ int main(int argc, const char *argv[]) {
 
   ofstream outFile(output);
   assert(output);
-  if(string(mode) == "-koopa") {
-    streambuf* cout_buf = cout.rdbuf();
-    cout.rdbuf(outFile.rdbuf());
-    ast->DumpIR();
-    cout.rdbuf(cout_buf);
 
+  // 先得到koopa-ir并储存在irStr中
+  stringstream ss;
+  streambuf* cout_buf = cout.rdbuf();
+  cout.rdbuf(ss.rdbuf());
+  ast->DumpIR();
+  string irStr = ss.str();
+  cout.rdbuf(cout_buf);
+
+  if(string(mode) == "-koopa" && opt_options.level == 0) {
+    outFile << irStr;
     //输出到标准输出，方便调试
-    ast->DumpIR();
-    cout << endl;
+    cout << irStr << endl;
   }
-  else if (string(mode) == "-riscv") {
-    // 先得到koopa-ir并储存在str中
-    stringstream ss;
-    streambuf* cout_buf = cout.rdbuf();
-    cout.rdbuf(ss.rdbuf());
-    ast->DumpIR();
-    string irStr = ss.str();
-    cout.rdbuf(cout_buf);
-    const char* str = irStr.c_str();
-
-    // 解析字符串 str, 得到 Koopa IR 程序
-    koopa_program_t program;
-    koopa_error_code_t ret = koopa_parse_from_string(str, &program);
-    assert(ret == KOOPA_EC_SUCCESS);  // 确保解析时没有出错
+  else if (string(mode) == "-koopa" || string(mode) == "-riscv" || string(mode) == "-perf") {
     // 创建一个 raw program builder, 用来构建 raw program
     koopa_raw_program_builder_t builder = koopa_new_raw_program_builder();
-    // 将 Koopa IR 程序转换为 raw program
-    koopa_raw_program_t raw = koopa_build_raw_program(builder, program);
-    // 释放 Koopa IR 程序占用的内存
-    koopa_delete_program(program);
+    koopa_raw_program_t raw = build_raw(irStr, builder);
 
-    cout.rdbuf(outFile.rdbuf()); 
-    // 处理 raw program
-    Visit(raw);
-    cout.rdbuf(cout_buf);
-    // 输出到标准输出，便于调试
-    Visit(raw);
-    // 处理完成, 释放 raw program builder 占用的内存
-    // 注意, raw program 中所有的指针指向的内存均为 raw program builder 的内存
-    // 所以不要在 raw program 处理完毕之前释放 builder
-    koopa_delete_raw_program_builder(builder);
-  } else if(string(mode) == "-perf") {
-    // 先得到koopa-ir并储存在str中
-    stringstream ss;
-    streambuf* cout_buf = cout.rdbuf();
-    cout.rdbuf(ss.rdbuf());
-    ast->DumpIR();
-    string irStr = ss.str();
-    cout.rdbuf(cout_buf);
-    const char* str = irStr.c_str();
-    // 与 "-riscv" 相同
-    // 解析字符串 str, 得到 Koopa IR 程序
-    koopa_program_t program;
-    koopa_error_code_t ret = koopa_parse_from_string(str, &program);
-    assert(ret == KOOPA_EC_SUCCESS);  // 确保解析时没有出错
-    // 创建一个 raw program builder, 用来构建 raw program
-    koopa_raw_program_builder_t builder = koopa_new_raw_program_builder();
-    // 将 Koopa IR 程序转换为 raw program
-    koopa_raw_program_t raw = koopa_build_raw_program(builder, program);
-    // 释放 Koopa IR 程序占用的内存
-    koopa_delete_program(program);
+    // 在raw program上进行优化
+    optimize(raw);
 
-    cout.rdbuf(outFile.rdbuf()); 
-    // 处理 raw program
-    Visit(raw);
-    cout.rdbuf(cout_buf);
-    // 输出到标准输出，便于调试
-    Visit(raw);
+    if(string(mode) == "-koopa") {
+      string optStr = dump_raw(raw);
+      outFile << optStr;
+      cout << optStr << endl;
+    } else {
+      cout.rdbuf(outFile.rdbuf());
+      // 处理 raw program
+      Visit(raw);
+      cout.rdbuf(cout_buf);
+      // 输出到标准输出，便于调试
+      Visit(raw);
+    }
     // 处理完成, 释放 raw program builder 占用的内存
     // 注意, raw program 中所有的指针指向的内存均为 raw program builder 的内存
     // 所以不要在 raw program 处理完毕之前释放 builder
-    koopa_delete_raw_program_builder(builder);    
+    koopa_delete_raw_program_builder(builder);
   }
 
   outFile.close();
   return 0;
 }
-
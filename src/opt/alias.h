@@ -0,0 +1,214 @@
+#pragma once
+#include <map>
+#include "ir.h"
+
+// 别名分析
+// 指针都由alloc, 全局变量或指针参数经过getptr/getelemptr得到, 称它们为指针的基对象
+// 1. 不同的alloc/全局变量互不重叠; 函数的alloc不可能被指针参数指向
+// 2. 基对象相同时, 把地址写成 基对象 + Σ 系数 * 下标变量 + 常量偏移 (字节) 的线性形式,
+//    变量部分相同时比较常量偏移; 也沿相同形状的getelemptr链比较下标, 某一层常量下标不同则不重叠
+// 3. 过程间的实参事实: 指针形参在所有调用点上可能指向的基对象, 两个形参的集合不相交时不重叠,
+//    形参也不会指向集合之外的全局变量
+// 基本块参数上的指针 (如强度削弱产生的指针递推) 由创建它的优化登记基对象, 没有登记的可能指向任何对象
+
+// 登记过的基本块参数上的指针的基对象
+static std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> derived_pointers;
+
+inline void note_derived_pointer(koopa_raw_value_t param, koopa_raw_value_t base) { derived_pointers[param] = base; }
+
+// 指针的基对象: alloc, 全局变量, 函数参数, 其他情况 (如没有登记的基本块参数) 返回指针本身
+inline koopa_raw_value_t pointer_base(koopa_raw_value_t ptr) {
+  while (true) {
+    switch (ptr->kind.tag) {
+      case KOOPA_RVT_GET_PTR:
+        ptr = ptr->kind.data.get_ptr.src;
+        break;
+      case KOOPA_RVT_GET_ELEM_PTR:
+        ptr = ptr->kind.data.get_elem_ptr.src;
+        break;
+      case KOOPA_RVT_BLOCK_ARG_REF: {
+        auto it = derived_pointers.find(ptr);
+        if (it == derived_pointers.end()) return ptr;
+        ptr = it->second;
+        break;
+      }
+      default:
+        return ptr;
+    }
+  }
+}
+
+// 基对象是否是确定的内存对象 (alloc或全局变量)
+inline bool is_identified_object(koopa_raw_value_t base) {
+  return base->kind.tag == KOOPA_RVT_ALLOC || base->kind.tag == KOOPA_RVT_GLOBAL_ALLOC;
+}
+
+// 指针形参可能指向的基对象, 没有记录的形参可能指向任何对象
+static std::unordered_map<koopa_raw_value_t, std::unordered_set<koopa_raw_value_t>> param_targets;
+
+// 按所有调用点上的实参计算指针形参的事实, 在mem2reg之后、其他优化之前计算
+// 之后的内联、特化等变换只会让实参指向的对象更少, 事实一直是安全的; 新创建的形参没有记录
+inline void compute_param_targets(const std::vector<koopa_raw_function_t> &funcs) {
+  std::vector<koopa_raw_value_t> calls;
+  for (auto f : funcs) {
+    for (auto bb : func_blocks(f)) {
+      for (auto inst : bb_insts(bb)) {
+        if (inst->kind.tag != KOOPA_RVT_CALL || inst->kind.data.call.callee->bbs.len == 0) continue;
+        calls.push_back(inst);
+        // 被调用过的函数的指针形参从空集出发
+        for (auto p : slice_items<koopa_raw_value_t>(inst->kind.data.call.callee->params)) {
+          if (p->ty->tag == KOOPA_RTT_POINTER) param_targets[p];
+        }
+      }
+    }
+  }
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto call : calls) {
+      auto params = slice_items<koopa_raw_value_t>(call->kind.data.call.callee->params);
+      auto args = slice_items<koopa_raw_value_t>(call->kind.data.call.args);
+      for (size_t i = 0; i < args.size(); ++i) {
+        auto it = param_targets.find(params[i]);
+        if (it == param_targets.end()) continue;
+        auto base = pointer_base(args[i]);
+        auto from = param_targets.find(base);
+        if (is_identified_object(base)) {
+          changed |= it->second.insert(base).second;
+        } else if (from != param_targets.end()) {
+          if (from == it) continue;
+          for (auto b : from->second) changed |= it->second.insert(b).second;
+        } else {
+          param_targets.erase(it);
+          changed = true;
+        }
+      }
+    }
+  }
+}
+
+// 指针形参param可能指向基对象obj (alloc或全局变量)
+inline bool param_may_point_to(koopa_raw_value_t param, koopa_raw_value_t obj) {
+  auto it = param_targets.find(param);
+  return it == param_targets.end() || it->second.count(obj) != 0;
+}
+
+// 两个地址一定不同: 沿着相同的getelemptr链向上, 某一层的常量下标不同
+inline bool must_differ(koopa_raw_value_t a, koopa_raw_value_t b) {
+  while (a != b && a->kind.tag == KOOPA_RVT_GET_ELEM_PTR && b->kind.tag == KOOPA_RVT_GET_ELEM_PTR) {
+    auto ia = a->kind.data.get_elem_ptr.index, ib = b->kind.data.get_elem_ptr.index;
+    if (is_integer(ia) && is_integer(ib)) {
+      if (int_value(ia) != int_value(ib)) return true;
+    } else if (ia != ib) {
+      return false;
+    }
+    a = a->kind.data.get_elem_ptr.src;
+    b = b->kind.data.get_elem_ptr.src;
+  }
+  return false;
+}
+
+// 两个基对象可能重叠
+inline bool objects_may_alias(koopa_raw_value_t a, koopa_raw_value_t b) {
+  if (a == b) return true;
+  bool ia = is_identified_object(a), ib = is_identified_object(b);
+  if (ia && ib) return false;
+  bool pa = a->kind.tag == KOOPA_RVT_FUNC_ARG_REF, pb = b->kind.tag == KOOPA_RVT_FUNC_ARG_REF;
+  // alloc只在本函数中可见
+  if ((pa && b->kind.tag == KOOPA_RVT_ALLOC) || (pb && a->kind.tag == KOOPA_RVT_ALLOC)) return false;
+  if (pa && ib) return param_may_point_to(a, b);
+  if (pb && ia) return param_may_point_to(b, a);
+  if (pa && pb) {
+    auto ta = param_targets.find(a), tb = param_targets.find(b);
+    if (ta == param_targets.end() || tb == param_targets.end()) return true;
+    for (auto obj : ta->second) {
+      if (tb->second.count(obj)) return true;
+    }
+    return false;
+  }
+  return true;
+}
+
+// 地址的线性形式: 基对象 + Σ 系数 * 变量 + 常量偏移, 以字节计
+struct LinearAddress {
+  koopa_raw_value_t base;
+  std::map<koopa_raw_value_t, int64_t> terms;
+  int64_t offset = 0;
+  // 经过登记的基本块参数时, 相对基对象的偏移未知
+  bool exact = true;
+};
+
+// 把 下标 * 步长 加到线性形式上, 下标中加减、乘以常量的部分拆开
+inline void add_linear_index(LinearAddress &la, koopa_raw_value_t index, int64_t size) {
+  while (!is_integer(index) && index->kind.tag == KOOPA_RVT_BINARY) {
+    const auto &bin = index->kind.data.binary;
+    if (bin.op == KOOPA_RBO_ADD && is_integer(bin.rhs)) {
+      la.offset += size * int_value(bin.rhs);
+      index = bin.lhs;
+    } else if (bin.op == KOOPA_RBO_ADD && is_integer(bin.lhs)) {
+      la.offset += size * int_value(bin.lhs);
+      index = bin.rhs;
+    } else if (bin.op == KOOPA_RBO_SUB && is_integer(bin.rhs)) {
+      la.offset -= size * int_value(bin.rhs);
+      index = bin.lhs;
+    } else if (bin.op == KOOPA_RBO_MUL && is_integer(bin.rhs)) {
+      size *= int_value(bin.rhs);
+      index = bin.lhs;
+    } else if (bin.op == KOOPA_RBO_MUL && is_integer(bin.lhs)) {
+      size *= int_value(bin.lhs);
+      index = bin.rhs;
+    } else {
+      break;
+    }
+  }
+  if (is_integer(index)) {
+    la.offset += size * int_value(index);
+  } else if ((la.terms[index] += size) == 0) {
+    la.terms.erase(index);
+  }
+}
+
+inline LinearAddress linear_address(koopa_raw_value_t ptr) {
+  LinearAddress la;
+  while (true) {
+    switch (ptr->kind.tag) {
+      case KOOPA_RVT_GET_PTR:
+        // 步长都是结果指针指向的类型的大小
+        add_linear_index(la, ptr->kind.data.get_ptr.index, type_size(ptr->ty->data.pointer.base));
+        ptr = ptr->kind.data.get_ptr.src;
+        break;
+      case KOOPA_RVT_GET_ELEM_PTR:
+        add_linear_index(la, ptr->kind.data.get_elem_ptr.index, type_size(ptr->ty->data.pointer.base));
+        ptr = ptr->kind.data.get_elem_ptr.src;
+        break;
+      case KOOPA_RVT_BLOCK_ARG_REF: {
+        auto it = derived_pointers.find(ptr);
+        if (it == derived_pointers.end()) {
+          la.base = ptr;
+          return la;
+        }
+        la.exact = false;
+        ptr = it->second;
+        break;
+      }
+      default:
+        la.base = ptr;
+        return la;
+    }
+  }
+}
+
+// 两个地址指向的对象可能重叠
+// same_values: 两个地址中相同的变量取相同的值 (如同一段直线代码中求值); 比较循环不同迭代中的地址时为false,
+// 这时只比较基对象和常量下标
+inline bool may_alias(koopa_raw_value_t a, koopa_raw_value_t b, bool same_values = true) {
+  if (a == b) return true;
+  auto la = linear_address(a), lb = linear_address(b);
+  if (!objects_may_alias(la.base, lb.base)) return false;
+  if (la.base != lb.base) return true;
+  if (must_differ(a, b)) return false;
+  if (!same_values || !la.exact || !lb.exact || la.terms != lb.terms) return true;
+  // 变量部分相同, 比较两段 [偏移, 偏移 + 大小) 是否相交
+  int64_t sa = type_size(a->ty->data.pointer.base), sb = type_size(b->ty->data.pointer.base);
+  return la.offset < lb.offset + sb && lb.offset < la.offset + sa;
+}
@@ -0,0 +1,150 @@
+#pragma once
+#include "ir.h"
+
+// 调用图: 节点是函数, 每条call指令是一条从调用者到被调用者的边
+// 库函数只有声明 (bbs为空), 标记为外部函数
+// 用Tarjan算法求强连通分量, 分量的输出顺序正好是自底向上的 (被调用者所在的分量在前)
+// 过程间的优化按这个顺序处理, 分析调用者时被调用者的结果已经算好
+
+struct CallSite {
+  koopa_raw_value_t call;
+  koopa_raw_function_t caller;
+};
+
+struct CallGraphNode {
+  koopa_raw_function_t func = nullptr;
+  // 库函数
+  bool external = false;
+  // 在调用图的环上 (直接或间接地调用自己)
+  bool recursive = false;
+  // 直接调用自己
+  bool self_recursive = false;
+  // 所在强连通分量的编号, 编号小的分量先处理
+  int scc = -1;
+  // 调用的函数 (去重, 按第一次出现的顺序) 和调用它的call
+  std::vector<koopa_raw_function_t> callees;
+  std::vector<CallSite> callers;
+};
+
+class CallGraph {
+ public:
+  // 源代码顺序的所有函数, 包括库函数
+  std::vector<koopa_raw_function_t> funcs;
+  std::unordered_map<koopa_raw_function_t, CallGraphNode> nodes;
+  // 自底向上的强连通分量
+  std::vector<std::vector<koopa_raw_function_t>> sccs;
+
+  explicit CallGraph(const koopa_raw_program_t &program) {
+    funcs = slice_items<koopa_raw_function_t>(program.funcs);
+    for (auto f : funcs) {
+      auto &n = nodes[f];
+      n.func = f;
+      n.external = f->bbs.len == 0;
+    }
+    for (auto f : funcs) {
+      auto &n = nodes[f];
+      std::unordered_set<koopa_raw_function_t> seen;
+      for (auto bb : func_blocks(f)) {
+        for (auto inst : bb_insts(bb)) {
+          if (inst->kind.tag != KOOPA_RVT_CALL) continue;
+          auto callee = inst->kind.data.call.callee;
+          if (seen.insert(callee).second) n.callees.push_back(callee);
+          if (callee == f) n.self_recursive = n.recursive = true;
+          nodes[callee].callers.push_back({inst, f});
+        }
+      }
+    }
+    for (auto f : funcs) {
+      if (!index.count(f)) strong_connect(f);
+    }
+  }
+
+  const CallGraphNode &node(koopa_raw_function_t f) const { return nodes.at(f); }
+
+  // 变换新建的函数 (如特化的副本) 自成一个分量, 它的call由调用者用add_call加入
+  // join不为空时加入join所在的分量 (如与原函数互相调用的记忆化包装函数), 分量中的函数都是递归的
+  void add_function(koopa_raw_function_t f, koopa_raw_function_t pos, koopa_raw_function_t join = nullptr) {
+    funcs.insert(std::find(funcs.begin(), funcs.end(), pos) + 1, f);
+    auto &n = nodes[f];
+    n.func = f;
+    if (join == nullptr) {
+      n.scc = sccs.size();
+      sccs.push_back({f});
+      return;
+    }
+    n.scc = nodes[join].scc;
+    sccs[n.scc].push_back(f);
+    for (auto g : sccs[n.scc]) nodes[g].recursive = true;
+  }
+
+  // 变换增删call指令时维护边, 强连通分量不变
+  void add_call(koopa_raw_value_t call, koopa_raw_function_t caller) {
+    auto callee = call->kind.data.call.callee;
+    auto &callees = nodes[caller].callees;
+    if (std::find(callees.begin(), callees.end(), callee) == callees.end()) callees.push_back(callee);
+    nodes[callee].callers.push_back({call, caller});
+  }
+  // 最后一个自调用被删除时 (如尾递归消除), 不在更大的环上的函数不再是递归函数
+  void remove_call(koopa_raw_value_t call) {
+    auto callee = call->kind.data.call.callee;
+    auto &n = nodes[callee];
+    koopa_raw_function_t caller = nullptr;
+    for (auto &s : n.callers) {
+      if (s.call == call) caller = s.caller;
+    }
+    n.callers.erase(std::remove_if(n.callers.begin(), n.callers.end(), [&](const CallSite &s) { return s.call == call; }),
+                    n.callers.end());
+    if (caller != callee) return;
+    for (auto &s : n.callers) {
+      if (s.caller == callee) return;
+    }
+    n.callees.erase(std::find(n.callees.begin(), n.callees.end(), callee));
+    n.self_recursive = false;
+    n.recursive = sccs[n.scc].size() > 1;
+  }
+
+  // 有函数体的函数, 被调用者在调用者之前; 同一分量内保持源代码顺序
+  std::vector<koopa_raw_function_t> bottom_up() const {
+    std::vector<koopa_raw_function_t> order;
+    for (auto &scc : sccs) {
+      for (auto f : funcs) {
+        if (!nodes.at(f).external && std::find(scc.begin(), scc.end(), f) != scc.end()) order.push_back(f);
+      }
+    }
+    return order;
+  }
+
+ private:
+  std::unordered_map<koopa_raw_function_t, int> index, lowlink;
+  std::vector<koopa_raw_function_t> stack;
+  std::unordered_set<koopa_raw_function_t> on_stack;
+  int clock = 0;
+
+  void strong_connect(koopa_raw_function_t f) {
+    index[f] = lowlink[f] = clock++;
+    stack.push_back(f);
+    on_stack.insert(f);
+    for (auto callee : nodes[f].callees) {
+      if (!index.count(callee)) {
+        strong_connect(callee);
+        lowlink[f] = std::min(lowlink[f], lowlink[callee]);
+      } else if (on_stack.count(callee)) {
+        lowlink[f] = std::min(lowlink[f], index[callee]);
+      }
+    }
+    if (lowlink[f] != index[f]) return;
+    std::vector<koopa_raw_function_t> scc;
+    koopa_raw_function_t g;
+    do {
+      g = stack.back();
+      stack.pop_back();
+      on_stack.erase(g);
+      nodes[g].scc = sccs.size();
+      scc.push_back(g);
+    } while (g != f);
+    if (scc.size() > 1) {
+      for (auto h : scc) nodes[h].recursive = true;
+    }
+    sccs.push_back(scc);
+  }
+};
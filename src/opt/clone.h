@@ -0,0 +1,86 @@
+#pragma once
+#include "ir.h"
+#include "alias.h"
+
+// 复制基本块: 块内定义的值和块之间的跳转都指向副本, 其他的值保持不变
+
+struct CloneMap {
+  std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> values;
+  std::unordered_map<koopa_raw_basic_block_t, koopa_raw_basic_block_t> blocks;
+
+  koopa_raw_value_t operator()(koopa_raw_value_t v) const {
+    auto it = values.find(v);
+    return it == values.end() ? v : it->second;
+  }
+  koopa_raw_basic_block_t operator()(koopa_raw_basic_block_t bb) const {
+    auto it = blocks.find(bb);
+    return it == blocks.end() ? bb : it->second;
+  }
+};
+
+// 浅复制一条指令, 实参列表复制为新的slice, 操作数尚未映射
+inline koopa_raw_value_data_t *copy_inst(koopa_raw_value_t inst) {
+  auto v = new_value(inst->ty, inst->kind.tag);
+  v->kind = inst->kind;
+  auto copy_slice = [](koopa_raw_slice_t &slice) {
+    slice = make_slice(slice_items<koopa_raw_value_t>(slice), KOOPA_RSIK_VALUE);
+  };
+  switch (v->kind.tag) {
+    case KOOPA_RVT_BRANCH:
+      copy_slice(v->kind.data.branch.true_args);
+      copy_slice(v->kind.data.branch.false_args);
+      break;
+    case KOOPA_RVT_JUMP:
+      copy_slice(v->kind.data.jump.args);
+      break;
+    case KOOPA_RVT_CALL:
+      copy_slice(v->kind.data.call.args);
+      break;
+    default:
+      break;
+  }
+  return v;
+}
+
+// 把指令的操作数和跳转目标按map替换
+inline void remap_inst(koopa_raw_value_t inst, const CloneMap &map) {
+  map_operands(inst, [&](koopa_raw_value_t op) { return map(op); });
+  for (int e = 0; e < edge_count(inst); ++e) {
+    edge_target(inst, e) = map(edge_target(inst, e));
+  }
+}
+
+// 复制bbs, 新的映射记录在map中 (map中已有的映射也会生效), 返回副本
+inline std::vector<koopa_raw_basic_block_t> clone_blocks(const std::vector<koopa_raw_basic_block_t> &bbs, CloneMap &map) {
+  std::vector<koopa_raw_basic_block_t> copies;
+  for (auto bb : bbs) {
+    auto copy = make_block(bb->name + 1);
+    std::vector<koopa_raw_value_t> params;
+    for (auto p : bb_params(bb)) {
+      auto np = make_block_arg(p->ty, params.size());
+      map.values[p] = np;
+      params.push_back(np);
+    }
+    set_bb_params(copy, params);
+    std::vector<koopa_raw_value_t> insts;
+    for (auto inst : bb_insts(bb)) {
+      auto ni = copy_inst(inst);
+      map.values[inst] = ni;
+      insts.push_back(ni);
+    }
+    set_bb_insts(copy, insts);
+    map.blocks[bb] = copy;
+    copies.push_back(copy);
+  }
+  for (auto copy : copies) {
+    for (auto inst : bb_insts(copy)) remap_inst(inst, map);
+  }
+  // 登记过基对象的基本块参数, 副本的基对象是原来的基对象的映射
+  for (auto bb : bbs) {
+    for (auto p : bb_params(bb)) {
+      auto it = derived_pointers.find(p);
+      if (it != derived_pointers.end()) note_derived_pointer(map(p), pointer_base(map(it->second)));
+    }
+  }
+  return copies;
+}
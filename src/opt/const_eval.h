@@ -0,0 +1,217 @@
+#pragma once
+#include <map>
+#include "ir.h"
+#include "callgraph.h"
+
+// 编译期求值: 实参全是常量的call在编译器中用Koopa IR解释器执行, 成功时用返回值替换call
+// 解释器只有被调用的函数自己的栈内存, 遇到库函数、全局变量、undef、读未初始化的内存、
+// 越界访问或除数为0时放弃, 因此能执行完的函数一定是纯函数, 结果只由实参决定
+// 运算与生成的RISC-V代码一样按32位补码回绕 (fold_binary)
+// 每次求值和整个程序的步数、内存、调用深度都有上限, 编译时间可以预期
+// 形参都是i32的调用的结果只取决于实参, 嵌套的调用也记录下来, 递归的fib等只需线性的步数
+
+static const long kEvalMaxSteps = 2000000;
+static const long kEvalTotalSteps = 10000000;
+static const size_t kEvalMaxMemory = 1 << 18;
+static const int kEvalMaxDepth = 1000;
+
+class Interpreter {
+ public:
+  // 执行f, 成功时返回true, 结果在result中
+  bool run(koopa_raw_function_t f, const std::vector<int32_t> &args, int32_t &result) {
+    if (total_steps >= kEvalTotalSteps) return false;
+    steps = 0;
+    depth = 0;
+    ok = true;
+    // 地址0不是合法的地址
+    memory.assign(1, 0);
+    defined.assign(1, false);
+    result = call(f, args);
+    total_steps += steps;
+    return ok;
+  }
+
+ private:
+  typedef std::pair<koopa_raw_function_t, std::vector<int32_t>> Key;
+
+  long steps = 0, total_steps = 0;
+  int depth = 0;
+  bool ok = true;
+  // 按字编址的内存, 指针的值是字节地址
+  std::vector<int32_t> memory;
+  std::vector<bool> defined;
+  std::map<Key, int32_t> memo;
+
+  int32_t fail() {
+    ok = false;
+    return 0;
+  }
+
+  // 形参都是i32时, 函数访问不到调用者的内存
+  static bool only_int_params(koopa_raw_function_t f) {
+    for (auto p : slice_items<koopa_raw_value_t>(f->params)) {
+      if (p->ty->tag != KOOPA_RTT_INT32) return false;
+    }
+    return true;
+  }
+
+  int32_t call(koopa_raw_function_t f, const std::vector<int32_t> &args) {
+    if (f->bbs.len == 0 || depth >= kEvalMaxDepth) return fail();
+    bool cacheable = only_int_params(f);
+    if (cacheable) {
+      auto it = memo.find({f, args});
+      if (it != memo.end()) return it->second;
+    }
+    ++depth;
+    size_t mark = memory.size();
+    std::unordered_map<koopa_raw_value_t, int32_t> env;
+    auto params = slice_items<koopa_raw_value_t>(f->params);
+    for (size_t i = 0; i < params.size(); ++i) env[params[i]] = args[i];
+    auto value = [&](koopa_raw_value_t v) -> int32_t {
+      if (is_integer(v)) return int_value(v);
+      auto it = env.find(v);
+      return it == env.end() ? fail() : it->second;
+    };
+    auto word = [&](int32_t addr) -> size_t {
+      if (addr <= 0 || addr % 4 != 0 || size_t(addr / 4) >= memory.size()) return fail();
+      return addr / 4;
+    };
+
+    int32_t result = 0;
+    auto bb = reinterpret_cast<koopa_raw_basic_block_t>(f->bbs.buffer[0]);
+    while (ok && bb != nullptr) {
+      koopa_raw_basic_block_t next = nullptr;
+      for (auto inst : bb_insts(bb)) {
+        if (++steps > kEvalMaxSteps) fail();
+        if (!ok) break;
+        const auto &kind = inst->kind;
+        switch (kind.tag) {
+          case KOOPA_RVT_ALLOC: {
+            size_t words = (type_size(inst->ty->data.pointer.base) + 3) / 4;
+            if (memory.size() + words > kEvalMaxMemory) {
+              fail();
+              break;
+            }
+            env[inst] = int32_t(memory.size() * 4);
+            memory.resize(memory.size() + words, 0);
+            defined.resize(memory.size(), false);
+            break;
+          }
+          case KOOPA_RVT_LOAD: {
+            size_t w = word(value(kind.data.load.src));
+            if (ok && !defined[w]) fail();
+            if (ok) env[inst] = memory[w];
+            break;
+          }
+          case KOOPA_RVT_STORE: {
+            size_t w = word(value(kind.data.store.dest));
+            int32_t v = value(kind.data.store.value);
+            if (ok) {
+              memory[w] = v;
+              defined[w] = true;
+            }
+            break;
+          }
+          case KOOPA_RVT_GET_PTR: {
+            int size = type_size(kind.data.get_ptr.src->ty->data.pointer.base);
+            env[inst] = int32_t(uint32_t(value(kind.data.get_ptr.src)) + uint32_t(value(kind.data.get_ptr.index)) * size);
+            break;
+          }
+          case KOOPA_RVT_GET_ELEM_PTR: {
+            int size = type_size(kind.data.get_elem_ptr.src->ty->data.pointer.base->data.array.base);
+            env[inst] = int32_t(uint32_t(value(kind.data.get_elem_ptr.src)) +
+                                uint32_t(value(kind.data.get_elem_ptr.index)) * size);
+            break;
+          }
+          case KOOPA_RVT_BINARY: {
+            int32_t r;
+            int32_t lhs = value(kind.data.binary.lhs), rhs = value(kind.data.binary.rhs);
+            if (!fold_binary(kind.data.binary.op, lhs, rhs, r)) fail();
+            env[inst] = r;
+            break;
+          }
+          case KOOPA_RVT_CALL: {
+            std::vector<int32_t> call_args;
+            for (auto arg : slice_items<koopa_raw_value_t>(kind.data.call.args)) call_args.push_back(value(arg));
+            if (ok) env[inst] = call(kind.data.call.callee, call_args);
+            break;
+          }
+          case KOOPA_RVT_BRANCH:
+          case KOOPA_RVT_JUMP: {
+            // 先求出所有实参再赋给目标块的参数
+            int e = kind.tag == KOOPA_RVT_JUMP ? 0 : value(kind.data.branch.cond) != 0 ? 0 : 1;
+            std::vector<int32_t> vals;
+            for (auto arg : slice_items<koopa_raw_value_t>(edge_args(inst, e))) vals.push_back(value(arg));
+            next = edge_target(inst, e);
+            auto target_params = bb_params(next);
+            for (size_t i = 0; i < vals.size(); ++i) env[target_params[i]] = vals[i];
+            break;
+          }
+          case KOOPA_RVT_RETURN:
+            if (kind.data.ret.value != nullptr) result = value(kind.data.ret.value);
+            break;
+          default:
+            // undef, 全局变量等
+            fail();
+            break;
+        }
+      }
+      bb = next;
+    }
+    memory.resize(mark);
+    defined.resize(mark);
+    --depth;
+    if (ok && cacheable) memo[{f, args}] = result;
+    return result;
+  }
+};
+
+// 对func中实参全是常量的call求值
+class CallEvaluator {
+ public:
+  std::vector<std::string> remarks;
+
+  explicit CallEvaluator(CallGraph &g) : cg(g) {}
+
+  // 返回替换掉的call数量
+  int run(koopa_raw_function_t func) {
+    remarks.clear();
+    std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> repl;
+    for (auto bb : func_blocks(func)) {
+      std::vector<koopa_raw_value_t> kept;
+      for (auto inst : bb_insts(bb)) {
+        int32_t result;
+        if (inst->kind.tag == KOOPA_RVT_CALL && evaluate(func, inst, result)) {
+          cg.remove_call(inst);
+          if (inst->ty->tag != KOOPA_RTT_UNIT) repl[inst] = make_integer(result);
+          continue;
+        }
+        kept.push_back(inst);
+      }
+      set_bb_insts(bb, kept);
+    }
+    replace_uses(func, repl);
+    return remarks.size();
+  }
+
+ private:
+  CallGraph &cg;
+  Interpreter interp;
+
+  bool evaluate(koopa_raw_function_t func, koopa_raw_value_t call, int32_t &result) {
+    auto callee = call->kind.data.call.callee;
+    const auto &node = cg.node(callee);
+    if (node.external || node.scc == cg.node(func).scc) return false;
+    std::vector<int32_t> args;
+    std::string text;
+    for (auto arg : slice_items<koopa_raw_value_t>(call->kind.data.call.args)) {
+      if (!is_integer(arg)) return false;
+      args.push_back(int_value(arg));
+      text += (text.empty() ? "" : ", ") + std::to_string(int_value(arg));
+    }
+    if (!interp.run(callee, args, result)) return false;
+    text = std::string(callee->name) + "(" + text + ")";
+    remarks.push_back(call->ty->tag == KOOPA_RTT_UNIT ? "removed " + text : text + " = " + std::to_string(result));
+    return true;
+  }
+};
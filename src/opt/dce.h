@@ -0,0 +1,127 @@
+#pragma once
+#include "ir.h"
+#include "modref.h"
+
+// 激进的死代码删除: 只把store, 有副作用的call, 终结指令当作根, 从根出发沿操作数标记活跃的值
+// 基本块参数只有在活跃时, 传给它的实参才是活跃的, 所以只在环上互相传递的值也会被删除
+
+// 沿getptr/getelemptr找到指针的来源, 不是alloc时返回nullptr
+inline koopa_raw_value_t local_root(koopa_raw_value_t ptr) {
+  while (true) {
+    switch (ptr->kind.tag) {
+      case KOOPA_RVT_ALLOC:
+        return ptr;
+      case KOOPA_RVT_GET_PTR:
+        ptr = ptr->kind.data.get_ptr.src;
+        break;
+      case KOOPA_RVT_GET_ELEM_PTR:
+        ptr = ptr->kind.data.get_elem_ptr.src;
+        break;
+      default:
+        return nullptr;
+    }
+  }
+}
+
+// 函数没有副作用: 不写调用者可见的内存, 也没有输入输出 (见modref.h的过程间分析)
+inline bool is_side_effect_free(koopa_raw_function_t func) { return modref(func).readonly(); }
+
+class DCE {
+ public:
+  explicit DCE(koopa_raw_function_t f) : func(f) {}
+
+  // 返回删除的指令数量
+  int run() {
+    auto bbs = func_blocks(func);
+    for (auto bb : bbs) {
+      for (auto inst : bb_insts(bb)) {
+        if (inst->kind.tag == KOOPA_RVT_JUMP || inst->kind.tag == KOOPA_RVT_BRANCH) {
+          for (int e = 0; e < edge_count(inst); ++e) {
+            auto params = bb_params(edge_target(inst, e));
+            auto args = slice_items<koopa_raw_value_t>(edge_args(inst, e));
+            for (size_t i = 0; i < args.size(); ++i) {
+              incoming[params[i]].push_back(args[i]);
+            }
+          }
+          if (inst->kind.tag == KOOPA_RVT_BRANCH) mark(inst->kind.data.branch.cond);
+          live.insert(inst);
+        } else if (is_root(inst)) {
+          mark(inst);
+        }
+      }
+    }
+    while (!worklist.empty()) {
+      auto v = worklist.back();
+      worklist.pop_back();
+      if (v->kind.tag == KOOPA_RVT_BLOCK_ARG_REF) {
+        for (auto arg : incoming[v]) mark(arg);
+      } else {
+        for (auto op : operands(v)) mark(op);
+      }
+    }
+
+    int cnt = 0;
+    for (auto bb : bbs) {
+      // 删除死参数和对应的实参
+      auto params = bb_params(bb);
+      std::vector<bool> keep(params.size());
+      std::vector<koopa_raw_value_t> kept_params;
+      for (size_t i = 0; i < params.size(); ++i) {
+        keep[i] = live.count(params[i]) != 0;
+        if (keep[i]) kept_params.push_back(params[i]);
+      }
+      if (kept_params.size() != params.size()) {
+        set_bb_params(bb, kept_params);
+        for (auto pred : bbs) {
+          auto term = terminator(pred);
+          for (int e = 0; e < edge_count(term); ++e) {
+            if (edge_target(term, e) != bb) continue;
+            auto args = slice_items<koopa_raw_value_t>(edge_args(term, e));
+            std::vector<koopa_raw_value_t> kept_args;
+            for (size_t i = 0; i < args.size(); ++i) {
+              if (keep[i]) kept_args.push_back(args[i]);
+            }
+            edge_args(term, e) = make_slice(kept_args, KOOPA_RSIK_VALUE);
+          }
+        }
+      }
+    }
+    for (auto bb : bbs) {
+      std::vector<koopa_raw_value_t> kept;
+      for (auto inst : bb_insts(bb)) {
+        if (live.count(inst)) {
+          kept.push_back(inst);
+        } else {
+          ++cnt;
+        }
+      }
+      set_bb_insts(bb, kept);
+    }
+    return cnt;
+  }
+
+ private:
+  koopa_raw_function_t func;
+  std::unordered_set<koopa_raw_value_t> live;
+  std::vector<koopa_raw_value_t> worklist;
+  std::unordered_map<koopa_raw_value_t, std::vector<koopa_raw_value_t>> incoming;
+
+  bool is_root(koopa_raw_value_t inst) {
+    switch (inst->kind.tag) {
+      case KOOPA_RVT_STORE:
+      case KOOPA_RVT_RETURN:
+        return true;
+      case KOOPA_RVT_CALL:
+        return !is_side_effect_free(inst->kind.data.call.callee);
+      default:
+        return false;
+    }
+  }
+
+  void mark(koopa_raw_value_t v) {
+    if (!is_local_value(v)) return;
+    if (live.insert(v).second) worklist.push_back(v);
+  }
+};
+
+inline int dce(koopa_raw_function_t func) { return DCE(func).run(); }
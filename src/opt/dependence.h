@@ -0,0 +1,204 @@
+#pragma once
+#include <map>
+#include "ir.h"
+#include "alias.h"
+
+// 一对嵌套循环中访存之间的依赖测试
+// 下标表示为线性形式 coef[0]*x0 + coef[1]*x1 + sum(系数 * 不变量) + c, x0/x1是外层/内层循环的归纳变量
+// 两个访问在迭代 (x0, x1) 和 (y0, y1) 访问同一元素, 要求每一维的下标相等:
+// 1. GCD测试: 各归纳变量系数的最大公约数不整除常数差时无整数解
+// 2. Banerjee测试: 在给定的方向 (x < y 或 x > y) 和取值范围下, 左边的取值范围不包含常数差时无解
+// 任何一维无解就不存在这个方向上的依赖
+
+struct LinearForm {
+  int64_t coef[2] = {0, 0};
+  int64_t c = 0;
+  std::map<koopa_raw_value_t, int64_t> syms;
+};
+
+// 一次load/store, 地址为基对象经过若干层getptr/getelemptr得到
+struct Access {
+  koopa_raw_value_t inst;
+  bool is_store;
+  koopa_raw_value_t addr;
+  koopa_raw_value_t base;
+  // 由外到内各层的下标和每层元素的大小, affine为false时下标不全是线性形式
+  std::vector<LinearForm> subs;
+  std::vector<int> sizes;
+  bool affine;
+};
+
+// 归纳变量的取值范围 [lo, hi], known为false时视为无界
+struct IVRange {
+  bool known = false;
+  int64_t lo = 0, hi = 0;
+};
+
+class DependenceAnalysis {
+ public:
+  // ivs: 外层和内层循环的归纳变量, is_invariant判断值在这对循环中是否不变
+  DependenceAnalysis(koopa_raw_value_t outer_iv, koopa_raw_value_t inner_iv,
+                     const std::function<bool(koopa_raw_value_t)> &inv)
+      : is_invariant(inv) {
+    ivs[0] = outer_iv;
+    ivs[1] = inner_iv;
+  }
+
+  bool linear(koopa_raw_value_t v, LinearForm &r) {
+    r = LinearForm();
+    if (is_integer(v)) {
+      r.c = int_value(v);
+      return true;
+    }
+    for (int k = 0; k < 2; ++k) {
+      if (v == ivs[k]) {
+        r.coef[k] = 1;
+        return true;
+      }
+    }
+    if (is_invariant(v)) {
+      if (v->ty->tag != KOOPA_RTT_INT32) return false;
+      r.syms[v] = 1;
+      return true;
+    }
+    if (v->kind.tag != KOOPA_RVT_BINARY) return false;
+    const auto &b = v->kind.data.binary;
+    LinearForm x, y;
+    if (!linear(b.lhs, x) || !linear(b.rhs, y)) return false;
+    switch (b.op) {
+      case KOOPA_RBO_ADD:
+      case KOOPA_RBO_SUB: {
+        int64_t sign = b.op == KOOPA_RBO_ADD ? 1 : -1;
+        r = x;
+        for (int k = 0; k < 2; ++k) r.coef[k] += sign * y.coef[k];
+        r.c += sign * y.c;
+        for (auto &[s, c] : y.syms) r.syms[s] += sign * c;
+        return true;
+      }
+      case KOOPA_RBO_MUL: {
+        auto is_const = [](const LinearForm &f) { return !f.coef[0] && !f.coef[1] && f.syms.empty(); };
+        if (is_const(x)) std::swap(x, y);
+        if (!is_const(y)) return false;
+        r = x;
+        for (int k = 0; k < 2; ++k) r.coef[k] *= y.c;
+        r.c *= y.c;
+        for (auto &[s, c] : r.syms) c *= y.c;
+        return true;
+      }
+      default:
+        return false;
+    }
+  }
+
+  Access access(koopa_raw_value_t inst) {
+    Access a;
+    a.inst = inst;
+    a.is_store = inst->kind.tag == KOOPA_RVT_STORE;
+    a.addr = a.is_store ? inst->kind.data.store.dest : inst->kind.data.load.src;
+    a.affine = true;
+    auto ptr = a.addr;
+    while (ptr->kind.tag == KOOPA_RVT_GET_PTR || ptr->kind.tag == KOOPA_RVT_GET_ELEM_PTR) {
+      bool gep = ptr->kind.tag == KOOPA_RVT_GET_ELEM_PTR;
+      auto index = gep ? ptr->kind.data.get_elem_ptr.index : ptr->kind.data.get_ptr.index;
+      // 每层下标的步长都是结果指针指向的类型的大小
+      a.sizes.insert(a.sizes.begin(), type_size(ptr->ty->data.pointer.base));
+      LinearForm f;
+      a.affine &= linear(index, f);
+      a.subs.insert(a.subs.begin(), f);
+      ptr = gep ? ptr->kind.data.get_elem_ptr.src : ptr->kind.data.get_ptr.src;
+    }
+    a.base = ptr;
+    return a;
+  }
+
+  // 是否可能存在 a 在迭代x、b 在迭代y 访问同一元素, 且各层的方向为dir (-1: x < y, 1: x > y, 0: 任意)
+  bool may_depend(const Access &a, const Access &b, const int dir[2], const IVRange range[2]) {
+    if (!may_alias(a.addr, b.addr, false)) return false;
+    if (!a.affine || !b.affine || a.base != b.base || a.subs.size() != b.subs.size()) return true;
+    for (size_t d = 0; d < a.subs.size(); ++d) {
+      if (a.sizes[d] != b.sizes[d]) return true;
+      if (!dimension_may_equal(a.subs[d], b.subs[d], dir, range)) return false;
+    }
+    return true;
+  }
+
+ private:
+  koopa_raw_value_t ivs[2];
+  std::function<bool(koopa_raw_value_t)> is_invariant;
+
+  // 取值范围, 带无界标记
+  struct Bound {
+    bool lo_inf = false, hi_inf = false;
+    int64_t lo = 0, hi = 0;
+  };
+
+  static int64_t gcd(int64_t a, int64_t b) {
+    a = a < 0 ? -a : a;
+    b = b < 0 ? -b : b;
+    while (b) {
+      a %= b;
+      std::swap(a, b);
+    }
+    return a;
+  }
+
+  // a*x - b*y 的取值范围, dir < 0 时 x < y, dir > 0 时 x > y, dir == 0 时x, y独立; 返回false表示不存在这样的x, y
+  static bool term_bound(int64_t a, int64_t b, int dir, const IVRange &r, Bound &out) {
+    if (r.known) {
+      if (dir != 0 && r.hi - r.lo < 1) return false;
+      std::vector<std::pair<int64_t, int64_t>> points;
+      if (dir < 0) {
+        points = {{r.lo, r.lo + 1}, {r.hi - 1, r.hi}, {r.lo, r.hi}};
+      } else if (dir > 0) {
+        points = {{r.lo + 1, r.lo}, {r.hi, r.hi - 1}, {r.hi, r.lo}};
+      } else {
+        points = {{r.lo, r.lo}, {r.lo, r.hi}, {r.hi, r.lo}, {r.hi, r.hi}};
+      }
+      out.lo = out.hi = a * points[0].first - b * points[0].second;
+      for (auto [x, y] : points) {
+        int64_t f = a * x - b * y;
+        if (f < out.lo) out.lo = f;
+        if (f > out.hi) out.hi = f;
+      }
+      return true;
+    }
+    // 无界时只有 a == b 才有一侧的界: x < y 时 a*x - b*y = -b*(y-x), y-x >= 1
+    if (dir == 0 || a != b) {
+      out.lo_inf = out.hi_inf = !(a == 0 && b == 0);
+      return true;
+    }
+    int64_t s = dir < 0 ? -b : b;
+    if (s > 0) {
+      out.lo = s;
+      out.hi_inf = true;
+    } else if (s < 0) {
+      out.hi = s;
+      out.lo_inf = true;
+    }
+    return true;
+  }
+
+  bool dimension_may_equal(const LinearForm &x, const LinearForm &y, const int dir[2], const IVRange range[2]) {
+    // 不变量部分不同时无法比较
+    std::map<koopa_raw_value_t, int64_t> diff = x.syms;
+    for (auto &[s, c] : y.syms) diff[s] -= c;
+    for (auto &[s, c] : diff) {
+      if (c != 0) return true;
+    }
+    // x.coef * xs - y.coef * ys = y.c - x.c
+    int64_t rhs = y.c - x.c;
+    int64_t g = gcd(gcd(x.coef[0], y.coef[0]), gcd(x.coef[1], y.coef[1]));
+    if (g == 0) return rhs == 0;
+    if (rhs % g != 0) return false;
+    Bound total;
+    for (int k = 0; k < 2; ++k) {
+      Bound t;
+      if (!term_bound(x.coef[k], y.coef[k], dir[k], range[k], t)) return false;
+      total.lo_inf |= t.lo_inf;
+      total.hi_inf |= t.hi_inf;
+      total.lo += t.lo;
+      total.hi += t.hi;
+    }
+    return (total.lo_inf || total.lo <= rhs) && (total.hi_inf || rhs <= total.hi);
+  }
+};
@@ -0,0 +1,190 @@
+#pragma once
+#include "ir.h"
+#include "dce.h"
+#include "alias.h"
+
+// 局部内存的死存储删除
+// 只处理地址没有逃逸的alloc (只作为load/store的地址和getptr/getelemptr的基址), 它们不会被调用的函数读写
+// 逆向数据流 (按alloc划分内存, 相当于一个简化的memory SSA): 一个store是死的, 当且仅当从它出发的
+// 所有路径上, 同一地址在被读取之前就被覆盖, 或者函数已经返回
+
+class DSE {
+ public:
+  explicit DSE(koopa_raw_function_t f) : func(f) {}
+
+  // 返回删除的store数量
+  int run() {
+    find_locals();
+    if (roots.empty()) return 0;
+    CFG cfg(func);
+    solve(cfg);
+    std::unordered_set<koopa_raw_value_t> dead;
+    for (auto bb : cfg.rpo) {
+      State state = out_state(cfg, bb);
+      auto insts = bb_insts(bb);
+      for (auto it = insts.rbegin(); it != insts.rend(); ++it) {
+        if (transfer(state, *it)) dead.insert(*it);
+      }
+    }
+    if (dead.empty()) return 0;
+    for (auto bb : func_blocks(func)) {
+      std::vector<koopa_raw_value_t> kept;
+      for (auto inst : bb_insts(bb)) {
+        if (dead.count(inst) == 0) kept.push_back(inst);
+      }
+      set_bb_insts(bb, kept);
+    }
+    return dead.size();
+  }
+
+ private:
+  // 死地址集合: roots中的alloc整个都是死的, addrs中的地址是死的
+  struct State {
+    bool top = false;
+    std::unordered_set<koopa_raw_value_t> roots, addrs;
+  };
+
+  koopa_raw_function_t func;
+  // 地址 -> 它指向的未逃逸alloc
+  std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> root_of;
+  std::unordered_set<koopa_raw_value_t> roots;
+  // 每个alloc中被store写过的地址
+  std::unordered_map<koopa_raw_value_t, std::vector<koopa_raw_value_t>> stored;
+  std::unordered_map<koopa_raw_basic_block_t, State> in;
+
+  void find_locals() {
+    std::unordered_set<koopa_raw_value_t> escaped;
+    for (auto bb : func_blocks(func)) {
+      for (auto inst : bb_insts(bb)) {
+        auto root = local_root(inst);
+        if (root != nullptr) root_of[inst] = root;
+        if (inst->kind.tag == KOOPA_RVT_ALLOC) roots.insert(inst);
+        // 地址被当作值使用就视为逃逸
+        auto escape = [&](koopa_raw_value_t v) {
+          auto r = local_root(v);
+          if (r != nullptr) escaped.insert(r);
+        };
+        switch (inst->kind.tag) {
+          case KOOPA_RVT_LOAD:
+          case KOOPA_RVT_GET_PTR:
+          case KOOPA_RVT_GET_ELEM_PTR:
+          case KOOPA_RVT_ALLOC:
+            break;
+          case KOOPA_RVT_STORE:
+            escape(inst->kind.data.store.value);
+            if (auto r = local_root(inst->kind.data.store.dest)) {
+              stored[r].push_back(inst->kind.data.store.dest);
+            }
+            break;
+          default:
+            for (auto op : operands(inst)) escape(op);
+            break;
+        }
+      }
+    }
+    for (auto r : escaped) roots.erase(r);
+  }
+
+  bool is_dead(const State &s, koopa_raw_value_t addr) {
+    if (s.top) return true;
+    auto root = root_of[addr];
+    return s.roots.count(root) || s.addrs.count(addr);
+  }
+
+  // 逆向经过inst, 返回inst是否是死存储
+  bool transfer(State &s, koopa_raw_value_t inst) {
+    if (inst->kind.tag == KOOPA_RVT_STORE) {
+      auto dest = inst->kind.data.store.dest;
+      auto it = root_of.find(dest);
+      if (it == root_of.end() || roots.count(it->second) == 0) return false;
+      bool dead = is_dead(s, dest);
+      if (!s.top) s.addrs.insert(dest);
+      return dead;
+    }
+    if (inst->kind.tag == KOOPA_RVT_LOAD) {
+      auto it = root_of.find(inst->kind.data.load.src);
+      if (it == root_of.end()) return false;
+      auto root = it->second;
+      auto src = inst->kind.data.load.src;
+      if (s.top) {
+        s.top = false;
+        s.roots = roots;
+      }
+      // 整个alloc都是死的时, 把其中与读取地址不重叠的地址单独记下来
+      if (s.roots.erase(root)) {
+        for (auto a : stored[root]) {
+          if (must_differ(a, src)) s.addrs.insert(a);
+        }
+      }
+      // 读取之后, 这个alloc中可能与读取地址重叠的地址都不再是死的
+      for (auto a = s.addrs.begin(); a != s.addrs.end();) {
+        if (root_of[*a] == root && !must_differ(*a, src)) {
+          a = s.addrs.erase(a);
+        } else {
+          ++a;
+        }
+      }
+    }
+    return false;
+  }
+
+  // 对所有后继的入口状态取交
+  State out_state(const CFG &cfg, koopa_raw_basic_block_t bb) {
+    auto term = terminator(bb);
+    State out;
+    if (term->kind.tag == KOOPA_RVT_RETURN) {
+      out.top = true;
+      return out;
+    }
+    bool first = true;
+    for (auto s : cfg.succs.at(bb)) {
+      const State &other = in[s];
+      if (first) {
+        out = other;
+        first = false;
+        continue;
+      }
+      if (other.top) continue;
+      if (out.top) {
+        out = other;
+        continue;
+      }
+      State merged;
+      for (auto r : out.roots) {
+        if (other.roots.count(r)) merged.roots.insert(r);
+      }
+      for (auto a : out.addrs) {
+        if (is_dead(other, a)) merged.addrs.insert(a);
+      }
+      for (auto a : other.addrs) {
+        if (is_dead(out, a)) merged.addrs.insert(a);
+      }
+      out = std::move(merged);
+    }
+    return out;
+  }
+
+  static bool same_state(const State &a, const State &b) {
+    return a.top == b.top && a.roots == b.roots && a.addrs == b.addrs;
+  }
+
+  void solve(const CFG &cfg) {
+    // 最大不动点: 初始时所有状态都是TOP
+    for (auto bb : cfg.rpo) in[bb].top = true;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (auto it = cfg.rpo.rbegin(); it != cfg.rpo.rend(); ++it) {
+        State s = out_state(cfg, *it);
+        auto insts = bb_insts(*it);
+        for (auto i = insts.rbegin(); i != insts.rend(); ++i) transfer(s, *i);
+        if (!same_state(s, in[*it])) {
+          in[*it] = std::move(s);
+          changed = true;
+        }
+      }
+    }
+  }
+};
+
+inline int dse(koopa_raw_function_t func) { return DSE(func).run(); }
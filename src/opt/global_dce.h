@@ -0,0 +1,206 @@
+#pragma once
+#include "ir.h"
+#include "dce.h"
+
+// 全局的死代码删除, 在所有函数优化完之后执行
+// 1. 从main出发沿call求出可达的函数, 删除其余的函数和没有被调用的库函数声明
+// 2. 可达函数中没有被引用的全局变量被删除
+// 3. 函数 (main除外) 中没有使用的形参被删除, 每个调用点上对应的实参一起删除;
+//    只用于计算自调用的同一位置实参的形参也算没有使用
+// 4. 所有调用点都不使用返回值的函数改为没有返回值, 只用于计算自己的返回值的自调用结果也算没有使用
+// 删除实参和返回值后, 计算它们的指令在调用者和被调用者中都成为死代码, 再执行DCE
+
+class GlobalDCE {
+ public:
+  explicit GlobalDCE(const koopa_raw_program_t &p) : program(p) {}
+
+  int removed_funcs = 0, removed_globals = 0, removed_params = 0, removed_rets = 0;
+
+  // 返回main, 没有main时返回nullptr
+  koopa_raw_function_t run() {
+    auto funcs = slice_items<koopa_raw_function_t>(program.funcs);
+    koopa_raw_function_t main = nullptr;
+    for (auto f : funcs) {
+      if (strcmp(f->name, "@main") == 0) main = f;
+    }
+    if (main == nullptr) return nullptr;
+    find_reachable(main);
+
+    // 先删除返回值, 只用于计算返回值的形参随之变为没有使用
+    std::unordered_set<koopa_raw_function_t> changed;
+    for (auto f : order) {
+      if (f != main && f->bbs.len != 0 && remove_dead_ret(f)) {
+        dce(f);
+        changed.insert(f);
+      }
+    }
+    for (auto f : order) {
+      if (f != main && f->bbs.len != 0 && remove_dead_params(f)) changed.insert(f);
+    }
+    // 调用者中计算实参的指令也可能变成死代码
+    for (auto f : order) {
+      if (f->bbs.len != 0 && (changed.count(f) || calls_changed(f, changed))) dce(f);
+    }
+
+    std::vector<koopa_raw_function_t> kept;
+    for (auto f : funcs) {
+      if (reachable.count(f)) {
+        kept.push_back(f);
+      } else {
+        ++removed_funcs;
+      }
+    }
+    const_cast<koopa_raw_program_t &>(program).funcs = make_slice(kept, KOOPA_RSIK_FUNCTION);
+
+    std::unordered_set<koopa_raw_value_t> used;
+    for (auto f : order) {
+      for (auto bb : func_blocks(f)) {
+        for (auto inst : bb_insts(bb)) {
+          for (auto op : operands(inst)) used.insert(op);
+        }
+      }
+    }
+    std::vector<koopa_raw_value_t> globals;
+    for (auto v : slice_items<koopa_raw_value_t>(program.values)) {
+      if (used.count(v)) {
+        globals.push_back(v);
+      } else {
+        ++removed_globals;
+      }
+    }
+    const_cast<koopa_raw_program_t &>(program).values = make_slice(globals, KOOPA_RSIK_VALUE);
+    return main;
+  }
+
+ private:
+  const koopa_raw_program_t &program;
+  std::unordered_set<koopa_raw_function_t> reachable;
+  // 可达的函数, 按发现的顺序
+  std::vector<koopa_raw_function_t> order;
+  // 每个可达函数的调用点
+  std::unordered_map<koopa_raw_function_t, std::vector<koopa_raw_value_t>> calls;
+
+  void find_reachable(koopa_raw_function_t main) {
+    std::vector<koopa_raw_function_t> stack{main};
+    reachable.insert(main);
+    while (!stack.empty()) {
+      auto f = stack.back();
+      stack.pop_back();
+      order.push_back(f);
+      for (auto bb : func_blocks(f)) {
+        for (auto inst : bb_insts(bb)) {
+          if (inst->kind.tag != KOOPA_RVT_CALL) continue;
+          auto callee = inst->kind.data.call.callee;
+          calls[callee].push_back(inst);
+          if (reachable.insert(callee).second) stack.push_back(callee);
+        }
+      }
+    }
+  }
+
+  bool calls_changed(koopa_raw_function_t f, const std::unordered_set<koopa_raw_function_t> &changed) {
+    for (auto bb : func_blocks(f)) {
+      for (auto inst : bb_insts(bb)) {
+        if (inst->kind.tag == KOOPA_RVT_CALL && changed.count(inst->kind.data.call.callee)) return true;
+      }
+    }
+    return false;
+  }
+
+  bool remove_dead_params(koopa_raw_function_t f) {
+    auto params = slice_items<koopa_raw_value_t>(f->params);
+    auto used = used_values(f, true, false);
+    std::vector<bool> keep(params.size());
+    std::vector<koopa_raw_value_t> kept;
+    std::vector<koopa_raw_type_t> types;
+    for (size_t i = 0; i < params.size(); ++i) {
+      keep[i] = used.count(params[i]) != 0;
+      if (!keep[i]) continue;
+      mut(params[i])->kind.data.func_arg_ref.index = kept.size();
+      kept.push_back(params[i]);
+      types.push_back(params[i]->ty);
+    }
+    if (kept.size() == params.size()) return false;
+    removed_params += params.size() - kept.size();
+    mut(f)->params = make_slice(kept, KOOPA_RSIK_VALUE);
+    mut(f)->ty = type_function(types, f->ty->data.function.ret);
+    for (auto call : calls[f]) {
+      auto args = slice_items<koopa_raw_value_t>(call->kind.data.call.args);
+      std::vector<koopa_raw_value_t> kept_args;
+      for (size_t i = 0; i < args.size(); ++i) {
+        if (keep[i]) kept_args.push_back(args[i]);
+      }
+      mut(call)->kind.data.call.args = make_slice(kept_args, KOOPA_RSIK_VALUE);
+    }
+    return true;
+  }
+
+  // f中用到的值: 从store、call、br的条件和ret (with_ret时) 出发沿操作数标记, 基本块参数沿传入的实参标记
+  // self_args为false时自调用的实参不作为根, 像基本块参数一样只在对应位置的形参用到时才用到
+  static std::unordered_set<koopa_raw_value_t> used_values(koopa_raw_function_t f, bool with_ret, bool self_args) {
+    std::unordered_map<koopa_raw_value_t, std::vector<koopa_raw_value_t>> incoming;
+    std::unordered_set<koopa_raw_value_t> used;
+    std::vector<koopa_raw_value_t> worklist;
+    auto mark = [&](koopa_raw_value_t v) {
+      if (used.insert(v).second) worklist.push_back(v);
+    };
+    auto params = slice_items<koopa_raw_value_t>(f->params);
+    for (auto bb : func_blocks(f)) {
+      for (auto inst : bb_insts(bb)) {
+        auto tag = inst->kind.tag;
+        if (tag == KOOPA_RVT_JUMP || tag == KOOPA_RVT_BRANCH) {
+          for (int e = 0; e < edge_count(inst); ++e) {
+            auto targets = bb_params(edge_target(inst, e));
+            auto args = slice_items<koopa_raw_value_t>(edge_args(inst, e));
+            for (size_t i = 0; i < args.size(); ++i) incoming[targets[i]].push_back(args[i]);
+          }
+          if (tag == KOOPA_RVT_BRANCH) mark(inst->kind.data.branch.cond);
+        } else if (tag == KOOPA_RVT_CALL && inst->kind.data.call.callee == f && !self_args) {
+          auto args = slice_items<koopa_raw_value_t>(inst->kind.data.call.args);
+          for (size_t i = 0; i < args.size(); ++i) incoming[params[i]].push_back(args[i]);
+        } else if (tag == KOOPA_RVT_STORE || tag == KOOPA_RVT_CALL || (tag == KOOPA_RVT_RETURN && with_ret)) {
+          for (auto op : operands(inst)) mark(op);
+        }
+      }
+    }
+    while (!worklist.empty()) {
+      auto v = worklist.back();
+      worklist.pop_back();
+      auto it = incoming.find(v);
+      if (it != incoming.end()) {
+        for (auto arg : it->second) mark(arg);
+      } else if (v->kind.tag != KOOPA_RVT_CALL) {
+        for (auto op : operands(v)) mark(op);
+      }
+    }
+    return used;
+  }
+
+  bool remove_dead_ret(koopa_raw_function_t f) {
+    if (f->ty->data.function.ret->tag == KOOPA_RTT_UNIT) return false;
+    std::unordered_set<koopa_raw_value_t> sites(calls[f].begin(), calls[f].end());
+    for (auto caller : order) {
+      if (caller == f) continue;
+      for (auto bb : func_blocks(caller)) {
+        for (auto inst : bb_insts(bb)) {
+          for (auto op : operands(inst)) {
+            if (sites.count(op)) return false;
+          }
+        }
+      }
+    }
+    // 自调用的结果只用于计算返回值
+    auto used = used_values(f, false, true);
+    for (auto call : calls[f]) {
+      if (used.count(call)) return false;
+    }
+    ++removed_rets;
+    mut(f)->ty = type_function(slice_items<koopa_raw_type_t>(f->ty->data.function.params), type_unit());
+    for (auto bb : func_blocks(f)) {
+      auto ret = terminator(bb);
+      if (ret->kind.tag == KOOPA_RVT_RETURN) mut(ret)->kind.data.ret.value = nullptr;
+    }
+    for (auto call : calls[f]) mut(call)->ty = type_unit();
+    return true;
+  }
+};
@@ -0,0 +1,144 @@
+#pragma once
+#include "ir.h"
+#include "modref.h"
+#include "callgraph.h"
+
+// 全局变量的优化
+// 1. 常量化: 没有store写它、地址也没有传给可能通过该形参写内存的函数 (如getarray) 的全局变量是常量,
+//    它和常量下标的getelemptr上的load直接替换为初值中对应的值. 判断在优化开始前进行, 需要优化前的mod/ref摘要
+// 2. 局部化: main不是递归函数, 只在main中 (内联之后, 在main能调用到的函数中都不出现) 访问的标量全局变量
+//    改为main的局部变量, 在入口处用初值初始化, 之后由mem2reg提升为SSA值. 数组留在全局, 不占用栈帧
+
+class GlobalOpt {
+ public:
+  GlobalOpt(const koopa_raw_program_t &p, CallGraph &g) : program(p), cg(g) {
+    for (auto v : slice_items<koopa_raw_value_t>(program.values)) {
+      if (v->kind.tag == KOOPA_RVT_GLOBAL_ALLOC) constants.insert(v);
+    }
+    for (auto f : cg.funcs) {
+      for (auto bb : func_blocks(f)) {
+        for (auto inst : bb_insts(bb)) {
+          if (inst->kind.tag == KOOPA_RVT_STORE) constants.erase(pointer_base(inst->kind.data.store.dest));
+          if (inst->kind.tag != KOOPA_RVT_CALL) continue;
+          const auto &s = modref(inst->kind.data.call.callee);
+          auto args = slice_items<koopa_raw_value_t>(inst->kind.data.call.args);
+          for (size_t i = 0; i < args.size(); ++i) {
+            if (args[i]->ty->tag == KOOPA_RTT_POINTER && (s.param_writes[i] || s.writes_unknown)) {
+              constants.erase(pointer_base(args[i]));
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // 替换func中常量全局变量的load, 返回替换的数量
+  int fold_constants(koopa_raw_function_t func) {
+    std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> repl;
+    for (auto bb : func_blocks(func)) {
+      std::vector<koopa_raw_value_t> kept;
+      for (auto inst : bb_insts(bb)) {
+        int32_t val;
+        if (inst->kind.tag == KOOPA_RVT_LOAD && constant_value(inst->kind.data.load.src, val)) {
+          repl[inst] = make_integer(val);
+          continue;
+        }
+        kept.push_back(inst);
+      }
+      set_bb_insts(bb, kept);
+    }
+    replace_uses(func, repl);
+    return repl.size();
+  }
+
+  // 局部化只在main中访问的标量全局变量, 返回它们的名字
+  std::vector<std::string> localize(koopa_raw_function_t main) {
+    std::vector<std::string> names;
+    if (cg.node(main).recursive) return names;
+    // main中出现的标量全局变量, 去掉其他可达函数中出现的
+    std::unordered_set<koopa_raw_value_t> candidates;
+    for (auto bb : func_blocks(main)) {
+      for (auto inst : bb_insts(bb)) {
+        for (auto op : operands(inst)) {
+          if (op->kind.tag == KOOPA_RVT_GLOBAL_ALLOC && op->ty->data.pointer.base->tag == KOOPA_RTT_INT32) {
+            candidates.insert(op);
+          }
+        }
+      }
+    }
+    std::unordered_set<koopa_raw_function_t> reachable{main};
+    std::vector<koopa_raw_function_t> stack{main};
+    while (!stack.empty()) {
+      auto f = stack.back();
+      stack.pop_back();
+      for (auto bb : func_blocks(f)) {
+        for (auto inst : bb_insts(bb)) {
+          if (f != main) {
+            for (auto op : operands(inst)) candidates.erase(op);
+          }
+          if (inst->kind.tag == KOOPA_RVT_CALL && reachable.insert(inst->kind.data.call.callee).second) {
+            stack.push_back(inst->kind.data.call.callee);
+          }
+        }
+      }
+    }
+    if (candidates.empty()) return names;
+
+    std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> repl;
+    std::vector<koopa_raw_value_t> allocs, inits;
+    for (auto v : slice_items<koopa_raw_value_t>(program.values)) {
+      if (!candidates.count(v)) continue;
+      auto alloc = make_alloc(type_i32());
+      auto init = v->kind.data.global_alloc.init;
+      allocs.push_back(alloc);
+      inits.push_back(make_store(make_integer(is_integer(init) ? int_value(init) : 0), alloc));
+      repl[v] = alloc;
+      names.push_back(v->name);
+    }
+    replace_uses(main, repl);
+    auto entry = func_blocks(main)[0];
+    auto insts = bb_insts(entry);
+    allocs.insert(allocs.end(), inits.begin(), inits.end());
+    insts.insert(insts.begin(), allocs.begin(), allocs.end());
+    set_bb_insts(entry, insts);
+    return names;
+  }
+
+ private:
+  const koopa_raw_program_t &program;
+  CallGraph &cg;
+  std::unordered_set<koopa_raw_value_t> constants;
+
+  // addr是常量全局变量经过常量下标的getelemptr得到的i32地址时, 求出初值中对应的值
+  bool constant_value(koopa_raw_value_t addr, int32_t &val) {
+    std::vector<int32_t> indices;
+    while (addr->kind.tag == KOOPA_RVT_GET_ELEM_PTR) {
+      auto index = addr->kind.data.get_elem_ptr.index;
+      if (!is_integer(index)) return false;
+      indices.push_back(int_value(index));
+      addr = addr->kind.data.get_elem_ptr.src;
+    }
+    if (!constants.count(addr)) return false;
+    auto init = addr->kind.data.global_alloc.init;
+    for (auto it = indices.rbegin(); it != indices.rend(); ++it) {
+      if (init->kind.tag == KOOPA_RVT_ZERO_INIT) break;
+      if (init->kind.tag != KOOPA_RVT_AGGREGATE) return false;
+      const auto &elems = init->kind.data.aggregate.elems;
+      if (*it < 0 || uint32_t(*it) >= elems.len) return false;
+      init = reinterpret_cast<koopa_raw_value_t>(elems.buffer[*it]);
+    }
+    if (init->kind.tag == KOOPA_RVT_ZERO_INIT) {
+      // 下标仍要在数组范围之内
+      auto ty = addr->ty->data.pointer.base;
+      for (auto it = indices.rbegin(); it != indices.rend(); ++it) {
+        if (ty->tag != KOOPA_RTT_ARRAY || *it < 0 || size_t(*it) >= ty->data.array.len) return false;
+        ty = ty->data.array.base;
+      }
+      val = 0;
+      return ty->tag == KOOPA_RTT_INT32;
+    }
+    if (!is_integer(init)) return false;
+    val = int_value(init);
+    return true;
+  }
+};
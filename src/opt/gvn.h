@@ -0,0 +1,175 @@
+#pragma once
+#include "ir.h"
+#include "modref.h"
+
+// 基于支配树的全局值编号: 沿支配树先序遍历, 用带作用域的哈希表记录可用的表达式
+// 1. binary/getptr/getelemptr 是纯计算, 在支配者中出现过的相同表达式可以直接复用
+// 2. load 还要求中间没有可能写同一地址的store或call (见alias.h, modref.h), 所以只在单前驱的链上继承;
+//    store之后, 对同一地址的load直接使用存入的值
+// 3. 对纯函数 (见modref.h) 的调用按表达式复用; 只读函数的调用与load一样, 遇到可能写它读的内存的store或call失效
+
+// 表达式的键: 指令种类, 运算符和各个操作数; 整数常量按值比较
+typedef std::vector<intptr_t> gvn_key_t;
+
+struct GVNKeyHash {
+  size_t operator()(const gvn_key_t &key) const {
+    size_t h = 0;
+    for (auto x : key) h = h * 1000003u ^ std::hash<intptr_t>()(x);
+    return h;
+  }
+};
+
+// 可用的load (或只读函数的调用) 的值, addr是load的地址, 调用的addr为nullptr
+struct AvailLoad {
+  koopa_raw_value_t value, addr;
+};
+
+class GVN {
+ public:
+  explicit GVN(koopa_raw_function_t f) : func(f) {}
+
+  // 返回删除的指令数量
+  int run() {
+    remove_unreachable_blocks(func);
+    CFG cfg(func);
+    DomTree dt(cfg);
+    visit(cfg, dt, cfg.entry(), false);
+    if (removed.empty()) return 0;
+    for (auto bb : func_blocks(func)) {
+      std::vector<koopa_raw_value_t> kept;
+      for (auto inst : bb_insts(bb)) {
+        if (removed.count(inst) == 0) kept.push_back(inst);
+      }
+      set_bb_insts(bb, kept);
+    }
+    replace_uses(func, repl);
+    return removed.size();
+  }
+
+ private:
+  koopa_raw_function_t func;
+  std::unordered_map<gvn_key_t, koopa_raw_value_t, GVNKeyHash> exprs;
+  std::unordered_map<gvn_key_t, AvailLoad, GVNKeyHash> loads;
+  std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> repl;
+  std::unordered_set<koopa_raw_value_t> removed;
+
+  koopa_raw_value_t resolve(koopa_raw_value_t v) {
+    auto it = repl.find(v);
+    while (it != repl.end()) {
+      v = it->second;
+      it = repl.find(v);
+    }
+    return v;
+  }
+
+  static void push_operand(gvn_key_t &key, koopa_raw_value_t v) {
+    if (is_integer(v)) {
+      key.push_back(0);
+      key.push_back(int_value(v));
+    } else {
+      key.push_back(1);
+      key.push_back(reinterpret_cast<intptr_t>(v));
+    }
+  }
+
+  static gvn_key_t make_key(koopa_raw_value_t inst) {
+    gvn_key_t key;
+    const auto &kind = inst->kind;
+    key.push_back(kind.tag);
+    switch (kind.tag) {
+      case KOOPA_RVT_BINARY: {
+        auto lhs = kind.data.binary.lhs, rhs = kind.data.binary.rhs;
+        // 可交换运算的操作数按固定顺序排列
+        if (is_commutative(kind.data.binary.op) && !is_integer(lhs) && (is_integer(rhs) || rhs < lhs)) {
+          std::swap(lhs, rhs);
+        }
+        key.push_back(kind.data.binary.op);
+        push_operand(key, lhs);
+        push_operand(key, rhs);
+        break;
+      }
+      case KOOPA_RVT_GET_PTR:
+        push_operand(key, kind.data.get_ptr.src);
+        push_operand(key, kind.data.get_ptr.index);
+        break;
+      case KOOPA_RVT_GET_ELEM_PTR:
+        push_operand(key, kind.data.get_elem_ptr.src);
+        push_operand(key, kind.data.get_elem_ptr.index);
+        break;
+      case KOOPA_RVT_LOAD:
+        push_operand(key, kind.data.load.src);
+        break;
+      case KOOPA_RVT_CALL:
+        key.push_back(reinterpret_cast<intptr_t>(kind.data.call.callee));
+        for (auto arg : slice_items<koopa_raw_value_t>(kind.data.call.args)) push_operand(key, arg);
+        break;
+      default:
+        break;
+    }
+    return key;
+  }
+
+  // inherit_loads: bb的唯一前驱就是支配树上的父结点, 父结点末尾可用的load在bb入口仍然可用
+  void visit(const CFG &cfg, const DomTree &dt, koopa_raw_basic_block_t bb, bool inherit_loads) {
+    std::vector<gvn_key_t> added;
+    auto saved_loads = std::move(loads);
+    loads.clear();
+    if (inherit_loads) loads = saved_loads;
+
+    for (auto inst : bb_insts(bb)) {
+      map_operands(inst, [&](koopa_raw_value_t op) { return resolve(op); });
+      auto tag = inst->kind.tag;
+      bool pure_call = tag == KOOPA_RVT_CALL && modref(inst->kind.data.call.callee).pure();
+      bool readonly_call = tag == KOOPA_RVT_CALL && modref(inst->kind.data.call.callee).readonly();
+      if (tag == KOOPA_RVT_BINARY || tag == KOOPA_RVT_GET_PTR || tag == KOOPA_RVT_GET_ELEM_PTR || pure_call) {
+        auto key = make_key(inst);
+        auto it = exprs.find(key);
+        if (it != exprs.end()) {
+          repl[inst] = it->second;
+          removed.insert(inst);
+        } else {
+          exprs.emplace(key, inst);
+          added.push_back(std::move(key));
+        }
+      } else if (tag == KOOPA_RVT_LOAD || readonly_call) {
+        auto key = make_key(inst);
+        auto it = loads.find(key);
+        if (it != loads.end()) {
+          repl[inst] = it->second.value;
+          removed.insert(inst);
+        } else {
+          auto addr = tag == KOOPA_RVT_LOAD ? inst->kind.data.load.src : nullptr;
+          loads.emplace(std::move(key), AvailLoad{inst, addr});
+        }
+      } else if (tag == KOOPA_RVT_CALL) {
+        // 只保留这次调用不会写的load
+        for (auto it = loads.begin(); it != loads.end();) {
+          auto addr = it->second.addr;
+          bool keep = addr != nullptr && !call_may_write(inst, addr);
+          it = keep ? std::next(it) : loads.erase(it);
+        }
+      } else if (tag == KOOPA_RVT_STORE) {
+        // 只保留与store的地址不重叠的load和不读这个地址的调用
+        auto dest = inst->kind.data.store.dest;
+        for (auto it = loads.begin(); it != loads.end();) {
+          auto [value, addr] = it->second;
+          bool keep = addr != nullptr ? !may_alias(addr, dest) : !call_may_read(value, dest);
+          it = keep ? std::next(it) : loads.erase(it);
+        }
+        gvn_key_t key{KOOPA_RVT_LOAD};
+        push_operand(key, dest);
+        loads[key] = AvailLoad{inst->kind.data.store.value, dest};
+      }
+    }
+
+    for (auto child : dt.children.at(bb)) {
+      auto &ps = cfg.preds.at(child);
+      visit(cfg, dt, child, ps.size() == 1 && ps[0] == bb);
+    }
+
+    for (auto &key : added) exprs.erase(key);
+    loads = std::move(saved_loads);
+  }
+};
+
+inline int gvn(koopa_raw_function_t func) { return GVN(func).run(); }
@@ -0,0 +1,152 @@
+#pragma once
+#include "ir.h"
+#include "loop.h"
+#include "clone.h"
+#include "callgraph.h"
+
+// 函数内联: 按调用图自底向上处理, 内联到调用者时被调用者已经优化过
+// 代价 = 被调用者的指令数 - 省下的调用开销 (传参, 保存ra, 建立栈帧) - 常量实参的奖励
+// 阈值随调用点所在的循环深度增加; 被调用者只有这一个调用点时, 内联后原函数可以删除, 阈值更高
+// 递归函数 (在调用图的环上) 不内联
+// 内联时在call处拆分基本块, call之后的指令移到新的基本块, 返回值作为它的参数;
+// 复制被调用者的基本块, 形参替换为实参, 每个ret改为带着返回值跳到新的基本块, alloc移到调用者的入口
+
+static const int kInlineThreshold = 30;
+static const int kInlineLoopBonus = 40;
+static const int kInlineMaxLoopDepth = 3;
+static const int kInlineSingleCallerBonus = 200;
+static const int kInlineConstArgBonus = 8;
+static const int kInlineCallOverhead = 4;
+static const int kMaxInlineCallerSize = 2000;
+
+class Inliner {
+ public:
+  // 每个调用点的决定和原因, 由调用者在--opt-report时输出
+  std::vector<std::string> remarks;
+
+  Inliner(koopa_raw_function_t f, CallGraph &g) : func(f), cg(g) {}
+
+  // 返回内联的调用点数量
+  int run() {
+    // 先收集调用点和所在循环的深度, 内联出来的call不再考虑
+    std::vector<std::pair<koopa_raw_value_t, int>> sites;
+    {
+      LoopInfo li(func);
+      for (auto bb : func_blocks(func)) {
+        auto it = li.loop_of.find(bb);
+        int depth = it == li.loop_of.end() ? 0 : it->second->depth;
+        for (auto inst : bb_insts(bb)) {
+          if (inst->kind.tag == KOOPA_RVT_CALL) sites.emplace_back(inst, depth);
+        }
+      }
+    }
+    int cnt = 0;
+    for (auto [call, depth] : sites) {
+      auto callee = call->kind.data.call.callee;
+      const auto &node = cg.node(callee);
+      if (node.external) continue;
+      auto name = std::string(callee->name);
+      if (node.recursive || node.scc == cg.node(func).scc) {
+        remarks.push_back("not inlined " + name + ": recursive");
+        continue;
+      }
+      int size = func_size(callee), cost = size - kInlineCallOverhead - int(call->kind.data.call.args.len);
+      for (auto arg : slice_items<koopa_raw_value_t>(call->kind.data.call.args)) {
+        if (is_integer(arg)) cost -= kInlineConstArgBonus;
+      }
+      int threshold = kInlineThreshold + kInlineLoopBonus * (depth < kInlineMaxLoopDepth ? depth : kInlineMaxLoopDepth);
+      if (node.callers.size() == 1) threshold += kInlineSingleCallerBonus;
+      auto why = "cost " + std::to_string(cost) + ", threshold " + std::to_string(threshold) + ", loop depth " +
+                 std::to_string(depth);
+      if (cost > threshold) {
+        remarks.push_back("not inlined " + name + ": too large (" + why + ")");
+        continue;
+      }
+      if (func_size(func) + size > kMaxInlineCallerSize) {
+        remarks.push_back("not inlined " + name + ": caller too large");
+        continue;
+      }
+      inline_call(call);
+      remarks.push_back("inlined " + name + " (" + why + ")");
+      ++cnt;
+    }
+    return cnt;
+  }
+
+ private:
+  koopa_raw_function_t func;
+  CallGraph &cg;
+
+  static int func_size(koopa_raw_function_t f) {
+    int size = 0;
+    for (auto bb : func_blocks(f)) size += bb->insts.len;
+    return size;
+  }
+
+  void inline_call(koopa_raw_value_t call) {
+    auto callee = call->kind.data.call.callee;
+    auto where = build_inst_blocks(func);
+    auto bb = where[call];
+
+    // call之后的指令移到cont, 返回值是cont的参数
+    auto cont = make_block("inline_cont");
+    auto insts = bb_insts(bb);
+    auto pos = std::find(insts.begin(), insts.end(), call);
+    set_bb_insts(cont, std::vector<koopa_raw_value_t>(pos + 1, insts.end()));
+    koopa_raw_value_t result = nullptr;
+    if (call->ty->tag != KOOPA_RTT_UNIT) {
+      result = make_block_arg(call->ty, 0);
+      set_bb_params(cont, {result});
+    }
+
+    CloneMap map;
+    auto params = slice_items<koopa_raw_value_t>(callee->params);
+    auto args = slice_items<koopa_raw_value_t>(call->kind.data.call.args);
+    for (size_t i = 0; i < params.size(); ++i) map.values[params[i]] = args[i];
+    auto copies = clone_blocks(func_blocks(callee), map);
+
+    std::vector<koopa_raw_value_t> allocs;
+    for (auto copy : copies) {
+      std::vector<koopa_raw_value_t> kept;
+      for (auto inst : bb_insts(copy)) {
+        if (inst->kind.tag == KOOPA_RVT_ALLOC) {
+          allocs.push_back(inst);
+        } else if (inst->kind.tag == KOOPA_RVT_RETURN) {
+          auto value = inst->kind.data.ret.value;
+          kept.push_back(make_jump(cont, value != nullptr && result != nullptr ? std::vector<koopa_raw_value_t>{value}
+                                                                              : std::vector<koopa_raw_value_t>{}));
+        } else {
+          if (inst->kind.tag == KOOPA_RVT_CALL) cg.add_call(inst, func);
+          kept.push_back(inst);
+        }
+      }
+      set_bb_insts(copy, kept);
+    }
+    cg.remove_call(call);
+
+    insts.erase(pos, insts.end());
+    insts.push_back(make_jump(copies[0]));
+    set_bb_insts(bb, insts);
+
+    auto order = func_blocks(func);
+    auto at = std::find(order.begin(), order.end(), bb) + 1;
+    at = order.insert(at, copies.begin(), copies.end()) + copies.size();
+    order.insert(at, cont);
+    set_func_blocks(func, order);
+
+    if (!allocs.empty()) {
+      auto entry = order[0];
+      auto entry_insts = bb_insts(entry);
+      entry_insts.insert(entry_insts.begin(), allocs.begin(), allocs.end());
+      set_bb_insts(entry, entry_insts);
+    }
+    if (result != nullptr) replace_uses(func, {{call, result}});
+  }
+};
+
+inline int inline_calls(koopa_raw_function_t func, CallGraph &cg, std::vector<std::string> &remarks) {
+  Inliner inliner(func, cg);
+  int cnt = inliner.run();
+  remarks = inliner.remarks;
+  return cnt;
+}
@@ -0,0 +1,260 @@
+#pragma once
+#include "ir.h"
+
+// 指令合并: 对binary反复应用代数恒等式直到不动点
+// 规范形式: 可交换运算和比较的常量操作数放在右边, 减常量改写为加负常量
+// 比较的比较: (a cmp b) != 0 => a cmp b, (a cmp b) == 0 => a !cmp b
+
+// 交换比较的两个操作数后对应的运算符
+inline koopa_raw_binary_op_t swapped_compare(koopa_raw_binary_op_t op) {
+  switch (op) {
+    case KOOPA_RBO_GT: return KOOPA_RBO_LT;
+    case KOOPA_RBO_LT: return KOOPA_RBO_GT;
+    case KOOPA_RBO_GE: return KOOPA_RBO_LE;
+    case KOOPA_RBO_LE: return KOOPA_RBO_GE;
+    default: return op;
+  }
+}
+
+// 比较取反后对应的运算符
+inline koopa_raw_binary_op_t inverted_compare(koopa_raw_binary_op_t op) {
+  switch (op) {
+    case KOOPA_RBO_EQ: return KOOPA_RBO_NOT_EQ;
+    case KOOPA_RBO_NOT_EQ: return KOOPA_RBO_EQ;
+    case KOOPA_RBO_GT: return KOOPA_RBO_LE;
+    case KOOPA_RBO_LT: return KOOPA_RBO_GE;
+    case KOOPA_RBO_GE: return KOOPA_RBO_LT;
+    case KOOPA_RBO_LE: return KOOPA_RBO_GT;
+    default: return op;
+  }
+}
+
+inline bool is_compare(koopa_raw_binary_op_t op) {
+  switch (op) {
+    case KOOPA_RBO_EQ:
+    case KOOPA_RBO_NOT_EQ:
+    case KOOPA_RBO_GT:
+    case KOOPA_RBO_LT:
+    case KOOPA_RBO_GE:
+    case KOOPA_RBO_LE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+inline bool is_const(koopa_raw_value_t v, int32_t c) { return is_integer(v) && int_value(v) == c; }
+
+class InstCombine {
+ public:
+  explicit InstCombine(koopa_raw_function_t f) : func(f) {}
+
+  // 返回化简的次数
+  int run() {
+    int cnt = 0;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (auto bb : func_blocks(func)) {
+        std::vector<koopa_raw_value_t> kept;
+        for (auto inst : bb_insts(bb)) {
+          map_operands(inst, [&](koopa_raw_value_t op) { return resolve(op); });
+          if (inst->kind.tag == KOOPA_RVT_BINARY) {
+            while (combine(inst)) {
+              changed = true;
+              ++cnt;
+              if (repl.count(inst)) break;
+            }
+            if (repl.count(inst)) continue;
+          }
+          kept.push_back(inst);
+        }
+        set_bb_insts(bb, kept);
+      }
+      replace_uses(func, repl);
+    }
+    remove_dead_binaries();
+    return cnt;
+  }
+
+ private:
+  koopa_raw_function_t func;
+  std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> repl;
+
+  koopa_raw_value_t resolve(koopa_raw_value_t v) {
+    auto it = repl.find(v);
+    while (it != repl.end()) {
+      v = it->second;
+      it = repl.find(v);
+    }
+    return v;
+  }
+
+  static bool is_binary(koopa_raw_value_t v, koopa_raw_binary_op_t op) {
+    return v->kind.tag == KOOPA_RVT_BINARY && v->kind.data.binary.op == op;
+  }
+
+  // 值只可能是0或1
+  static bool is_bool(koopa_raw_value_t v) {
+    if (is_integer(v)) return int_value(v) == 0 || int_value(v) == 1;
+    if (v->kind.tag != KOOPA_RVT_BINARY) return false;
+    const auto &b = v->kind.data.binary;
+    if (is_compare(b.op)) return true;
+    if (b.op == KOOPA_RBO_AND) return is_bool(b.lhs) || is_bool(b.rhs);
+    if (b.op == KOOPA_RBO_OR || b.op == KOOPA_RBO_XOR) return is_bool(b.lhs) && is_bool(b.rhs);
+    return false;
+  }
+
+  bool replace(koopa_raw_value_t inst, koopa_raw_value_t v) {
+    repl[inst] = v;
+    return true;
+  }
+
+  bool rewrite(koopa_raw_value_t inst, koopa_raw_binary_op_t op, koopa_raw_value_t lhs, koopa_raw_value_t rhs) {
+    auto &b = mut(inst)->kind.data.binary;
+    b.op = op;
+    b.lhs = lhs;
+    b.rhs = rhs;
+    return true;
+  }
+
+  // 应用一条规则, 返回是否有改动
+  bool combine(koopa_raw_value_t inst) {
+    const auto &b = inst->kind.data.binary;
+    auto op = b.op;
+    auto lhs = b.lhs, rhs = b.rhs;
+    int32_t c;
+
+    if (is_integer(lhs) && is_integer(rhs)) {
+      if (fold_binary(op, int_value(lhs), int_value(rhs), c)) return replace(inst, make_integer(c));
+      return false;
+    }
+    // 常量放在右边
+    if (is_integer(lhs) && (is_commutative(op) || is_compare(op))) {
+      return rewrite(inst, swapped_compare(op), rhs, lhs);
+    }
+
+    // 两个操作数相同
+    if (lhs == rhs) {
+      switch (op) {
+        case KOOPA_RBO_SUB:
+        case KOOPA_RBO_XOR:
+        case KOOPA_RBO_NOT_EQ:
+        case KOOPA_RBO_GT:
+        case KOOPA_RBO_LT:
+          return replace(inst, make_integer(0));
+        case KOOPA_RBO_EQ:
+        case KOOPA_RBO_GE:
+        case KOOPA_RBO_LE:
+          return replace(inst, make_integer(1));
+        case KOOPA_RBO_AND:
+        case KOOPA_RBO_OR:
+          return replace(inst, lhs);
+        default:
+          break;
+      }
+    }
+
+    if (is_integer(rhs)) {
+      int32_t k = int_value(rhs);
+      switch (op) {
+        case KOOPA_RBO_ADD:
+          if (k == 0) return replace(inst, lhs);
+          // (x + c1) + c2 => x + (c1 + c2)
+          if (is_binary(lhs, KOOPA_RBO_ADD) && is_integer(lhs->kind.data.binary.rhs)) {
+            int32_t sum = int32_t(uint32_t(int_value(lhs->kind.data.binary.rhs)) + uint32_t(k));
+            return rewrite(inst, KOOPA_RBO_ADD, lhs->kind.data.binary.lhs, make_integer(sum));
+          }
+          break;
+        case KOOPA_RBO_SUB:
+          if (k == 0) return replace(inst, lhs);
+          if (k != INT32_MIN) return rewrite(inst, KOOPA_RBO_ADD, lhs, make_integer(-k));
+          break;
+        case KOOPA_RBO_MUL:
+          if (k == 0) return replace(inst, rhs);
+          if (k == 1) return replace(inst, lhs);
+          if (k == -1) return rewrite(inst, KOOPA_RBO_SUB, make_integer(0), lhs);
+          // (x * c1) * c2 => x * (c1 * c2)
+          if (is_binary(lhs, KOOPA_RBO_MUL) && is_integer(lhs->kind.data.binary.rhs)) {
+            int32_t prod = int32_t(uint32_t(int_value(lhs->kind.data.binary.rhs)) * uint32_t(k));
+            return rewrite(inst, KOOPA_RBO_MUL, lhs->kind.data.binary.lhs, make_integer(prod));
+          }
+          break;
+        case KOOPA_RBO_DIV:
+          if (k == 1) return replace(inst, lhs);
+          if (k == -1) return rewrite(inst, KOOPA_RBO_SUB, make_integer(0), lhs);
+          break;
+        case KOOPA_RBO_MOD:
+          if (k == 1 || k == -1) return replace(inst, make_integer(0));
+          break;
+        case KOOPA_RBO_AND:
+          if (k == 0) return replace(inst, rhs);
+          if (k == -1 || (k == 1 && is_bool(lhs))) return replace(inst, lhs);
+          break;
+        case KOOPA_RBO_OR:
+        case KOOPA_RBO_XOR:
+        case KOOPA_RBO_SHL:
+        case KOOPA_RBO_SHR:
+        case KOOPA_RBO_SAR:
+          if (k == 0) return replace(inst, lhs);
+          if (op == KOOPA_RBO_XOR && k == 1 && is_bool(lhs)) return rewrite(inst, KOOPA_RBO_EQ, lhs, make_integer(0));
+          break;
+        case KOOPA_RBO_NOT_EQ:
+        case KOOPA_RBO_EQ: {
+          if (!is_bool(lhs)) break;
+          // 布尔值与0/1比较
+          bool keep = (op == KOOPA_RBO_NOT_EQ && k == 0) || (op == KOOPA_RBO_EQ && k == 1);
+          bool invert = (op == KOOPA_RBO_EQ && k == 0) || (op == KOOPA_RBO_NOT_EQ && k == 1);
+          if (keep) return replace(inst, lhs);
+          if (invert && lhs->kind.tag == KOOPA_RVT_BINARY && is_compare(lhs->kind.data.binary.op)) {
+            const auto &inner = lhs->kind.data.binary;
+            return rewrite(inst, inverted_compare(inner.op), inner.lhs, inner.rhs);
+          }
+          if (!invert) return replace(inst, make_integer(op == KOOPA_RBO_NOT_EQ ? 1 : 0));
+          break;
+        }
+        default:
+          break;
+      }
+    }
+
+    // 0 - (0 - x) => x
+    if (op == KOOPA_RBO_SUB && is_const(lhs, 0) && is_binary(rhs, KOOPA_RBO_SUB) && is_const(rhs->kind.data.binary.lhs, 0)) {
+      return replace(inst, rhs->kind.data.binary.rhs);
+    }
+    // x - (0 - y) => x + y, x + (0 - y) => x - y
+    if ((op == KOOPA_RBO_SUB || op == KOOPA_RBO_ADD) && is_binary(rhs, KOOPA_RBO_SUB) &&
+        is_const(rhs->kind.data.binary.lhs, 0)) {
+      return rewrite(inst, op == KOOPA_RBO_SUB ? KOOPA_RBO_ADD : KOOPA_RBO_SUB, lhs, rhs->kind.data.binary.rhs);
+    }
+    // (x + y) - y => x
+    if (op == KOOPA_RBO_SUB && is_binary(lhs, KOOPA_RBO_ADD)) {
+      const auto &inner = lhs->kind.data.binary;
+      if (inner.rhs == rhs) return replace(inst, inner.lhs);
+      if (inner.lhs == rhs) return replace(inst, inner.rhs);
+    }
+    return false;
+  }
+
+  // 删除没有使用者的binary
+  void remove_dead_binaries() {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      auto users = build_users(func);
+      for (auto bb : func_blocks(func)) {
+        std::vector<koopa_raw_value_t> kept;
+        for (auto inst : bb_insts(bb)) {
+          if (inst->kind.tag == KOOPA_RVT_BINARY && users[inst].empty()) {
+            changed = true;
+            continue;
+          }
+          kept.push_back(inst);
+        }
+        set_bb_insts(bb, kept);
+      }
+    }
+  }
+};
+
+inline int instcombine(koopa_raw_function_t func) { return InstCombine(func).run(); }
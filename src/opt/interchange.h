@@ -0,0 +1,271 @@
+#pragma once
+#include "ir.h"
+#include "loop.h"
+#include "iv.h"
+#include "instcombine.h"
+#include "dependence.h"
+
+// 循环交换: 处理紧密嵌套的两层循环, 内层是最内层循环, 外层中除内层循环外只有条件判断和计数器递增
+// 两层循环的边界都与两个归纳变量无关时, 交换就是交换两个header控制的归纳变量:
+// 外层header改为按内层原来的初值/步长/边界计数, 内层反之, 循环体中两个归纳变量的使用对调
+// 当不存在迭代顺序为 (<, >) 的依赖, 且交换后内层访存的步长更小时才交换
+// header的其他参数只能是满足交换律和结合律的归约 (如 s = s + a[i][j]), 交换只改变运算的顺序
+
+class LoopInterchange {
+ public:
+  explicit LoopInterchange(koopa_raw_function_t f) : func(f) {}
+
+  // 返回交换的循环嵌套数量
+  int run() {
+    insert_preheaders(func);
+    LoopInfo li(func);
+    where = build_inst_blocks(func);
+    int cnt = 0;
+    for (auto loop : li.loops) {
+      if (loop->children.size() == 1 && loop->children[0]->children.empty() &&
+          try_interchange(li, loop, loop->children[0])) {
+        ++cnt;
+      }
+    }
+    return cnt;
+  }
+
+ private:
+  // 循环的控制部分: header中只有 stay_op(param, bound) 的比较和br
+  struct Control {
+    koopa_raw_value_t param;
+    size_t index;
+    koopa_raw_value_t init;
+    int32_t step;
+    koopa_raw_binary_op_t stay_op;
+    koopa_raw_value_t bound;
+    koopa_raw_basic_block_t stay_bb, exit_bb;
+    koopa_raw_slice_t stay_args, exit_args;
+    // 回边上的 param + step
+    koopa_raw_value_t inc;
+    IVRange range;
+  };
+
+  koopa_raw_function_t func;
+  std::unordered_map<koopa_raw_value_t, koopa_raw_basic_block_t> where;
+
+  bool outside(const Loop *loop, koopa_raw_value_t v) { return !is_local_value(v) || !loop->contains(where[v]); }
+
+  bool analyze(const LoopInfo &li, const Loop *loop, Control &c) {
+    auto header = loop->header;
+    auto insts = bb_insts(header);
+    auto params = bb_params(header);
+    auto exiting = li.exiting_blocks(loop);
+    auto edges = latch_edges(loop);
+    if (loop->preheader == nullptr || params.empty() || insts.size() != 2 || edges.size() != 1 ||
+        exiting.size() != 1 || exiting[0] != header) {
+      return false;
+    }
+    auto cond = insts[0], br = insts[1];
+    if (br->kind.tag != KOOPA_RVT_BRANCH || br->kind.data.branch.cond != cond || cond->kind.tag != KOOPA_RVT_BINARY ||
+        !is_compare(cond->kind.data.binary.op)) {
+      return false;
+    }
+    auto op = cond->kind.data.binary.op;
+    auto lhs = cond->kind.data.binary.lhs, rhs = cond->kind.data.binary.rhs;
+    auto ivs = find_induction_vars(loop);
+    auto iv = std::find_if(ivs.begin(), ivs.end(), [&](const InductionVar &v) { return v.param == lhs; });
+    if (iv == ivs.end()) {
+      iv = std::find_if(ivs.begin(), ivs.end(), [&](const InductionVar &v) { return v.param == rhs; });
+      std::swap(lhs, rhs);
+      op = swapped_compare(op);
+    }
+    if (iv == ivs.end() || iv->steps[0] == 0 || !outside(loop, rhs)) return false;
+    c.param = iv->param;
+    c.index = iv->index;
+    c.init = iv->init;
+    c.step = iv->steps[0];
+    c.inc = slice_items<koopa_raw_value_t>(edge_args(edges[0].term, edges[0].edge))[c.index];
+    const auto &b = br->kind.data.branch;
+    bool stay_true = loop->contains(b.true_bb);
+    c.stay_op = stay_true ? op : inverted_compare(op);
+    c.bound = rhs;
+    c.stay_bb = stay_true ? b.true_bb : b.false_bb;
+    c.exit_bb = stay_true ? b.false_bb : b.true_bb;
+    c.stay_args = stay_true ? b.true_args : b.false_args;
+    c.exit_args = stay_true ? b.false_args : b.true_args;
+
+    // 取值范围
+    bool up = c.step > 0;
+    if ((up && c.stay_op != KOOPA_RBO_LT && c.stay_op != KOOPA_RBO_LE) ||
+        (!up && c.stay_op != KOOPA_RBO_GT && c.stay_op != KOOPA_RBO_GE)) {
+      return false;
+    }
+    if (is_integer(c.init) && is_integer(c.bound)) {
+      int64_t init = int_value(c.init), bound = int_value(c.bound);
+      c.range.known = true;
+      switch (c.stay_op) {
+        case KOOPA_RBO_LT: c.range.lo = init, c.range.hi = bound - 1; break;
+        case KOOPA_RBO_LE: c.range.lo = init, c.range.hi = bound; break;
+        case KOOPA_RBO_GT: c.range.lo = bound + 1, c.range.hi = init; break;
+        default: c.range.lo = bound, c.range.hi = init; break;
+      }
+    }
+    return true;
+  }
+
+  // 访存在以iv为内层循环时每次迭代的地址步长, 步长超过一个cache行的都一样差
+  static int64_t stride_cost(const Access &a, int k, int32_t step) {
+    int64_t stride = 0;
+    for (size_t d = 0; d < a.subs.size(); ++d) stride += a.subs[d].coef[k] * a.sizes[d];
+    stride *= step;
+    stride = stride < 0 ? -stride : stride;
+    return stride < 64 ? stride : 64;
+  }
+
+  bool try_interchange(const LoopInfo &li, const Loop *outer, const Loop *inner) {
+    Control co, ci;
+    if (!analyze(li, outer, co) || !analyze(li, inner, ci)) return false;
+    // 紧密嵌套: 外层只有header, 内层的preheader, 内层的出口 (外层唯一的回边所在的块)
+    auto pi = inner->preheader, ei = ci.exit_bb;
+    if (outer->blocks.size() != inner->blocks.size() + 3 || co.stay_bb != pi || pi->insts.len != 1 ||
+        !outer->contains(ei) || outer->latches.size() != 1 || outer->latches[0] != ei || ei->insts.len != 2 ||
+        ei->params.len != 0 || where[co.inc] != ei) {
+      return false;
+    }
+    // 内层的控制与外层的归纳变量无关
+    if (!outside(outer, ci.init) || !outside(outer, ci.bound) || ci.stay_args.len != 0 || ci.exit_args.len != 0) {
+      return false;
+    }
+    // 两个归纳变量在循环外的值会改变
+    for (auto bb : func_blocks(func)) {
+      if (outer->contains(bb)) continue;
+      for (auto inst : bb_insts(bb)) {
+        for (auto op : operands(inst)) {
+          if (op == co.param || op == ci.param) return false;
+        }
+      }
+    }
+    if (!check_reductions(outer, inner, co, ci)) return false;
+    auto outer_params = bb_params(outer->header);
+    for (auto arg : slice_items<koopa_raw_value_t>(co.exit_args)) {
+      if (arg == co.param ||
+          (!outside(outer, arg) && std::find(outer_params.begin(), outer_params.end(), arg) == outer_params.end())) {
+        return false;
+      }
+    }
+
+    // 循环体: 没有call, 计数器递增的结果只用在回边上
+    std::vector<koopa_raw_basic_block_t> body;
+    for (auto bb : li.loop_blocks(inner)) {
+      if (bb != inner->header) body.push_back(bb);
+    }
+    DependenceAnalysis da(co.param, ci.param, [&](koopa_raw_value_t v) { return outside(outer, v); });
+    std::vector<Access> accesses;
+    int inc_uses = 0;
+    for (auto bb : body) {
+      for (auto inst : bb_insts(bb)) {
+        auto tag = inst->kind.tag;
+        if (tag == KOOPA_RVT_CALL) return false;
+        if (tag == KOOPA_RVT_LOAD || tag == KOOPA_RVT_STORE) accesses.push_back(da.access(inst));
+        for (auto op : operands(inst)) {
+          if (op == ci.inc || op == co.inc) ++inc_uses;
+        }
+      }
+    }
+    if (inc_uses != 1) return false;
+
+    // 依赖测试: 任何一对有store参与的访问都不能有迭代顺序为 (<, >) 或 (>, <) 的依赖
+    // may_depend的方向比较的是归纳变量的值, 步长为负的循环中先执行的迭代值更大, 方向要取反
+    int so = co.step > 0 ? 1 : -1, si = ci.step > 0 ? 1 : -1;
+    const int dirs[2][2] = {{-so, si}, {so, -si}};
+    IVRange ranges[2] = {co.range, ci.range};
+    for (size_t x = 0; x < accesses.size(); ++x) {
+      for (size_t y = x; y < accesses.size(); ++y) {
+        if (!accesses[x].is_store && !accesses[y].is_store) continue;
+        for (auto dir : dirs) {
+          if (da.may_depend(accesses[x], accesses[y], dir, ranges)) return false;
+        }
+      }
+    }
+
+    // 收益: 交换后内层的访存步长之和更小
+    int64_t cost_now = 0, cost_swapped = 0;
+    for (auto &a : accesses) {
+      if (!a.affine) continue;
+      cost_now += stride_cost(a, 1, ci.step);
+      cost_swapped += stride_cost(a, 0, co.step);
+    }
+    if (cost_swapped >= cost_now) return false;
+
+    swap_control(outer, co, ci);
+    swap_control(inner, ci, co);
+    auto outer_entry = terminator(outer->preheader), inner_entry = terminator(pi);
+    auto outer_args = slice_items<koopa_raw_value_t>(outer_entry->kind.data.jump.args);
+    auto inner_args = slice_items<koopa_raw_value_t>(inner_entry->kind.data.jump.args);
+    outer_args[co.index] = ci.init;
+    inner_args[ci.index] = co.init;
+    mut(outer_entry)->kind.data.jump.args = make_slice(outer_args, KOOPA_RSIK_VALUE);
+    mut(inner_entry)->kind.data.jump.args = make_slice(inner_args, KOOPA_RSIK_VALUE);
+    for (auto bb : body) {
+      for (auto inst : bb_insts(bb)) {
+        if (inst == ci.inc) continue;
+        map_operands(inst, [&](koopa_raw_value_t op) {
+          return op == co.param ? ci.param : op == ci.param ? co.param : op;
+        });
+      }
+    }
+    return true;
+  }
+
+  static int count_uses(const Loop *loop, koopa_raw_value_t v) {
+    int cnt = 0;
+    for (auto bb : loop->blocks) {
+      for (auto inst : bb_insts(bb)) {
+        for (auto op : operands(inst)) cnt += op == v;
+      }
+    }
+    return cnt;
+  }
+
+  // 归纳变量以外的参数: 外层参数p只作为内层参数q的初值, 内层结束后q作为p的下一个值;
+  // q只被一条 q op x 使用 (op满足交换律和结合律), 结果只作为q的下一个值
+  bool check_reductions(const Loop *outer, const Loop *inner, const Control &co, const Control &ci) {
+    auto ps = bb_params(outer->header), qs = bb_params(inner->header);
+    if (ps.size() != qs.size()) return false;
+    auto entry = slice_items<koopa_raw_value_t>(terminator(inner->preheader)->kind.data.jump.args);
+    auto outer_edge = latch_edges(outer)[0], inner_edge = latch_edges(inner)[0];
+    auto outer_next = slice_items<koopa_raw_value_t>(edge_args(outer_edge.term, outer_edge.edge));
+    auto inner_next = slice_items<koopa_raw_value_t>(edge_args(inner_edge.term, inner_edge.edge));
+    for (size_t k = 0; k < ps.size(); ++k) {
+      if (k == co.index) continue;
+      size_t q = std::find(entry.begin(), entry.end(), ps[k]) - entry.begin();
+      if (q == entry.size() || q == ci.index || outer_next[k] != qs[q] || count_uses(outer, ps[k]) != 1) {
+        return false;
+      }
+      auto upd = inner_next[q];
+      if (!is_local_value(upd) || !inner->contains(where[upd]) || upd->kind.tag != KOOPA_RVT_BINARY ||
+          count_uses(outer, upd) != 1 || count_uses(outer, qs[q]) != 2) {
+        return false;
+      }
+      const auto &bin = upd->kind.data.binary;
+      auto op = bin.op;
+      if ((bin.lhs == qs[q]) == (bin.rhs == qs[q]) || (op != KOOPA_RBO_ADD && op != KOOPA_RBO_MUL &&
+                                                       op != KOOPA_RBO_AND && op != KOOPA_RBO_OR && op != KOOPA_RBO_XOR)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // 让loop的header按from的方式计数
+  void swap_control(const Loop *loop, const Control &self, const Control &from) {
+    auto cond = make_binary(from.stay_op, self.param, from.bound);
+    auto br = make_branch(cond, self.stay_bb, self.exit_bb);
+    mut(br)->kind.data.branch.true_args = self.stay_args;
+    mut(br)->kind.data.branch.false_args = self.exit_args;
+    set_bb_insts(loop->header, {cond, br});
+    where[cond] = loop->header;
+    auto &inc = mut(self.inc)->kind.data.binary;
+    inc.op = KOOPA_RBO_ADD;
+    inc.lhs = self.param;
+    inc.rhs = make_integer(from.step);
+  }
+};
+
+inline int interchange_loops(koopa_raw_function_t func) { return LoopInterchange(func).run(); }
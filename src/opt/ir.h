@@ -0,0 +1,808 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "koopa.h"
+
+// 优化遍共用的工具: 修改raw program, 构造新的指令/基本块, CFG与支配树
+
+// raw program里的指针都是const的, 优化时需要原地修改
+inline koopa_raw_value_data_t *mut(koopa_raw_value_t v) {
+  return const_cast<koopa_raw_value_data_t *>(v);
+}
+inline koopa_raw_basic_block_data_t *mut(koopa_raw_basic_block_t bb) {
+  return const_cast<koopa_raw_basic_block_data_t *>(bb);
+}
+inline koopa_raw_function_data_t *mut(koopa_raw_function_t func) {
+  return const_cast<koopa_raw_function_data_t *>(func);
+}
+
+// 优化过程中新分配的对象, 与raw program builder一样活到程序结束
+static std::deque<std::vector<const void *>> ir_slice_pool;
+static std::deque<std::string> ir_name_pool;
+static std::deque<koopa_raw_value_data_t> ir_value_pool;
+static std::deque<koopa_raw_basic_block_data_t> ir_block_pool;
+static std::deque<koopa_raw_type_kind_t> ir_type_pool;
+static std::deque<koopa_raw_function_data_t> ir_func_pool;
+// 新基本块的编号, 保证汇编中的标号全局唯一
+static int ir_block_cnt = 0;
+
+// ---------- slice ----------
+
+template <typename T>
+std::vector<T> slice_items(const koopa_raw_slice_t &slice) {
+  std::vector<T> items;
+  items.reserve(slice.len);
+  for (uint32_t i = 0; i < slice.len; ++i) {
+    items.push_back(reinterpret_cast<T>(slice.buffer[i]));
+  }
+  return items;
+}
+
+template <typename T>
+koopa_raw_slice_t make_slice(const std::vector<T> &items, koopa_raw_slice_item_kind_t kind) {
+  ir_slice_pool.emplace_back(items.begin(), items.end());
+  auto &buf = ir_slice_pool.back();
+  koopa_raw_slice_t slice;
+  slice.buffer = buf.empty() ? nullptr : buf.data();
+  slice.len = buf.size();
+  slice.kind = kind;
+  return slice;
+}
+
+inline koopa_raw_slice_t empty_slice(koopa_raw_slice_item_kind_t kind) {
+  koopa_raw_slice_t slice;
+  slice.buffer = nullptr;
+  slice.len = 0;
+  slice.kind = kind;
+  return slice;
+}
+
+inline const char *make_name(const std::string &name) {
+  ir_name_pool.push_back(name);
+  return ir_name_pool.back().c_str();
+}
+
+// ---------- 类型 ----------
+
+inline koopa_raw_type_t make_type(koopa_raw_type_tag_t tag) {
+  ir_type_pool.emplace_back();
+  auto &ty = ir_type_pool.back();
+  memset(&ty, 0, sizeof(ty));
+  ty.tag = tag;
+  return &ty;
+}
+
+inline koopa_raw_type_t type_i32() {
+  static koopa_raw_type_t ty = make_type(KOOPA_RTT_INT32);
+  return ty;
+}
+
+inline koopa_raw_type_t type_unit() {
+  static koopa_raw_type_t ty = make_type(KOOPA_RTT_UNIT);
+  return ty;
+}
+
+inline koopa_raw_type_t type_pointer(koopa_raw_type_t base) {
+  auto ty = const_cast<koopa_raw_type_kind_t *>(make_type(KOOPA_RTT_POINTER));
+  ty->data.pointer.base = base;
+  return ty;
+}
+
+inline koopa_raw_type_t type_array(koopa_raw_type_t base, size_t len) {
+  auto ty = const_cast<koopa_raw_type_kind_t *>(make_type(KOOPA_RTT_ARRAY));
+  ty->data.array.base = base;
+  ty->data.array.len = len;
+  return ty;
+}
+
+// 类型所占字节数
+inline int type_size(koopa_raw_type_t ty) {
+  switch (ty->tag) {
+    case KOOPA_RTT_INT32:
+    case KOOPA_RTT_POINTER:
+      return 4;
+    case KOOPA_RTT_ARRAY:
+      return ty->data.array.len * type_size(ty->data.array.base);
+    default:
+      return 0;
+  }
+}
+
+inline bool type_equal(koopa_raw_type_t a, koopa_raw_type_t b) {
+  if (a == b) return true;
+  if (a->tag != b->tag) return false;
+  switch (a->tag) {
+    case KOOPA_RTT_ARRAY:
+      return a->data.array.len == b->data.array.len && type_equal(a->data.array.base, b->data.array.base);
+    case KOOPA_RTT_POINTER:
+      return type_equal(a->data.pointer.base, b->data.pointer.base);
+    default:
+      return true;
+  }
+}
+
+// ---------- 值 ----------
+
+inline koopa_raw_value_data_t *new_value(koopa_raw_type_t ty, koopa_raw_value_tag_t tag) {
+  ir_value_pool.emplace_back();
+  auto &v = ir_value_pool.back();
+  memset(&v, 0, sizeof(v));
+  v.ty = ty;
+  v.name = nullptr;
+  v.used_by = empty_slice(KOOPA_RSIK_VALUE);
+  v.kind.tag = tag;
+  return &v;
+}
+
+inline bool is_integer(koopa_raw_value_t v) { return v->kind.tag == KOOPA_RVT_INTEGER; }
+inline int32_t int_value(koopa_raw_value_t v) { return v->kind.data.integer.value; }
+
+inline koopa_raw_value_t make_integer(int32_t val) {
+  auto v = new_value(type_i32(), KOOPA_RVT_INTEGER);
+  v->kind.data.integer.value = val;
+  return v;
+}
+
+inline koopa_raw_value_t make_undef(koopa_raw_type_t ty) { return new_value(ty, KOOPA_RVT_UNDEF); }
+
+inline koopa_raw_value_data_t *make_binary(koopa_raw_binary_op_t op, koopa_raw_value_t lhs, koopa_raw_value_t rhs) {
+  auto v = new_value(type_i32(), KOOPA_RVT_BINARY);
+  v->kind.data.binary.op = op;
+  v->kind.data.binary.lhs = lhs;
+  v->kind.data.binary.rhs = rhs;
+  return v;
+}
+
+inline koopa_raw_value_data_t *make_load(koopa_raw_value_t src) {
+  auto v = new_value(src->ty->data.pointer.base, KOOPA_RVT_LOAD);
+  v->kind.data.load.src = src;
+  return v;
+}
+
+inline koopa_raw_value_data_t *make_store(koopa_raw_value_t value, koopa_raw_value_t dest) {
+  auto v = new_value(type_unit(), KOOPA_RVT_STORE);
+  v->kind.data.store.value = value;
+  v->kind.data.store.dest = dest;
+  return v;
+}
+
+inline koopa_raw_value_data_t *make_alloc(koopa_raw_type_t base) {
+  return new_value(type_pointer(base), KOOPA_RVT_ALLOC);
+}
+
+inline koopa_raw_value_data_t *make_get_ptr(koopa_raw_value_t src, koopa_raw_value_t index) {
+  auto v = new_value(src->ty, KOOPA_RVT_GET_PTR);
+  v->kind.data.get_ptr.src = src;
+  v->kind.data.get_ptr.index = index;
+  return v;
+}
+
+inline koopa_raw_value_data_t *make_get_elem_ptr(koopa_raw_value_t src, koopa_raw_value_t index) {
+  auto v = new_value(type_pointer(src->ty->data.pointer.base->data.array.base), KOOPA_RVT_GET_ELEM_PTR);
+  v->kind.data.get_elem_ptr.src = src;
+  v->kind.data.get_elem_ptr.index = index;
+  return v;
+}
+
+inline koopa_raw_value_data_t *make_jump(koopa_raw_basic_block_t target,
+                                         const std::vector<koopa_raw_value_t> &args = {}) {
+  auto v = new_value(type_unit(), KOOPA_RVT_JUMP);
+  v->kind.data.jump.target = target;
+  v->kind.data.jump.args = make_slice(args, KOOPA_RSIK_VALUE);
+  return v;
+}
+
+inline koopa_raw_value_data_t *make_branch(koopa_raw_value_t cond, koopa_raw_basic_block_t true_bb,
+                                           koopa_raw_basic_block_t false_bb) {
+  auto v = new_value(type_unit(), KOOPA_RVT_BRANCH);
+  v->kind.data.branch.cond = cond;
+  v->kind.data.branch.true_bb = true_bb;
+  v->kind.data.branch.false_bb = false_bb;
+  v->kind.data.branch.true_args = empty_slice(KOOPA_RSIK_VALUE);
+  v->kind.data.branch.false_args = empty_slice(KOOPA_RSIK_VALUE);
+  return v;
+}
+
+inline koopa_raw_value_data_t *make_call(koopa_raw_function_t callee, const std::vector<koopa_raw_value_t> &args) {
+  auto v = new_value(callee->ty->data.function.ret, KOOPA_RVT_CALL);
+  v->kind.data.call.callee = callee;
+  v->kind.data.call.args = make_slice(args, KOOPA_RSIK_VALUE);
+  return v;
+}
+
+inline koopa_raw_value_data_t *make_return(koopa_raw_value_t value) {
+  auto v = new_value(type_unit(), KOOPA_RVT_RETURN);
+  v->kind.data.ret.value = value;
+  return v;
+}
+
+inline koopa_raw_value_data_t *make_block_arg(koopa_raw_type_t ty, size_t index) {
+  auto v = new_value(ty, KOOPA_RVT_BLOCK_ARG_REF);
+  v->kind.data.block_arg_ref.index = index;
+  return v;
+}
+
+// 新建一个空基本块, 名字形如 %hint_N
+inline koopa_raw_basic_block_data_t *make_block(const std::string &hint) {
+  ir_block_pool.emplace_back();
+  auto &bb = ir_block_pool.back();
+  bb.name = make_name("%" + hint + "_" + std::to_string(ir_block_cnt++));
+  bb.params = empty_slice(KOOPA_RSIK_VALUE);
+  bb.used_by = empty_slice(KOOPA_RSIK_VALUE);
+  bb.insts = empty_slice(KOOPA_RSIK_VALUE);
+  return &bb;
+}
+
+// ---------- 函数 ----------
+
+inline koopa_raw_type_t type_function(const std::vector<koopa_raw_type_t> &params, koopa_raw_type_t ret) {
+  auto ty = const_cast<koopa_raw_type_kind_t *>(make_type(KOOPA_RTT_FUNCTION));
+  ty->data.function.params = make_slice(params, KOOPA_RSIK_TYPE);
+  ty->data.function.ret = ret;
+  return ty;
+}
+
+inline koopa_raw_value_data_t *make_func_arg(koopa_raw_type_t ty, size_t index, const char *name) {
+  auto v = new_value(ty, KOOPA_RVT_FUNC_ARG_REF);
+  v->name = name;
+  v->kind.data.func_arg_ref.index = index;
+  return v;
+}
+
+// 新建一个没有基本块的函数, 形参按params的类型和名字创建
+inline koopa_raw_function_data_t *make_function(const std::string &name, koopa_raw_type_t ret,
+                                                const std::vector<koopa_raw_value_t> &params) {
+  ir_func_pool.emplace_back();
+  auto &f = ir_func_pool.back();
+  std::vector<koopa_raw_type_t> types;
+  std::vector<koopa_raw_value_t> args;
+  for (auto p : params) {
+    types.push_back(p->ty);
+    args.push_back(make_func_arg(p->ty, args.size(), p->name));
+  }
+  f.ty = type_function(types, ret);
+  f.name = make_name(name);
+  f.params = make_slice(args, KOOPA_RSIK_VALUE);
+  f.bbs = empty_slice(KOOPA_RSIK_BASIC_BLOCK);
+  return &f;
+}
+
+// 把f插到程序的函数列表中pos之后
+inline void insert_function(const koopa_raw_program_t &program, koopa_raw_function_t f, koopa_raw_function_t pos) {
+  auto funcs = slice_items<koopa_raw_function_t>(program.funcs);
+  funcs.insert(std::find(funcs.begin(), funcs.end(), pos) + 1, f);
+  const_cast<koopa_raw_program_t &>(program).funcs = make_slice(funcs, KOOPA_RSIK_FUNCTION);
+}
+
+// ---------- 全局变量 ----------
+
+// 新建一个初值为0的全局变量
+inline koopa_raw_value_data_t *make_global(const std::string &name, koopa_raw_type_t base) {
+  auto v = new_value(type_pointer(base), KOOPA_RVT_GLOBAL_ALLOC);
+  v->name = make_name(name);
+  v->kind.data.global_alloc.init = new_value(base, KOOPA_RVT_ZERO_INIT);
+  return v;
+}
+
+// 把全局变量v加到程序的全局变量列表末尾
+inline void append_global(const koopa_raw_program_t &program, koopa_raw_value_t v) {
+  auto values = slice_items<koopa_raw_value_t>(program.values);
+  values.push_back(v);
+  const_cast<koopa_raw_program_t &>(program).values = make_slice(values, KOOPA_RSIK_VALUE);
+}
+
+// 新建函数或全局变量用的名字 prefix + N, N是程序的函数和全局变量都没有使用的最小序号
+// (函数和全局变量在汇编中共用标号, 所以两个列表都要检查)
+inline std::string unique_name(const koopa_raw_program_t &program, const std::string &prefix) {
+  std::unordered_set<std::string> used;
+  for (auto f : slice_items<koopa_raw_function_t>(program.funcs)) used.insert(f->name);
+  for (auto v : slice_items<koopa_raw_value_t>(program.values)) {
+    if (v->name) used.insert(v->name);
+  }
+  for (int n = 0;; ++n) {
+    auto name = prefix + std::to_string(n);
+    if (!used.count(name)) return name;
+  }
+}
+
+// ---------- 常量折叠 ----------
+
+// 按RISC-V的32位语义计算 lhs op rhs, 除数为0时不折叠
+inline bool fold_binary(koopa_raw_binary_op_t op, int32_t lhs, int32_t rhs, int32_t &result) {
+  uint32_t a = lhs, b = rhs;
+  switch (op) {
+    case KOOPA_RBO_NOT_EQ: result = lhs != rhs; break;
+    case KOOPA_RBO_EQ: result = lhs == rhs; break;
+    case KOOPA_RBO_GT: result = lhs > rhs; break;
+    case KOOPA_RBO_LT: result = lhs < rhs; break;
+    case KOOPA_RBO_GE: result = lhs >= rhs; break;
+    case KOOPA_RBO_LE: result = lhs <= rhs; break;
+    case KOOPA_RBO_ADD: result = int32_t(a + b); break;
+    case KOOPA_RBO_SUB: result = int32_t(a - b); break;
+    case KOOPA_RBO_MUL: result = int32_t(a * b); break;
+    case KOOPA_RBO_DIV:
+      if (rhs == 0) return false;
+      // 溢出时与div指令的结果一致
+      result = (lhs == INT32_MIN && rhs == -1) ? INT32_MIN : lhs / rhs;
+      break;
+    case KOOPA_RBO_MOD:
+      if (rhs == 0) return false;
+      result = (lhs == INT32_MIN && rhs == -1) ? 0 : lhs % rhs;
+      break;
+    case KOOPA_RBO_AND: result = lhs & rhs; break;
+    case KOOPA_RBO_OR: result = lhs | rhs; break;
+    case KOOPA_RBO_XOR: result = lhs ^ rhs; break;
+    case KOOPA_RBO_SHL: result = int32_t(a << (b & 31)); break;
+    case KOOPA_RBO_SHR: result = int32_t(a >> (b & 31)); break;
+    case KOOPA_RBO_SAR: result = lhs >> (b & 31); break;
+    default: return false;
+  }
+  return true;
+}
+
+inline bool is_commutative(koopa_raw_binary_op_t op) {
+  switch (op) {
+    case KOOPA_RBO_NOT_EQ:
+    case KOOPA_RBO_EQ:
+    case KOOPA_RBO_ADD:
+    case KOOPA_RBO_MUL:
+    case KOOPA_RBO_AND:
+    case KOOPA_RBO_OR:
+    case KOOPA_RBO_XOR:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// ---------- 指令的操作数 ----------
+
+inline bool is_terminator(koopa_raw_value_t v) {
+  auto tag = v->kind.tag;
+  return tag == KOOPA_RVT_BRANCH || tag == KOOPA_RVT_JUMP || tag == KOOPA_RVT_RETURN;
+}
+
+// 用f的返回值替换v的每个操作数, 包括跳转和调用的实参
+template <typename F>
+void map_operands(koopa_raw_value_t value, F f) {
+  auto v = mut(value);
+  auto &kind = v->kind;
+  auto map_slice = [&](koopa_raw_slice_t &slice) {
+    for (uint32_t i = 0; i < slice.len; ++i) {
+      slice.buffer[i] = f(reinterpret_cast<koopa_raw_value_t>(slice.buffer[i]));
+    }
+  };
+  switch (kind.tag) {
+    case KOOPA_RVT_LOAD:
+      kind.data.load.src = f(kind.data.load.src);
+      break;
+    case KOOPA_RVT_STORE:
+      kind.data.store.value = f(kind.data.store.value);
+      kind.data.store.dest = f(kind.data.store.dest);
+      break;
+    case KOOPA_RVT_GET_PTR:
+      kind.data.get_ptr.src = f(kind.data.get_ptr.src);
+      kind.data.get_ptr.index = f(kind.data.get_ptr.index);
+      break;
+    case KOOPA_RVT_GET_ELEM_PTR:
+      kind.data.get_elem_ptr.src = f(kind.data.get_elem_ptr.src);
+      kind.data.get_elem_ptr.index = f(kind.data.get_elem_ptr.index);
+      break;
+    case KOOPA_RVT_BINARY:
+      kind.data.binary.lhs = f(kind.data.binary.lhs);
+      kind.data.binary.rhs = f(kind.data.binary.rhs);
+      break;
+    case KOOPA_RVT_BRANCH:
+      kind.data.branch.cond = f(kind.data.branch.cond);
+      map_slice(kind.data.branch.true_args);
+      map_slice(kind.data.branch.false_args);
+      break;
+    case KOOPA_RVT_JUMP:
+      map_slice(kind.data.jump.args);
+      break;
+    case KOOPA_RVT_CALL:
+      map_slice(kind.data.call.args);
+      break;
+    case KOOPA_RVT_RETURN:
+      if (kind.data.ret.value != nullptr) {
+        kind.data.ret.value = f(kind.data.ret.value);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+inline std::vector<koopa_raw_value_t> operands(koopa_raw_value_t value) {
+  std::vector<koopa_raw_value_t> ops;
+  map_operands(value, [&](koopa_raw_value_t op) {
+    ops.push_back(op);
+    return op;
+  });
+  return ops;
+}
+
+// 会写内存, 调用函数或改变控制流的指令
+inline bool has_side_effect(koopa_raw_value_t v) {
+  auto tag = v->kind.tag;
+  return tag == KOOPA_RVT_STORE || tag == KOOPA_RVT_CALL || is_terminator(v);
+}
+
+// 函数内定义的值(指令与基本块参数), 常量/全局变量/函数参数之外的值
+inline bool is_local_value(koopa_raw_value_t v) {
+  switch (v->kind.tag) {
+    case KOOPA_RVT_INTEGER:
+    case KOOPA_RVT_ZERO_INIT:
+    case KOOPA_RVT_UNDEF:
+    case KOOPA_RVT_AGGREGATE:
+    case KOOPA_RVT_FUNC_ARG_REF:
+    case KOOPA_RVT_GLOBAL_ALLOC:
+      return false;
+    default:
+      return true;
+  }
+}
+
+// ---------- 基本块与函数 ----------
+
+inline std::vector<koopa_raw_value_t> bb_insts(koopa_raw_basic_block_t bb) {
+  return slice_items<koopa_raw_value_t>(bb->insts);
+}
+
+inline void set_bb_insts(koopa_raw_basic_block_t bb, const std::vector<koopa_raw_value_t> &insts) {
+  mut(bb)->insts = make_slice(insts, KOOPA_RSIK_VALUE);
+}
+
+inline std::vector<koopa_raw_value_t> bb_params(koopa_raw_basic_block_t bb) {
+  return slice_items<koopa_raw_value_t>(bb->params);
+}
+
+// 设置基本块参数, 同时更新参数的序号
+inline void set_bb_params(koopa_raw_basic_block_t bb, const std::vector<koopa_raw_value_t> &params) {
+  for (size_t i = 0; i < params.size(); ++i) {
+    mut(params[i])->kind.data.block_arg_ref.index = i;
+  }
+  mut(bb)->params = make_slice(params, KOOPA_RSIK_VALUE);
+}
+
+inline std::vector<koopa_raw_basic_block_t> func_blocks(koopa_raw_function_t func) {
+  return slice_items<koopa_raw_basic_block_t>(func->bbs);
+}
+
+inline void set_func_blocks(koopa_raw_function_t func, const std::vector<koopa_raw_basic_block_t> &bbs) {
+  mut(func)->bbs = make_slice(bbs, KOOPA_RSIK_BASIC_BLOCK);
+}
+
+inline koopa_raw_value_t terminator(koopa_raw_basic_block_t bb) {
+  if (bb->insts.len == 0) return nullptr;
+  auto last = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[bb->insts.len - 1]);
+  return is_terminator(last) ? last : nullptr;
+}
+
+// 终结指令的后继, br的两个目标相同时会出现两次
+inline std::vector<koopa_raw_basic_block_t> successors(koopa_raw_basic_block_t bb) {
+  auto term = terminator(bb);
+  if (term == nullptr) return {};
+  if (term->kind.tag == KOOPA_RVT_BRANCH) {
+    return {term->kind.data.branch.true_bb, term->kind.data.branch.false_bb};
+  }
+  if (term->kind.tag == KOOPA_RVT_JUMP) {
+    return {term->kind.data.jump.target};
+  }
+  return {};
+}
+
+// 终结指令第i条出边上的实参
+inline koopa_raw_slice_t &edge_args(koopa_raw_value_t term, int i) {
+  auto &kind = mut(term)->kind;
+  if (kind.tag == KOOPA_RVT_JUMP) return kind.data.jump.args;
+  return i == 0 ? kind.data.branch.true_args : kind.data.branch.false_args;
+}
+
+inline koopa_raw_basic_block_t &edge_target(koopa_raw_value_t term, int i) {
+  auto &kind = mut(term)->kind;
+  if (kind.tag == KOOPA_RVT_JUMP) return kind.data.jump.target;
+  return i == 0 ? kind.data.branch.true_bb : kind.data.branch.false_bb;
+}
+
+inline int edge_count(koopa_raw_value_t term) {
+  if (term == nullptr) return 0;
+  if (term->kind.tag == KOOPA_RVT_BRANCH) return 2;
+  if (term->kind.tag == KOOPA_RVT_JUMP) return 1;
+  return 0;
+}
+
+// 在边的实参末尾追加一个实参
+inline void append_edge_arg(koopa_raw_value_t term, int i, koopa_raw_value_t arg) {
+  auto args = slice_items<koopa_raw_value_t>(edge_args(term, i));
+  args.push_back(arg);
+  edge_args(term, i) = make_slice(args, KOOPA_RSIK_VALUE);
+}
+
+// 在基本块的终结指令之前插入指令
+inline void insert_before_terminator(koopa_raw_basic_block_t bb, const std::vector<koopa_raw_value_t> &new_insts) {
+  auto insts = bb_insts(bb);
+  insts.insert(insts.end() - 1, new_insts.begin(), new_insts.end());
+  set_bb_insts(bb, insts);
+}
+
+// ---------- CFG ----------
+
+class CFG {
+ public:
+  koopa_raw_function_t func;
+  // 可达基本块的逆后序, rpo[0]为入口
+  std::vector<koopa_raw_basic_block_t> rpo;
+  std::unordered_map<koopa_raw_basic_block_t, int> order;
+  // 每条边记一次, 因此br的两个目标相同时前驱会出现两次
+  std::unordered_map<koopa_raw_basic_block_t, std::vector<koopa_raw_basic_block_t>> preds, succs;
+
+  explicit CFG(koopa_raw_function_t f) : func(f) {
+    auto bbs = func_blocks(func);
+    for (auto bb : bbs) {
+      succs[bb] = successors(bb);
+      preds[bb];
+    }
+    for (auto bb : bbs) {
+      for (auto s : succs[bb]) {
+        preds[s].push_back(bb);
+      }
+    }
+    if (bbs.empty()) return;
+    // 迭代DFS求后序
+    std::vector<koopa_raw_basic_block_t> post;
+    std::unordered_set<koopa_raw_basic_block_t> visited;
+    std::vector<std::pair<koopa_raw_basic_block_t, size_t>> stack;
+    stack.emplace_back(bbs[0], 0);
+    visited.insert(bbs[0]);
+    while (!stack.empty()) {
+      auto &top = stack.back();
+      auto &ss = succs[top.first];
+      if (top.second < ss.size()) {
+        auto s = ss[top.second++];
+        if (visited.insert(s).second) {
+          stack.emplace_back(s, 0);
+        }
+      } else {
+        post.push_back(top.first);
+        stack.pop_back();
+      }
+    }
+    rpo.assign(post.rbegin(), post.rend());
+    for (size_t i = 0; i < rpo.size(); ++i) {
+      order[rpo[i]] = i;
+    }
+  }
+
+  bool reachable(koopa_raw_basic_block_t bb) const { return order.count(bb) != 0; }
+  koopa_raw_basic_block_t entry() const { return rpo[0]; }
+};
+
+// 支配树 (Cooper-Harvey-Kennedy 迭代算法), 只包含可达基本块
+class DomTree {
+ public:
+  std::unordered_map<koopa_raw_basic_block_t, koopa_raw_basic_block_t> idom;
+  std::unordered_map<koopa_raw_basic_block_t, std::vector<koopa_raw_basic_block_t>> children;
+
+  explicit DomTree(const CFG &cfg) {
+    if (cfg.rpo.empty()) return;
+    auto entry = cfg.entry();
+    idom[entry] = entry;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (size_t i = 1; i < cfg.rpo.size(); ++i) {
+        auto bb = cfg.rpo[i];
+        koopa_raw_basic_block_t new_idom = nullptr;
+        for (auto p : cfg.preds.at(bb)) {
+          if (!cfg.reachable(p) || idom.count(p) == 0) continue;
+          new_idom = new_idom == nullptr ? p : intersect(cfg, p, new_idom);
+        }
+        auto it = idom.find(bb);
+        if (it == idom.end() || it->second != new_idom) {
+          idom[bb] = new_idom;
+          changed = true;
+        }
+      }
+    }
+    for (auto bb : cfg.rpo) {
+      children[bb];
+      if (bb != entry) children[idom[bb]].push_back(bb);
+    }
+    // 先序/后序编号, 用于O(1)判断支配关系
+    int clock = 0;
+    std::vector<std::pair<koopa_raw_basic_block_t, size_t>> stack;
+    stack.emplace_back(entry, 0);
+    pre[entry] = clock++;
+    while (!stack.empty()) {
+      auto &top = stack.back();
+      auto &cs = children[top.first];
+      if (top.second < cs.size()) {
+        auto c = cs[top.second++];
+        pre[c] = clock++;
+        stack.emplace_back(c, 0);
+      } else {
+        post[top.first] = clock++;
+        stack.pop_back();
+      }
+    }
+  }
+
+  // a是否支配b
+  bool dominates(koopa_raw_basic_block_t a, koopa_raw_basic_block_t b) const {
+    auto pa = pre.find(a), pb = pre.find(b);
+    if (pa == pre.end() || pb == pre.end()) return false;
+    return pa->second <= pb->second && post.at(b) <= post.at(a);
+  }
+
+  // 支配边界
+  std::unordered_map<koopa_raw_basic_block_t, std::vector<koopa_raw_basic_block_t>> frontier(const CFG &cfg) const {
+    std::unordered_map<koopa_raw_basic_block_t, std::vector<koopa_raw_basic_block_t>> df;
+    for (auto bb : cfg.rpo) {
+      df[bb];
+    }
+    for (auto bb : cfg.rpo) {
+      auto &ps = cfg.preds.at(bb);
+      if (ps.size() < 2) continue;
+      for (auto p : ps) {
+        if (!cfg.reachable(p)) continue;
+        auto runner = p;
+        while (runner != idom.at(bb)) {
+          auto &f = df[runner];
+          if (f.empty() || f.back() != bb) f.push_back(bb);
+          runner = idom.at(runner);
+        }
+      }
+    }
+    return df;
+  }
+
+ private:
+  std::unordered_map<koopa_raw_basic_block_t, int> pre, post;
+
+  koopa_raw_basic_block_t intersect(const CFG &cfg, koopa_raw_basic_block_t a, koopa_raw_basic_block_t b) {
+    while (a != b) {
+      while (cfg.order.at(a) > cfg.order.at(b)) a = idom[a];
+      while (cfg.order.at(b) > cfg.order.at(a)) b = idom[b];
+    }
+    return a;
+  }
+};
+
+// ---------- 常用变换 ----------
+
+// 删除从入口不可达的基本块, 返回是否有改动
+inline bool remove_unreachable_blocks(koopa_raw_function_t func) {
+  CFG cfg(func);
+  auto bbs = func_blocks(func);
+  if (cfg.rpo.size() == bbs.size()) return false;
+  std::vector<koopa_raw_basic_block_t> kept;
+  for (auto bb : bbs) {
+    if (cfg.reachable(bb)) kept.push_back(bb);
+  }
+  set_func_blocks(func, kept);
+  return true;
+}
+
+// 按照repl替换func中所有对值的使用, 会沿着替换链找到最终的值
+inline void replace_uses(koopa_raw_function_t func,
+                         const std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> &repl) {
+  if (repl.empty()) return;
+  auto resolve = [&](koopa_raw_value_t v) {
+    auto it = repl.find(v);
+    while (it != repl.end()) {
+      v = it->second;
+      it = repl.find(v);
+    }
+    return v;
+  };
+  for (auto bb : func_blocks(func)) {
+    for (auto inst : bb_insts(bb)) {
+      map_operands(inst, resolve);
+    }
+  }
+}
+
+// 每个值的使用者列表 (按指令计, 一条指令多次使用同一个值时重复出现)
+inline std::unordered_map<koopa_raw_value_t, std::vector<koopa_raw_value_t>> build_users(koopa_raw_function_t func) {
+  std::unordered_map<koopa_raw_value_t, std::vector<koopa_raw_value_t>> users;
+  for (auto bb : func_blocks(func)) {
+    for (auto inst : bb_insts(bb)) {
+      for (auto op : operands(inst)) {
+        users[op].push_back(inst);
+      }
+    }
+  }
+  return users;
+}
+
+// 指令所在的基本块
+inline std::unordered_map<koopa_raw_value_t, koopa_raw_basic_block_t> build_inst_blocks(koopa_raw_function_t func) {
+  std::unordered_map<koopa_raw_value_t, koopa_raw_basic_block_t> where;
+  for (auto bb : func_blocks(func)) {
+    for (auto p : bb_params(bb)) {
+      where[p] = bb;
+    }
+    for (auto inst : bb_insts(bb)) {
+      where[inst] = bb;
+    }
+  }
+  return where;
+}
+
+// 删除没有被任何实参使用的基本块参数 (包括只在环上互相传递的参数)
+inline bool remove_dead_block_params(koopa_raw_function_t func) {
+  auto bbs = func_blocks(func);
+  std::unordered_set<koopa_raw_value_t> live;
+  std::vector<koopa_raw_value_t> worklist;
+  auto mark = [&](koopa_raw_value_t v) {
+    if (v->kind.tag == KOOPA_RVT_BLOCK_ARG_REF && live.insert(v).second) {
+      worklist.push_back(v);
+    }
+  };
+  // 参数 -> 所有传给它的实参
+  std::unordered_map<koopa_raw_value_t, std::vector<koopa_raw_value_t>> incoming;
+  for (auto bb : bbs) {
+    for (auto inst : bb_insts(bb)) {
+      if (inst->kind.tag == KOOPA_RVT_JUMP || inst->kind.tag == KOOPA_RVT_BRANCH) {
+        if (inst->kind.tag == KOOPA_RVT_BRANCH) mark(inst->kind.data.branch.cond);
+        for (int i = 0; i < edge_count(inst); ++i) {
+          auto params = bb_params(edge_target(inst, i));
+          auto args = slice_items<koopa_raw_value_t>(edge_args(inst, i));
+          for (size_t j = 0; j < args.size() && j < params.size(); ++j) {
+            incoming[params[j]].push_back(args[j]);
+          }
+        }
+      } else {
+        for (auto op : operands(inst)) {
+          mark(op);
+        }
+      }
+    }
+  }
+  while (!worklist.empty()) {
+    auto p = worklist.back();
+    worklist.pop_back();
+    for (auto a : incoming[p]) {
+      mark(a);
+    }
+  }
+  bool changed = false;
+  for (auto bb : bbs) {
+    auto params = bb_params(bb);
+    std::vector<bool> keep(params.size());
+    bool any_dead = false;
+    for (size_t i = 0; i < params.size(); ++i) {
+      keep[i] = live.count(params[i]) != 0;
+      any_dead |= !keep[i];
+    }
+    if (!any_dead) continue;
+    changed = true;
+    std::vector<koopa_raw_value_t> kept;
+    for (size_t i = 0; i < params.size(); ++i) {
+      if (keep[i]) kept.push_back(params[i]);
+    }
+    set_bb_params(bb, kept);
+    for (auto pred : bbs) {
+      auto term = terminator(pred);
+      for (int e = 0; e < edge_count(term); ++e) {
+        if (edge_target(term, e) != bb) continue;
+        auto args = slice_items<koopa_raw_value_t>(edge_args(term, e));
+        std::vector<koopa_raw_value_t> new_args;
+        for (size_t i = 0; i < args.size(); ++i) {
+          if (keep[i]) new_args.push_back(args[i]);
+        }
+        edge_args(term, e) = make_slice(new_args, KOOPA_RSIK_VALUE);
+      }
+    }
+  }
+  return changed;
+}
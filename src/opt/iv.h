@@ -0,0 +1,159 @@
+#pragma once
+#include "ir.h"
+#include "loop.h"
+
+// 归纳变量分析
+// 基本归纳变量: header的参数p, 从preheader传入初值init, 每条回边传入 p 或 p + step (step为常量)
+// 仿射表达式: 循环中的值若等于 coef * p + off + inv (coef, off为常量, inv为循环不变量), 就用Affine表示
+
+// 进入header的回边 (终结指令, 出边序号)
+struct LatchEdge {
+  koopa_raw_value_t term;
+  int edge;
+};
+
+struct InductionVar {
+  koopa_raw_value_t param;
+  size_t index;
+  koopa_raw_value_t init;
+  // 与latch_edges一一对应
+  std::vector<int32_t> steps;
+};
+
+inline std::vector<LatchEdge> latch_edges(const Loop *loop) {
+  std::vector<LatchEdge> edges;
+  for (auto latch : loop->latches) {
+    auto term = terminator(latch);
+    for (int e = 0; e < edge_count(term); ++e) {
+      if (edge_target(term, e) == loop->header) edges.push_back({term, e});
+    }
+  }
+  return edges;
+}
+
+// 需要循环有preheader
+inline std::vector<InductionVar> find_induction_vars(const Loop *loop) {
+  std::vector<InductionVar> ivs;
+  if (loop->preheader == nullptr) return ivs;
+  auto params = bb_params(loop->header);
+  auto entry = terminator(loop->preheader);
+  auto edges = latch_edges(loop);
+  for (size_t i = 0; i < params.size(); ++i) {
+    InductionVar iv{params[i], i, slice_items<koopa_raw_value_t>(entry->kind.data.jump.args)[i], {}};
+    bool ok = true;
+    for (auto &le : edges) {
+      auto arg = slice_items<koopa_raw_value_t>(edge_args(le.term, le.edge))[i];
+      if (arg == iv.param) {
+        iv.steps.push_back(0);
+        continue;
+      }
+      if (arg->kind.tag != KOOPA_RVT_BINARY) {
+        ok = false;
+        break;
+      }
+      const auto &b = arg->kind.data.binary;
+      if (b.op == KOOPA_RBO_ADD && b.lhs == iv.param && is_integer(b.rhs)) {
+        iv.steps.push_back(int_value(b.rhs));
+      } else if (b.op == KOOPA_RBO_ADD && b.rhs == iv.param && is_integer(b.lhs)) {
+        iv.steps.push_back(int_value(b.lhs));
+      } else if (b.op == KOOPA_RBO_SUB && b.lhs == iv.param && is_integer(b.rhs)) {
+        iv.steps.push_back(int32_t(0u - uint32_t(int_value(b.rhs))));
+      } else {
+        ok = false;
+        break;
+      }
+    }
+    if (ok) ivs.push_back(iv);
+  }
+  return ivs;
+}
+
+// coef * iv + off + inv, iv为nullptr时是循环不变量
+struct Affine {
+  koopa_raw_value_t iv = nullptr;
+  int32_t coef = 0;
+  int32_t off = 0;
+  koopa_raw_value_t inv = nullptr;
+};
+
+class AffineAnalysis {
+ public:
+  AffineAnalysis(const Loop *l, const std::vector<InductionVar> &ivs,
+                 const std::unordered_map<koopa_raw_value_t, koopa_raw_basic_block_t> &w)
+      : loop(l), where(w) {
+    for (auto &iv : ivs) is_iv.insert(iv.param);
+  }
+
+  // 不是仿射表达式时返回false
+  bool get(koopa_raw_value_t v, Affine &result) {
+    auto it = memo.find(v);
+    if (it != memo.end()) {
+      result = it->second.second;
+      return it->second.first;
+    }
+    bool ok = compute(v, result);
+    memo[v] = {ok, result};
+    return ok;
+  }
+
+  bool is_invariant(koopa_raw_value_t v) const {
+    if (!is_local_value(v)) return true;
+    auto it = where.find(v);
+    return it != where.end() && !loop->contains(it->second);
+  }
+
+ private:
+  const Loop *loop;
+  const std::unordered_map<koopa_raw_value_t, koopa_raw_basic_block_t> &where;
+  std::unordered_set<koopa_raw_value_t> is_iv;
+  std::unordered_map<koopa_raw_value_t, std::pair<bool, Affine>> memo;
+
+  static int32_t wrap_add(int32_t a, int32_t b) { return int32_t(uint32_t(a) + uint32_t(b)); }
+  static int32_t wrap_mul(int32_t a, int32_t b) { return int32_t(uint32_t(a) * uint32_t(b)); }
+
+  bool compute(koopa_raw_value_t v, Affine &r) {
+    r = Affine();
+    if (is_integer(v)) {
+      r.off = int_value(v);
+      return true;
+    }
+    if (is_iv.count(v)) {
+      r.iv = v;
+      r.coef = 1;
+      return true;
+    }
+    if (is_invariant(v)) {
+      if (v->ty->tag != KOOPA_RTT_INT32) return false;
+      r.inv = v;
+      return true;
+    }
+    if (v->kind.tag != KOOPA_RVT_BINARY) return false;
+    const auto &b = v->kind.data.binary;
+    Affine x, y;
+    if (!get(b.lhs, x) || !get(b.rhs, y)) return false;
+    switch (b.op) {
+      case KOOPA_RBO_ADD:
+      case KOOPA_RBO_SUB: {
+        if (x.iv && y.iv && x.iv != y.iv) return false;
+        int32_t sign = b.op == KOOPA_RBO_ADD ? 1 : -1;
+        if (y.inv && (x.inv || sign < 0)) return false;
+        r.iv = x.iv ? x.iv : y.iv;
+        r.coef = wrap_add(x.coef, wrap_mul(sign, y.coef));
+        r.off = wrap_add(x.off, wrap_mul(sign, y.off));
+        r.inv = x.inv ? x.inv : y.inv;
+        return true;
+      }
+      case KOOPA_RBO_MUL: {
+        if (y.iv || y.inv) std::swap(x, y);
+        // 另一边必须是常量
+        if (y.iv || y.inv || x.inv) return false;
+        r.iv = x.iv;
+        r.coef = wrap_mul(x.coef, y.off);
+        r.off = wrap_mul(x.off, y.off);
+        return true;
+      }
+      default:
+        return false;
+    }
+  }
+};
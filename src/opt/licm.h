@@ -0,0 +1,118 @@
+#pragma once
+#include "ir.h"
+#include "loop.h"
+#include "modref.h"
+
+// 循环不变量外提: 由内到外处理每个循环, 把操作数都在循环外定义的纯计算移动到preheader中
+// load还要求循环中没有可能写同一地址的store或call, 并且提前执行是安全的:
+// load所在的基本块支配循环的所有出口, 或者地址一定落在某个alloc/全局数组之内
+// 对纯函数 (见modref.h) 的调用和纯计算一样只依赖实参, 但可能不终止或除以0, 同样要求支配所有出口
+
+// 地址是alloc/全局变量经过常量下标的getelemptr得到的, 且下标不越界
+inline bool is_in_bounds(koopa_raw_value_t addr) {
+  while (addr->kind.tag == KOOPA_RVT_GET_ELEM_PTR) {
+    const auto &gep = addr->kind.data.get_elem_ptr;
+    auto array = gep.src->ty->data.pointer.base;
+    if (!is_integer(gep.index) || int_value(gep.index) < 0 || size_t(int_value(gep.index)) >= array->data.array.len) {
+      return false;
+    }
+    addr = gep.src;
+  }
+  return is_identified_object(addr);
+}
+
+class LICM {
+ public:
+  explicit LICM(koopa_raw_function_t f) : func(f) {}
+
+  // 返回外提的指令数量
+  int run() {
+    insert_preheaders(func);
+    LoopInfo li(func);
+    where = build_inst_blocks(func);
+    int cnt = 0;
+    for (auto loop : li.loops) {
+      cnt += hoist(li, loop);
+    }
+    return cnt;
+  }
+
+ private:
+  koopa_raw_function_t func;
+  std::unordered_map<koopa_raw_value_t, koopa_raw_basic_block_t> where;
+
+  bool is_invariant(const Loop *loop, koopa_raw_value_t v) {
+    return !is_local_value(v) || !loop->contains(where[v]);
+  }
+
+  int hoist(const LoopInfo &li, const Loop *loop) {
+    auto pre = loop->preheader;
+    if (pre == nullptr) return 0;
+    auto bbs = li.loop_blocks(loop);
+    auto exiting = li.exiting_blocks(loop);
+    std::vector<koopa_raw_value_t> stores, calls;
+    for (auto bb : bbs) {
+      for (auto inst : bb_insts(bb)) {
+        if (inst->kind.tag == KOOPA_RVT_STORE) stores.push_back(inst);
+        if (inst->kind.tag == KOOPA_RVT_CALL) calls.push_back(inst);
+      }
+    }
+
+    std::vector<koopa_raw_value_t> hoisted;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (auto bb : bbs) {
+        std::vector<koopa_raw_value_t> kept;
+        for (auto inst : bb_insts(bb)) {
+          if (can_hoist(li, loop, bb, inst, exiting, stores, calls)) {
+            hoisted.push_back(inst);
+            where[inst] = pre;
+            changed = true;
+          } else {
+            kept.push_back(inst);
+          }
+        }
+        set_bb_insts(bb, kept);
+      }
+    }
+    if (hoisted.empty()) return 0;
+    auto insts = bb_insts(pre);
+    insts.insert(insts.end() - 1, hoisted.begin(), hoisted.end());
+    set_bb_insts(pre, insts);
+    return hoisted.size();
+  }
+
+  bool can_hoist(const LoopInfo &li, const Loop *loop, koopa_raw_basic_block_t bb, koopa_raw_value_t inst,
+                 const std::vector<koopa_raw_basic_block_t> &exiting, const std::vector<koopa_raw_value_t> &stores,
+                 const std::vector<koopa_raw_value_t> &calls) {
+    auto tag = inst->kind.tag;
+    bool pure_call = tag == KOOPA_RVT_CALL && modref(inst->kind.data.call.callee).pure();
+    if (tag != KOOPA_RVT_BINARY && tag != KOOPA_RVT_GET_PTR && tag != KOOPA_RVT_GET_ELEM_PTR &&
+        tag != KOOPA_RVT_LOAD && !pure_call) {
+      return false;
+    }
+    for (auto op : operands(inst)) {
+      if (!is_invariant(loop, op)) return false;
+    }
+    if (tag != KOOPA_RVT_LOAD && !pure_call) return true;
+
+    if (tag == KOOPA_RVT_LOAD) {
+      auto addr = inst->kind.data.load.src;
+      for (auto store : stores) {
+        if (may_alias(store->kind.data.store.dest, addr)) return false;
+      }
+      for (auto call : calls) {
+        if (call_may_write(call, addr)) return false;
+      }
+      if (is_in_bounds(addr)) return true;
+    }
+    if (exiting.empty()) return false;
+    for (auto e : exiting) {
+      if (!li.dt.dominates(bb, e)) return false;
+    }
+    return true;
+  }
+};
+
+inline int licm(koopa_raw_function_t func) { return LICM(func).run(); }
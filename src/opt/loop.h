@@ -0,0 +1,170 @@
+#pragma once
+#include <deque>
+#include "ir.h"
+
+// 自然循环: 回边 latch -> header 中header支配latch, 循环体是能不经过header到达latch的基本块
+struct Loop {
+  koopa_raw_basic_block_t header = nullptr;
+  // 循环外唯一的前驱, 且以jump结尾; 没有时为nullptr
+  koopa_raw_basic_block_t preheader = nullptr;
+  std::unordered_set<koopa_raw_basic_block_t> blocks;
+  std::vector<koopa_raw_basic_block_t> latches;
+  Loop *parent = nullptr;
+  std::vector<Loop *> children;
+  int depth = 1;
+
+  bool contains(koopa_raw_basic_block_t bb) const { return blocks.count(bb) != 0; }
+};
+
+class LoopInfo {
+ public:
+  CFG cfg;
+  DomTree dt;
+  // 由内到外的顺序, 内层循环总在外层循环之前
+  std::vector<Loop *> loops;
+  // 基本块所在的最内层循环
+  std::unordered_map<koopa_raw_basic_block_t, Loop *> loop_of;
+
+  explicit LoopInfo(koopa_raw_function_t func) : cfg(func), dt(cfg) {
+    std::unordered_map<koopa_raw_basic_block_t, Loop *> by_header;
+    // 按逆后序倒序遍历header, 内层循环的header一定更靠后
+    for (auto it = cfg.rpo.rbegin(); it != cfg.rpo.rend(); ++it) {
+      auto header = *it;
+      std::vector<koopa_raw_basic_block_t> latches;
+      for (auto p : cfg.preds.at(header)) {
+        if (cfg.reachable(p) && dt.dominates(header, p) &&
+            std::find(latches.begin(), latches.end(), p) == latches.end()) {
+          latches.push_back(p);
+        }
+      }
+      if (latches.empty()) continue;
+      pool.emplace_back();
+      Loop *loop = &pool.back();
+      loop->header = header;
+      loop->latches = latches;
+      loop->blocks.insert(header);
+      std::vector<koopa_raw_basic_block_t> worklist(latches.begin(), latches.end());
+      while (!worklist.empty()) {
+        auto bb = worklist.back();
+        worklist.pop_back();
+        if (!loop->blocks.insert(bb).second) continue;
+        for (auto p : cfg.preds.at(bb)) {
+          if (cfg.reachable(p)) worklist.push_back(p);
+        }
+      }
+      by_header[header] = loop;
+      loops.push_back(loop);
+    }
+    // 包含关系: 内层循环先创建, 所以第一个包含它的header的后续循环就是父循环
+    for (size_t i = 0; i < loops.size(); ++i) {
+      for (size_t j = i + 1; j < loops.size(); ++j) {
+        if (loops[j]->contains(loops[i]->header) && loops[j] != loops[i]) {
+          if (loops[i]->parent == nullptr || loops[i]->parent->blocks.size() > loops[j]->blocks.size()) {
+            loops[i]->parent = loops[j];
+          }
+        }
+      }
+    }
+    // loops按块数排序后, 内层循环一定在外层循环之前
+    std::stable_sort(loops.begin(), loops.end(), [](Loop *a, Loop *b) { return a->blocks.size() < b->blocks.size(); });
+    for (auto loop : loops) {
+      if (loop->parent) loop->parent->children.push_back(loop);
+      for (auto bb : loop->blocks) {
+        if (loop_of.count(bb) == 0) loop_of[bb] = loop;
+      }
+    }
+    for (auto it = loops.rbegin(); it != loops.rend(); ++it) {
+      auto loop = *it;
+      if (loop->parent) loop->depth = loop->parent->depth + 1;
+      std::vector<koopa_raw_basic_block_t> outside;
+      for (auto p : cfg.preds.at(loop->header)) {
+        if (cfg.reachable(p) && !loop->contains(p)) outside.push_back(p);
+      }
+      if (outside.size() == 1 && terminator(outside[0])->kind.tag == KOOPA_RVT_JUMP) {
+        loop->preheader = outside[0];
+      }
+    }
+  }
+
+  // 离开循环的边的目标 (循环外的基本块, 不重复)
+  std::vector<koopa_raw_basic_block_t> exit_blocks(const Loop *loop) const {
+    std::vector<koopa_raw_basic_block_t> exits;
+    for (auto bb : cfg.rpo) {
+      if (!loop->contains(bb)) continue;
+      for (auto s : cfg.succs.at(bb)) {
+        if (!loop->contains(s) && std::find(exits.begin(), exits.end(), s) == exits.end()) exits.push_back(s);
+      }
+    }
+    return exits;
+  }
+
+  // 有出边离开循环的基本块
+  std::vector<koopa_raw_basic_block_t> exiting_blocks(const Loop *loop) const {
+    std::vector<koopa_raw_basic_block_t> exiting;
+    for (auto bb : cfg.rpo) {
+      if (!loop->contains(bb)) continue;
+      for (auto s : cfg.succs.at(bb)) {
+        if (!loop->contains(s)) {
+          exiting.push_back(bb);
+          break;
+        }
+      }
+    }
+    return exiting;
+  }
+
+  // 循环中的基本块, 按逆后序排列
+  std::vector<koopa_raw_basic_block_t> loop_blocks(const Loop *loop) const {
+    std::vector<koopa_raw_basic_block_t> bbs;
+    for (auto bb : cfg.rpo) {
+      if (loop->contains(bb)) bbs.push_back(bb);
+    }
+    return bbs;
+  }
+
+ private:
+  std::deque<Loop> pool;
+};
+
+// 在基本块列表中把bb插到pos之前
+inline void insert_block_before(koopa_raw_function_t func, koopa_raw_basic_block_t bb, koopa_raw_basic_block_t pos) {
+  auto bbs = func_blocks(func);
+  bbs.insert(std::find(bbs.begin(), bbs.end(), pos), bb);
+  set_func_blocks(func, bbs);
+}
+
+// 为没有preheader的循环创建preheader, 返回创建的数量
+// 循环外只有一条边进入header时, preheader直接带着这条边的实参跳到header;
+// 否则preheader的参数与header相同, 循环外的边改为带着原来的实参跳到preheader
+inline int insert_preheaders(koopa_raw_function_t func) {
+  LoopInfo li(func);
+  int cnt = 0;
+  for (auto loop : li.loops) {
+    if (loop->preheader != nullptr) continue;
+    auto header = loop->header;
+    std::vector<std::pair<koopa_raw_value_t, int>> entries;
+    for (auto bb : func_blocks(func)) {
+      if (loop->contains(bb) || !li.cfg.reachable(bb)) continue;
+      auto term = terminator(bb);
+      for (int e = 0; e < edge_count(term); ++e) {
+        if (edge_target(term, e) == header) entries.emplace_back(term, e);
+      }
+    }
+    if (entries.empty()) continue;
+    auto pre = make_block("preheader");
+    if (entries.size() == 1) {
+      auto [term, e] = entries[0];
+      set_bb_insts(pre, {make_jump(header, slice_items<koopa_raw_value_t>(edge_args(term, e)))});
+      edge_args(term, e) = empty_slice(KOOPA_RSIK_VALUE);
+    } else {
+      std::vector<koopa_raw_value_t> params;
+      for (auto p : bb_params(header)) params.push_back(make_block_arg(p->ty, params.size()));
+      set_bb_params(pre, params);
+      set_bb_insts(pre, {make_jump(header, params)});
+    }
+    for (auto [term, e] : entries) edge_target(term, e) = pre;
+    insert_block_before(func, pre, header);
+    ++cnt;
+  }
+  return cnt;
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include "ir.h"
+#include "loop.h"
+#include "scev.h"
+#include "dce.h"
+#include "simplify_cfg.h"
+
+// 删除没有副作用的循环 (假定循环终止)
+// 1. 循环中的值在循环外都没有被使用: 直接从preheader跳到出口
+// 2. 循环外使用的值都是header中能用标量演化表示的值: 在preheader中计算迭代次数和它们的终值, 再跳到出口
+
+class LoopDeletion {
+ public:
+  explicit LoopDeletion(koopa_raw_function_t f) : func(f) {}
+
+  // 返回删除的循环数量
+  int run() {
+    int cnt = 0;
+    while (true) {
+      insert_preheaders(func);
+      LoopInfo li(func);
+      where = build_inst_blocks(func);
+      bool changed = false;
+      for (auto loop : li.loops) {
+        if (try_delete(li, loop)) {
+          ++cnt;
+          changed = true;
+          break;
+        }
+      }
+      if (!changed) break;
+      remove_unreachable_blocks(func);
+    }
+    return cnt;
+  }
+
+ private:
+  koopa_raw_function_t func;
+  std::unordered_map<koopa_raw_value_t, koopa_raw_basic_block_t> where;
+
+  bool in_loop(const Loop *loop, koopa_raw_value_t v) {
+    auto it = where.find(v);
+    return is_local_value(v) && it != where.end() && loop->contains(it->second);
+  }
+
+  bool try_delete(const LoopInfo &li, const Loop *loop) {
+    auto pre = loop->preheader;
+    if (pre == nullptr) return false;
+    for (auto bb : loop->blocks) {
+      for (auto inst : bb_insts(bb)) {
+        auto tag = inst->kind.tag;
+        if (tag == KOOPA_RVT_STORE || tag == KOOPA_RVT_ALLOC) return false;
+        if (tag == KOOPA_RVT_CALL && !is_side_effect_free(inst->kind.data.call.callee)) return false;
+      }
+    }
+    // 所有出边都到同一个基本块
+    koopa_raw_basic_block_t exit = nullptr;
+    std::vector<std::pair<koopa_raw_value_t, int>> exit_edges;
+    for (auto bb : loop->blocks) {
+      auto term = terminator(bb);
+      for (int e = 0; e < edge_count(term); ++e) {
+        auto target = edge_target(term, e);
+        if (loop->contains(target)) continue;
+        if (exit != nullptr && target != exit) return false;
+        exit = target;
+        exit_edges.emplace_back(term, e);
+      }
+    }
+    if (exit == nullptr) return false;
+
+    // 在循环外使用的循环中的值, 出边上的实参也算在内
+    std::vector<koopa_raw_value_t> used;
+    std::unordered_set<koopa_raw_value_t> seen;
+    auto use = [&](koopa_raw_value_t v) {
+      if (in_loop(loop, v) && seen.insert(v).second) used.push_back(v);
+    };
+    for (auto bb : func_blocks(func)) {
+      if (loop->contains(bb)) continue;
+      for (auto inst : bb_insts(bb)) {
+        for (auto op : operands(inst)) use(op);
+      }
+    }
+    for (auto [term, e] : exit_edges) {
+      for (auto arg : slice_items<koopa_raw_value_t>(edge_args(term, e))) use(arg);
+    }
+
+    std::vector<koopa_raw_value_t> pre_insts;
+    std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> repl;
+    if (!used.empty()) {
+      if (exit_edges.size() != 1 || where[exit_edges[0].first] != loop->header) return false;
+      ScalarEvolution se(loop, where, pre_insts);
+      auto n = se.trip_count();
+      if (n == nullptr) return false;
+      for (auto v : used) {
+        Chrec c;
+        if (where[v] != loop->header || !se.get(v, c)) return false;
+        repl[v] = se.evaluate(c, n);
+      }
+    } else {
+      // 各条出边的实参必须相同
+      for (auto [term, e] : exit_edges) {
+        if (!same_args(edge_args(term, e), edge_args(exit_edges[0].first, exit_edges[0].second))) return false;
+      }
+    }
+
+    auto args = slice_items<koopa_raw_value_t>(edge_args(exit_edges[0].first, exit_edges[0].second));
+    for (auto &arg : args) {
+      if (repl.count(arg)) arg = repl[arg];
+    }
+    auto insts = bb_insts(pre);
+    insts.pop_back();
+    insts.insert(insts.end(), pre_insts.begin(), pre_insts.end());
+    insts.push_back(make_jump(exit, args));
+    set_bb_insts(pre, insts);
+    replace_uses(func, repl);
+    return true;
+  }
+};
+
+inline int delete_loops(koopa_raw_function_t func) { return LoopDeletion(func).run(); }
@@ -0,0 +1,271 @@
+#pragma once
+#include <map>
+#include <tuple>
+#include "ir.h"
+#include "loop.h"
+#include "iv.h"
+#include "alias.h"
+#include "instcombine.h"
+
+// 循环强度削弱
+// 1. 循环中下标是归纳变量仿射表达式的getelemptr/getptr (基址为循环不变量) 改写为指针递推:
+//    header新增一个指针参数, 初值在preheader中计算, 每条回边上 getptr 指针, coef*step;
+//    新的指针参数向别名分析登记它的基对象
+// 2. 归纳变量的乘法 coef * i + off 改写为加法递推
+// 3. 计数器i除了自己的递增只被header的退出比较 i < n 使用时, 把比较改写到另一个仍被使用的整数递推
+//    r = coef * i + c 上 (见replace_exit_test), 计数器只剩环上的传递, 由随后的DCE删除
+//    Koopa IR的比较只能作用于i32, 只有指针递推的循环没法比较指针, 计数器保留
+//    改写后的 != 比较不能再部分展开, 所以这一步在展开之后单独执行 (rewrite_exit_tests)
+
+class LSR {
+ public:
+  explicit LSR(koopa_raw_function_t f) : func(f) {}
+
+  // 返回改写的指令数量
+  int run() {
+    insert_preheaders(func);
+    LoopInfo li(func);
+    where = build_inst_blocks(func);
+    int cnt = 0;
+    for (auto loop : li.loops) {
+      cnt += reduce(li, loop);
+    }
+    return cnt;
+  }
+
+  // 返回改写的退出比较数量; skip中的循环 (展开留下的余数循环) 迭代次数很少,
+  // 在它们的preheader中增加计算不划算
+  int run_exit_tests(const std::unordered_set<koopa_raw_basic_block_t> &skip) {
+    insert_preheaders(func);
+    LoopInfo li(func);
+    where = build_inst_blocks(func);
+    int cnt = 0;
+    for (auto loop : li.loops) {
+      if (!skip.count(loop->header)) cnt += replace_exit_test(loop);
+    }
+    return cnt;
+  }
+
+ private:
+  // (指令种类, 基址, 归纳变量, coef, off, inv)
+  typedef std::tuple<int, koopa_raw_value_t, koopa_raw_value_t, int32_t, int32_t, koopa_raw_value_t> key_t;
+
+  koopa_raw_function_t func;
+  std::unordered_map<koopa_raw_value_t, koopa_raw_basic_block_t> where;
+  // 改写退出比较时使用: 每个值的使用者, 以及值是否只被没有用的指令使用
+  std::unordered_map<koopa_raw_value_t, std::vector<koopa_raw_value_t>> users;
+  std::unordered_map<koopa_raw_value_t, bool> unused;
+
+  int reduce(const LoopInfo &li, const Loop *loop) {
+    auto ivs = find_induction_vars(loop);
+    if (ivs.empty()) return 0;
+    std::unordered_map<koopa_raw_value_t, const InductionVar *> iv_of;
+    for (auto &iv : ivs) iv_of[iv.param] = &iv;
+    AffineAnalysis aa(loop, ivs, where);
+    auto edges = latch_edges(loop);
+
+    std::map<key_t, koopa_raw_value_t> recurrences;
+    std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> repl;
+    for (auto bb : li.loop_blocks(loop)) {
+      for (auto inst : bb_insts(bb)) {
+        koopa_raw_value_t base = nullptr, index = nullptr;
+        const auto &kind = inst->kind;
+        if (kind.tag == KOOPA_RVT_GET_ELEM_PTR) {
+          base = kind.data.get_elem_ptr.src;
+          index = kind.data.get_elem_ptr.index;
+        } else if (kind.tag == KOOPA_RVT_GET_PTR) {
+          base = kind.data.get_ptr.src;
+          index = kind.data.get_ptr.index;
+        } else if (kind.tag == KOOPA_RVT_BINARY && kind.data.binary.op == KOOPA_RBO_MUL) {
+          index = inst;
+        } else {
+          continue;
+        }
+        if (base != nullptr && !aa.is_invariant(base)) continue;
+        Affine a;
+        if (!aa.get(index, a) || a.iv == nullptr || a.coef == 0) continue;
+        key_t key(kind.tag, base, a.iv, a.coef, a.off, a.inv);
+        auto it = recurrences.find(key);
+        if (it == recurrences.end()) {
+          it = recurrences.emplace(key, make_recurrence(loop, inst, base, a, *iv_of[a.iv], edges)).first;
+        }
+        repl[inst] = it->second;
+      }
+    }
+    if (repl.empty()) return 0;
+    // 只替换循环中的使用, 循环外看到的是最后一次迭代的值
+    for (auto bb : li.loop_blocks(loop)) {
+      for (auto inst : bb_insts(bb)) {
+        map_operands(inst, [&](koopa_raw_value_t op) {
+          auto r = repl.find(op);
+          return r == repl.end() ? op : r->second;
+        });
+      }
+    }
+    return repl.size();
+  }
+
+  // 步长为1的计数器i从i0走到 i_end = max(i0, n) 时退出, 所以 i < n 等价于 i != i_end,
+  // 也等价于 r != r0 + coef * (i_end - i0); 步长为-1的 i > n 同理 (i_end = min(i0, n))
+  // i_end - i0 = (i0 < n) * (n - i0), 在preheader中计算; coef为奇数时相差不到2^32的两个i对应的r一定不同,
+  // 所以这个等价在r回绕时也成立
+  int replace_exit_test(const Loop *loop) {
+    auto br = terminator(loop->header);
+    if (br->kind.tag != KOOPA_RVT_BRANCH) return 0;
+    bool t_in = loop->contains(br->kind.data.branch.true_bb), f_in = loop->contains(br->kind.data.branch.false_bb);
+    if (t_in == f_in) return 0;
+    auto cond = br->kind.data.branch.cond;
+    if (cond->kind.tag != KOOPA_RVT_BINARY || !is_compare(cond->kind.data.binary.op)) return 0;
+    auto ivs = find_induction_vars(loop);
+    auto edges = latch_edges(loop);
+    AffineAnalysis aa(loop, ivs, where);
+    auto op = cond->kind.data.binary.op;
+    auto lhs = cond->kind.data.binary.lhs, bound = cond->kind.data.binary.rhs;
+    auto find_iv = [&](koopa_raw_value_t v) -> const InductionVar * {
+      for (auto &iv : ivs) {
+        if (iv.param == v) return &iv;
+      }
+      return nullptr;
+    };
+    auto iv = find_iv(lhs);
+    if (iv == nullptr && (iv = find_iv(bound)) != nullptr) {
+      std::swap(lhs, bound);
+      op = swapped_compare(op);
+    }
+    if (iv == nullptr || edges.empty() || !aa.is_invariant(bound)) return 0;
+    auto stay_op = t_in ? op : inverted_compare(op);
+    // 常量边界的 <= 和 >= 转为 < n + 1 和 > n - 1
+    if (stay_op == KOOPA_RBO_LE || stay_op == KOOPA_RBO_GE) {
+      bool le = stay_op == KOOPA_RBO_LE;
+      if (!is_integer(bound) || int_value(bound) == (le ? INT32_MAX : INT32_MIN)) return 0;
+      bound = make_integer(int_value(bound) + (le ? 1 : -1));
+      stay_op = le ? KOOPA_RBO_LT : KOOPA_RBO_GT;
+    }
+    int32_t step = iv->steps[0];
+    if (!((stay_op == KOOPA_RBO_LT && step == 1) || (stay_op == KOOPA_RBO_GT && step == -1))) return 0;
+    for (auto s : iv->steps) {
+      if (s != step) return 0;
+    }
+    users = build_users(func);
+    unused.clear();
+    if (!only_recurrence_uses(*iv, edges, cond)) return 0;
+
+    for (auto &r : ivs) {
+      if (&r == iv || r.param->ty->tag != KOOPA_RTT_INT32) continue;
+      int32_t coef = int32_t(uint32_t(r.steps[0]) * uint32_t(step));
+      if ((coef & 1) == 0 || only_recurrence_uses(r, edges, nullptr)) continue;
+      bool same = true;
+      for (auto s : r.steps) same &= s == r.steps[0];
+      if (!same) continue;
+      // preheader中计算 r_end = r0 + coef * (i0 stay_op n) * (n - i0)
+      auto pre = loop->preheader;
+      std::vector<koopa_raw_value_t> pre_insts;
+      auto entered = emit(pre_insts, stay_op, iv->init, bound);
+      auto dist = emit(pre_insts, KOOPA_RBO_MUL, entered, emit(pre_insts, KOOPA_RBO_SUB, bound, iv->init));
+      if (coef != 1) dist = emit(pre_insts, KOOPA_RBO_MUL, dist, make_integer(coef));
+      auto end = emit(pre_insts, KOOPA_RBO_ADD, r.init, dist);
+      for (auto v : pre_insts) where[v] = pre;
+      insert_before_terminator(pre, pre_insts);
+      auto &bin = mut(cond)->kind.data.binary;
+      bin.op = t_in ? KOOPA_RBO_NOT_EQ : KOOPA_RBO_EQ;
+      bin.lhs = r.param;
+      bin.rhs = end;
+      return 1;
+    }
+    return 0;
+  }
+
+  // 值只被没有用的指令使用, 如被强度削弱替换掉的getelemptr和它的下标, 它们会被随后的DCE删除
+  bool is_unused(koopa_raw_value_t v) {
+    auto it = unused.find(v);
+    if (it != unused.end()) return it->second;
+    bool result = true;
+    for (auto u : users[v]) {
+      if (has_side_effect(u) || !is_unused(u)) {
+        result = false;
+        break;
+      }
+    }
+    return unused[v] = result;
+  }
+
+  // v只被allowed和自己在回边上的递增使用, 递增也只作为回边的实参; v的所有步长都不为0
+  bool only_recurrence_uses(const InductionVar &v, const std::vector<LatchEdge> &edges, koopa_raw_value_t allowed) {
+    // 递增 -> 在回边实参中出现的次数
+    std::unordered_map<koopa_raw_value_t, size_t> incs;
+    for (auto &le : edges) ++incs[slice_items<koopa_raw_value_t>(edge_args(le.term, le.edge))[v.index]];
+    for (auto u : users[v.param]) {
+      if (u != allowed && incs.count(u) == 0 && (has_side_effect(u) || !is_unused(u))) return false;
+    }
+    for (auto &[inc, n] : incs) {
+      size_t used = 0;
+      for (auto u : users[inc]) used += has_side_effect(u) || !is_unused(u);
+      if (used != n) return false;
+    }
+    return true;
+  }
+
+  // 生成 lhs op rhs, 两边都是常量时直接折叠
+  static koopa_raw_value_t emit(std::vector<koopa_raw_value_t> &insts, koopa_raw_binary_op_t op, koopa_raw_value_t lhs,
+                                koopa_raw_value_t rhs) {
+    int32_t c;
+    if (is_integer(lhs) && is_integer(rhs) && fold_binary(op, int_value(lhs), int_value(rhs), c)) {
+      return make_integer(c);
+    }
+    auto inst = make_binary(op, lhs, rhs);
+    insts.push_back(inst);
+    return inst;
+  }
+
+  // 在preheader中计算 coef * v + off + inv
+  koopa_raw_value_t materialize(std::vector<koopa_raw_value_t> &insts, koopa_raw_value_t v, const Affine &a) {
+    if (a.coef != 1) v = emit(insts, KOOPA_RBO_MUL, v, make_integer(a.coef));
+    if (a.off != 0) v = emit(insts, KOOPA_RBO_ADD, v, make_integer(a.off));
+    if (a.inv != nullptr) v = emit(insts, KOOPA_RBO_ADD, v, a.inv);
+    return v;
+  }
+
+  koopa_raw_value_t make_recurrence(const Loop *loop, koopa_raw_value_t inst, koopa_raw_value_t base, const Affine &a,
+                                    const InductionVar &iv, const std::vector<LatchEdge> &edges) {
+    auto header = loop->header, pre = loop->preheader;
+    // 初值
+    std::vector<koopa_raw_value_t> pre_insts;
+    koopa_raw_value_t start = materialize(pre_insts, iv.init, a);
+    if (base != nullptr) {
+      auto ptr = inst->kind.tag == KOOPA_RVT_GET_ELEM_PTR ? make_get_elem_ptr(base, start) : make_get_ptr(base, start);
+      pre_insts.push_back(ptr);
+      start = ptr;
+    }
+    for (auto v : pre_insts) where[v] = pre;
+    insert_before_terminator(pre, pre_insts);
+
+    auto params = bb_params(header);
+    auto param = make_block_arg(inst->ty, params.size());
+    params.push_back(param);
+    set_bb_params(header, params);
+    where[param] = header;
+    if (base != nullptr) note_derived_pointer(param, pointer_base(base));
+    append_edge_arg(terminator(pre), 0, start);
+
+    // 每条回边上递推
+    for (size_t i = 0; i < edges.size(); ++i) {
+      int32_t delta = int32_t(uint32_t(a.coef) * uint32_t(iv.steps[i]));
+      koopa_raw_value_t next = param;
+      if (delta != 0) {
+        auto latch = where[edges[i].term];
+        next = base != nullptr ? make_get_ptr(param, make_integer(delta))
+                               : make_binary(KOOPA_RBO_ADD, param, make_integer(delta));
+        insert_before_terminator(latch, {next});
+        where[next] = latch;
+      }
+      append_edge_arg(edges[i].term, edges[i].edge, next);
+    }
+    return param;
+  }
+};
+
+inline int lsr(koopa_raw_function_t func) { return LSR(func).run(); }
+
+inline int rewrite_exit_tests(koopa_raw_function_t func, const std::unordered_set<koopa_raw_basic_block_t> &skip) {
+  return LSR(func).run_exit_tests(skip);
+}
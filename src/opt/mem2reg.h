@@ -0,0 +1,198 @@
+#pragma once
+#include "ir.h"
+
+// mem2reg: 把只被load/store访问的标量alloc提升为SSA值
+// 在迭代支配边界处插入基本块参数, 再沿支配树重命名
+
+// alloc是否可以提升: 类型为i32或指针, 且只作为load的地址和store的目的地址出现
+inline bool is_promotable(koopa_raw_value_t alloc, const std::vector<koopa_raw_value_t> &users) {
+  auto base = alloc->ty->data.pointer.base;
+  if (base->tag != KOOPA_RTT_INT32 && base->tag != KOOPA_RTT_POINTER) return false;
+  for (auto user : users) {
+    if (user->kind.tag == KOOPA_RVT_LOAD) continue;
+    if (user->kind.tag == KOOPA_RVT_STORE && user->kind.data.store.dest == alloc &&
+        user->kind.data.store.value != alloc) {
+      continue;
+    }
+    return false;
+  }
+  return true;
+}
+
+class Mem2Reg {
+ public:
+  explicit Mem2Reg(koopa_raw_function_t f) : func(f) {}
+
+  // 返回提升的alloc数量
+  int run() {
+    remove_unreachable_blocks(func);
+    auto users = build_users(func);
+    for (auto bb : func_blocks(func)) {
+      for (auto inst : bb_insts(bb)) {
+        if (inst->kind.tag == KOOPA_RVT_ALLOC && is_promotable(inst, users[inst])) {
+          promoted.insert(inst);
+          allocs.push_back(inst);
+        }
+      }
+    }
+    if (allocs.empty()) return 0;
+
+    CFG cfg(func);
+    DomTree dt(cfg);
+    insert_params(cfg, dt);
+    rename(cfg, dt, cfg.entry());
+
+    // 删除被提升的alloc以及对应的load/store
+    for (auto bb : func_blocks(func)) {
+      std::vector<koopa_raw_value_t> kept;
+      for (auto inst : bb_insts(bb)) {
+        if (removed.count(inst) == 0) kept.push_back(inst);
+      }
+      set_bb_insts(bb, kept);
+    }
+    replace_uses(func, repl);
+    remove_dead_block_params(func);
+    return allocs.size();
+  }
+
+ private:
+  koopa_raw_function_t func;
+  std::vector<koopa_raw_value_t> allocs;
+  std::unordered_set<koopa_raw_value_t> promoted;
+  // 每个基本块新增的参数对应哪个alloc
+  std::unordered_map<koopa_raw_basic_block_t, std::vector<std::pair<koopa_raw_value_t, koopa_raw_value_t>>> phis;
+  // 每个alloc当前的值
+  std::unordered_map<koopa_raw_value_t, std::vector<koopa_raw_value_t>> cur;
+  std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> repl;
+  std::unordered_set<koopa_raw_value_t> removed;
+
+  void insert_params(const CFG &cfg, const DomTree &dt) {
+    auto df = dt.frontier(cfg);
+    for (auto alloc : allocs) {
+      std::vector<koopa_raw_basic_block_t> worklist;
+      std::unordered_set<koopa_raw_basic_block_t> has_def, has_phi;
+      for (auto bb : cfg.rpo) {
+        for (auto inst : bb_insts(bb)) {
+          if (inst->kind.tag == KOOPA_RVT_STORE && inst->kind.data.store.dest == alloc) {
+            if (has_def.insert(bb).second) worklist.push_back(bb);
+            break;
+          }
+        }
+      }
+      while (!worklist.empty()) {
+        auto bb = worklist.back();
+        worklist.pop_back();
+        for (auto d : df[bb]) {
+          if (!has_phi.insert(d).second) continue;
+          auto params = bb_params(d);
+          auto p = make_block_arg(alloc->ty->data.pointer.base, params.size());
+          params.push_back(p);
+          set_bb_params(d, params);
+          phis[d].emplace_back(alloc, p);
+          if (has_def.insert(d).second) worklist.push_back(d);
+        }
+      }
+    }
+  }
+
+  koopa_raw_value_t current(koopa_raw_value_t alloc) {
+    auto &stack = cur[alloc];
+    if (stack.empty()) return make_undef(alloc->ty->data.pointer.base);
+    return stack.back();
+  }
+
+  void rename(const CFG &cfg, const DomTree &dt, koopa_raw_basic_block_t bb) {
+    std::vector<koopa_raw_value_t> pushed;
+    for (auto &[alloc, p] : phis[bb]) {
+      cur[alloc].push_back(p);
+      pushed.push_back(alloc);
+    }
+    for (auto inst : bb_insts(bb)) {
+      const auto &kind = inst->kind;
+      if (kind.tag == KOOPA_RVT_ALLOC && promoted.count(inst)) {
+        removed.insert(inst);
+      } else if (kind.tag == KOOPA_RVT_LOAD && promoted.count(kind.data.load.src)) {
+        repl[inst] = current(kind.data.load.src);
+        removed.insert(inst);
+      } else if (kind.tag == KOOPA_RVT_STORE && promoted.count(kind.data.store.dest)) {
+        cur[kind.data.store.dest].push_back(kind.data.store.value);
+        pushed.push_back(kind.data.store.dest);
+        removed.insert(inst);
+      }
+    }
+    // 在出边上为后继新增的参数传入实参
+    auto term = terminator(bb);
+    for (int e = 0; e < edge_count(term); ++e) {
+      auto &ps = phis[edge_target(term, e)];
+      if (ps.empty()) continue;
+      auto args = slice_items<koopa_raw_value_t>(edge_args(term, e));
+      for (auto &[alloc, p] : ps) {
+        args.push_back(current(alloc));
+      }
+      edge_args(term, e) = make_slice(args, KOOPA_RSIK_VALUE);
+    }
+    for (auto child : dt.children.at(bb)) {
+      rename(cfg, dt, child);
+    }
+    for (auto alloc : pushed) {
+      cur[alloc].pop_back();
+    }
+  }
+};
+
+inline int mem2reg(koopa_raw_function_t func) { return Mem2Reg(func).run(); }
+
+// 同一个值在两段代码中的两个定义, 分别在所在基本块的末尾可用
+struct DefPair {
+  koopa_raw_value_t value;
+  koopa_raw_basic_block_t value_bb;
+  koopa_raw_value_t copy;
+  koopa_raw_basic_block_t copy_bb;
+};
+
+// 复制代码之后修复SSA: 两段代码之外 (inside为false的基本块) 对value的使用可能来自任意一个定义
+// 先降级为alloc上的load/store, 再由mem2reg插入需要的基本块参数, 返回降级的值的数量
+inline int repair_ssa(koopa_raw_function_t func, const std::vector<DefPair> &defs,
+                      const std::function<bool(koopa_raw_basic_block_t)> &inside) {
+  std::unordered_set<koopa_raw_value_t> used_outside;
+  for (auto bb : func_blocks(func)) {
+    if (inside(bb)) continue;
+    for (auto inst : bb_insts(bb)) {
+      for (auto op : operands(inst)) used_outside.insert(op);
+    }
+  }
+  std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> slot;
+  std::unordered_map<koopa_raw_basic_block_t, std::vector<koopa_raw_value_t>> stores;
+  std::vector<koopa_raw_value_t> allocs;
+  for (auto &d : defs) {
+    if (!used_outside.count(d.value)) continue;
+    auto alloc = make_alloc(d.value->ty);
+    slot[d.value] = alloc;
+    allocs.push_back(alloc);
+    stores[d.value_bb].push_back(make_store(d.value, alloc));
+    stores[d.copy_bb].push_back(make_store(d.copy, alloc));
+  }
+  if (allocs.empty()) return 0;
+  for (auto bb : func_blocks(func)) {
+    if (inside(bb)) continue;
+    std::vector<koopa_raw_value_t> insts;
+    for (auto inst : bb_insts(bb)) {
+      map_operands(inst, [&](koopa_raw_value_t op) -> koopa_raw_value_t {
+        auto it = slot.find(op);
+        if (it == slot.end()) return op;
+        auto load = make_load(it->second);
+        insts.push_back(load);
+        return load;
+      });
+      insts.push_back(inst);
+    }
+    set_bb_insts(bb, insts);
+  }
+  for (auto &[bb, s] : stores) insert_before_terminator(bb, s);
+  auto entry = func_blocks(func)[0];
+  auto entry_insts = bb_insts(entry);
+  entry_insts.insert(entry_insts.begin(), allocs.begin(), allocs.end());
+  set_bb_insts(entry, entry_insts);
+  mem2reg(func);
+  return allocs.size();
+}
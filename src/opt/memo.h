@@ -0,0 +1,127 @@
+#pragma once
+#include "ir.h"
+#include "alias.h"
+#include "callgraph.h"
+
+// 自动记忆化 (-fauto-memo): 纯的自递归函数 (形参和返回值都是i32, 只读写自己的alloc, 只调用自己)
+// 的结果只由实参决定, 用编译器生成的全局表缓存, 如fib(n)的指数次调用变为线性次
+// 只有一处递归调用的线性递归每个实参只会算一次, 缓存没有收益, 包装函数还会加深栈, 所以不处理
+// 新建包装函数@f_memoN: 实参散列到直接映射的表项, 有效位图中的位已置且记录的实参相同时直接返回缓存的值,
+// 否则调用原函数并写入表项. 原函数中的递归调用和其他函数对它的调用都改为调用包装函数
+// 包装函数读写全局变量, 会妨碍编译期求值和内联, 所以在其他优化都完成之后再执行
+
+static const int kMemoTableBits = 12;
+static const int kMaxMemoParams = 2;
+static const int kMemoHashMul = 61;
+
+class AutoMemo {
+ public:
+  AutoMemo(const koopa_raw_program_t &p, CallGraph &g) : program(p), cg(g) {}
+
+  // 记忆化func, 返回包装函数, 不满足条件时返回nullptr
+  koopa_raw_function_t run(koopa_raw_function_t func) {
+    if (!memoizable(func)) return nullptr;
+    auto name = std::string(func->name);
+    auto params = slice_items<koopa_raw_value_t>(func->params);
+    auto wrapper = make_function(unique_name(program, name + "_memo"), type_i32(), params);
+    auto args = slice_items<koopa_raw_value_t>(wrapper->params);
+
+    // 表项: 返回值、每个实参, 以及每个表项一位的有效位图
+    const int size = 1 << kMemoTableBits;
+    auto table = [&](const std::string &what, int len) {
+      auto v = make_global(unique_name(program, name + "_memo_" + what), type_array(type_i32(), len));
+      append_global(program, v);
+      return v;
+    };
+    auto vals = table("val", size);
+    std::vector<koopa_raw_value_t> keys;
+    for (size_t i = 0; i < args.size(); ++i) keys.push_back(table("key" + std::to_string(i) + "_", size));
+    auto valid = table("valid", size / 32);
+
+    auto entry = make_block("memo_entry"), check = make_block("memo_check");
+    auto found = make_block("memo_found"), miss = make_block("memo_miss");
+    std::vector<koopa_raw_value_t> insts;
+    auto emit = [&](koopa_raw_value_t inst) {
+      insts.push_back(inst);
+      return inst;
+    };
+
+    koopa_raw_value_t hash = args[0];
+    for (size_t i = 1; i < args.size(); ++i) {
+      hash = emit(make_binary(KOOPA_RBO_ADD, emit(make_binary(KOOPA_RBO_MUL, hash, make_integer(kMemoHashMul))), args[i]));
+    }
+    auto idx = emit(make_binary(KOOPA_RBO_AND, hash, make_integer(size - 1)));
+    auto bit = emit(make_binary(KOOPA_RBO_AND, idx, make_integer(31)));
+    auto word_ptr = emit(make_get_elem_ptr(valid, emit(make_binary(KOOPA_RBO_SHR, idx, make_integer(5)))));
+    auto word = emit(make_load(word_ptr));
+    auto hit = emit(make_binary(KOOPA_RBO_AND, emit(make_binary(KOOPA_RBO_SHR, word, bit)), make_integer(1)));
+    emit(make_branch(hit, check, miss));
+    set_bb_insts(entry, insts);
+
+    insts.clear();
+    koopa_raw_value_t same = nullptr;
+    for (size_t i = 0; i < args.size(); ++i) {
+      auto key = emit(make_load(emit(make_get_elem_ptr(keys[i], idx))));
+      auto eq = emit(make_binary(KOOPA_RBO_EQ, key, args[i]));
+      same = same == nullptr ? eq : emit(make_binary(KOOPA_RBO_AND, same, eq));
+    }
+    auto val_ptr = emit(make_get_elem_ptr(vals, idx));
+    emit(make_branch(same, found, miss));
+    set_bb_insts(check, insts);
+
+    insts.clear();
+    emit(make_return(emit(make_load(val_ptr))));
+    set_bb_insts(found, insts);
+
+    // 递归调用可能已经改写了位图, 置位前重新读取
+    insts.clear();
+    auto result = emit(make_call(func, args));
+    for (size_t i = 0; i < args.size(); ++i) emit(make_store(args[i], emit(make_get_elem_ptr(keys[i], idx))));
+    emit(make_store(result, emit(make_get_elem_ptr(vals, idx))));
+    auto mask = emit(make_binary(KOOPA_RBO_SHL, make_integer(1), bit));
+    emit(make_store(emit(make_binary(KOOPA_RBO_OR, emit(make_load(word_ptr)), mask)), word_ptr));
+    emit(make_return(result));
+    set_bb_insts(miss, insts);
+
+    set_func_blocks(wrapper, {entry, check, found, miss});
+    insert_function(program, wrapper, func);
+    cg.add_function(wrapper, func, func);
+    cg.add_call(result, wrapper);
+
+    auto sites = cg.node(func).callers;
+    for (auto &site : sites) {
+      if (site.caller == wrapper) continue;
+      cg.remove_call(site.call);
+      mut(site.call)->kind.data.call.callee = wrapper;
+      cg.add_call(site.call, site.caller);
+    }
+    return wrapper;
+  }
+
+ private:
+  const koopa_raw_program_t &program;
+  CallGraph &cg;
+
+  bool memoizable(koopa_raw_function_t func) {
+    if (!cg.node(func).self_recursive) return false;
+    auto params = slice_items<koopa_raw_value_t>(func->params);
+    if (params.empty() || params.size() > size_t(kMaxMemoParams)) return false;
+    if (func->ty->data.function.ret->tag != KOOPA_RTT_INT32) return false;
+    for (auto p : params) {
+      if (p->ty->tag != KOOPA_RTT_INT32) return false;
+    }
+    int self_calls = 0;
+    for (auto bb : func_blocks(func)) {
+      for (auto inst : bb_insts(bb)) {
+        const auto &kind = inst->kind;
+        koopa_raw_value_t ptr = nullptr;
+        if (kind.tag == KOOPA_RVT_LOAD) ptr = kind.data.load.src;
+        if (kind.tag == KOOPA_RVT_STORE) ptr = kind.data.store.dest;
+        if (ptr != nullptr && pointer_base(ptr)->kind.tag != KOOPA_RVT_ALLOC) return false;
+        if (kind.tag == KOOPA_RVT_CALL && kind.data.call.callee != func) return false;
+        if (kind.tag == KOOPA_RVT_CALL) ++self_calls;
+      }
+    }
+    return self_calls > 1;
+  }
+};
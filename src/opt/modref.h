@@ -0,0 +1,223 @@
+#pragma once
+#include <algorithm>
+#include <unordered_set>
+#include "ir.h"
+#include "alias.h"
+
+// 过程间的mod/ref分析: 对每个函数求出它 (包括它调用的函数) 读写的全局变量、通过哪些指针形参读写内存,
+// 以及是否有输入输出. 函数按调用图自底向上优化完后计算摘要, 分析调用者时被调用者的摘要已经算好;
+// 自递归的函数从空摘要出发迭代到不动点. 没有摘要的函数 (如同一分量中还没有优化完的函数) 按最坏情况处理
+// 指针只能来自alloc、全局变量和指针形参, 基本块参数上的指针沿着传入的实参找到它们; 找不到时 (如从栈上
+// 读出的指针) 记为可能访问任何全局变量和形参指向的内存
+
+struct ModRefSummary {
+  std::unordered_set<koopa_raw_value_t> global_reads, global_writes;
+  // 按形参的位置, 是否读写它指向的内存
+  std::vector<bool> param_reads, param_writes;
+  // 通过无法追踪的指针读写
+  bool reads_unknown = false, writes_unknown = false;
+  bool io = false;
+
+  // 不写调用者可见的内存, 没有输入输出, 删除对它的调用不影响程序的行为
+  bool readonly() const {
+    for (bool w : param_writes) {
+      if (w) return false;
+    }
+    return !io && !writes_unknown && global_writes.empty();
+  }
+  // 结果只由实参的值决定
+  bool pure() const {
+    for (bool r : param_reads) {
+      if (r) return false;
+    }
+    return readonly() && !reads_unknown && global_reads.empty();
+  }
+
+  bool operator==(const ModRefSummary &o) const {
+    return global_reads == o.global_reads && global_writes == o.global_writes && param_reads == o.param_reads &&
+           param_writes == o.param_writes && reads_unknown == o.reads_unknown && writes_unknown == o.writes_unknown &&
+           io == o.io;
+  }
+};
+
+// 已经分析过的函数和用到的库函数的摘要
+static std::unordered_map<koopa_raw_function_t, ModRefSummary> modref_summaries;
+
+// 库函数的声明没有形参, 个数取自函数类型
+inline ModRefSummary worst_modref(koopa_raw_function_t f) {
+  ModRefSummary s;
+  s.param_reads.assign(f->ty->data.function.params.len, true);
+  s.param_writes.assign(f->ty->data.function.params.len, true);
+  s.reads_unknown = s.writes_unknown = s.io = true;
+  return s;
+}
+
+// 库函数都有输入输出, getarray写实参指向的数组, putarray读它
+inline ModRefSummary lib_modref(koopa_raw_function_t f) {
+  static const char *names[] = {"@getint", "@getch", "@getarray", "@putint", "@putch", "@putarray", "@starttime",
+                                "@stoptime"};
+  bool known = false;
+  for (auto name : names) known |= strcmp(f->name, name) == 0;
+  if (!known) return worst_modref(f);
+  ModRefSummary s;
+  s.io = true;
+  s.param_reads.assign(f->ty->data.function.params.len, false);
+  s.param_writes.assign(f->ty->data.function.params.len, false);
+  if (strcmp(f->name, "@getarray") == 0) s.param_writes[0] = true;
+  if (strcmp(f->name, "@putarray") == 0) s.param_reads[1] = true;
+  return s;
+}
+
+// 没有摘要的函数按最坏情况处理
+inline const ModRefSummary &modref(koopa_raw_function_t f) {
+  auto it = modref_summaries.find(f);
+  if (it != modref_summaries.end()) return it->second;
+  if (f->bbs.len == 0) return modref_summaries[f] = lib_modref(f);
+  static std::unordered_map<koopa_raw_function_t, ModRefSummary> worst;
+  auto w = worst.find(f);
+  if (w == worst.end()) w = worst.emplace(f, worst_modref(f)).first;
+  return w->second;
+}
+
+class ModRefAnalysis {
+ public:
+  explicit ModRefAnalysis(koopa_raw_function_t f) : func(f) {}
+
+  ModRefSummary run() {
+    for (auto bb : func_blocks(func)) {
+      for (auto inst : bb_insts(bb)) {
+        if (inst->kind.tag != KOOPA_RVT_JUMP && inst->kind.tag != KOOPA_RVT_BRANCH) continue;
+        for (int e = 0; e < edge_count(inst); ++e) {
+          auto params = bb_params(edge_target(inst, e));
+          auto args = slice_items<koopa_raw_value_t>(edge_args(inst, e));
+          for (size_t i = 0; i < args.size(); ++i) incoming[params[i]].push_back(args[i]);
+        }
+      }
+    }
+    ModRefSummary cur;
+    cur.param_reads.assign(func->params.len, false);
+    cur.param_writes.assign(func->params.len, false);
+    while (true) {
+      auto next = analyze(cur);
+      if (next == cur) return cur;
+      cur = std::move(next);
+    }
+  }
+
+ private:
+  koopa_raw_function_t func;
+  std::unordered_map<koopa_raw_value_t, std::vector<koopa_raw_value_t>> incoming;
+
+  // 指针可能的基对象, 无法追踪时包含nullptr
+  std::unordered_set<koopa_raw_value_t> roots(koopa_raw_value_t ptr) {
+    std::unordered_set<koopa_raw_value_t> result, seen;
+    std::vector<koopa_raw_value_t> stack{ptr};
+    while (!stack.empty()) {
+      auto p = pointer_base(stack.back());
+      stack.pop_back();
+      if (!seen.insert(p).second) continue;
+      auto tag = p->kind.tag;
+      if (tag == KOOPA_RVT_ALLOC || tag == KOOPA_RVT_GLOBAL_ALLOC || tag == KOOPA_RVT_FUNC_ARG_REF) {
+        result.insert(p);
+      } else if (tag == KOOPA_RVT_BLOCK_ARG_REF && incoming.count(p)) {
+        for (auto arg : incoming[p]) stack.push_back(arg);
+      } else {
+        result.insert(nullptr);
+      }
+    }
+    return result;
+  }
+
+  void access(ModRefSummary &s, koopa_raw_value_t ptr, bool write) {
+    for (auto root : roots(ptr)) {
+      if (root == nullptr) {
+        (write ? s.writes_unknown : s.reads_unknown) = true;
+      } else if (root->kind.tag == KOOPA_RVT_GLOBAL_ALLOC) {
+        (write ? s.global_writes : s.global_reads).insert(root);
+      } else if (root->kind.tag == KOOPA_RVT_FUNC_ARG_REF) {
+        (write ? s.param_writes : s.param_reads)[root->kind.data.func_arg_ref.index] = true;
+      }
+    }
+  }
+
+  ModRefSummary analyze(const ModRefSummary &self) {
+    ModRefSummary s;
+    s.param_reads.assign(func->params.len, false);
+    s.param_writes.assign(func->params.len, false);
+    for (auto bb : func_blocks(func)) {
+      for (auto inst : bb_insts(bb)) {
+        const auto &kind = inst->kind;
+        if (kind.tag == KOOPA_RVT_LOAD) access(s, kind.data.load.src, false);
+        if (kind.tag == KOOPA_RVT_STORE) access(s, kind.data.store.dest, true);
+        if (kind.tag != KOOPA_RVT_CALL) continue;
+        auto callee = kind.data.call.callee;
+        const auto &c = callee == func ? self : modref(callee);
+        s.io |= c.io;
+        s.reads_unknown |= c.reads_unknown;
+        s.writes_unknown |= c.writes_unknown;
+        s.global_reads.insert(c.global_reads.begin(), c.global_reads.end());
+        s.global_writes.insert(c.global_writes.begin(), c.global_writes.end());
+        auto args = slice_items<koopa_raw_value_t>(kind.data.call.args);
+        for (size_t i = 0; i < args.size(); ++i) {
+          if (args[i]->ty->tag != KOOPA_RTT_POINTER) continue;
+          if (c.param_reads[i]) access(s, args[i], false);
+          if (c.param_writes[i]) access(s, args[i], true);
+        }
+      }
+    }
+    return s;
+  }
+};
+
+// 计算并记录func的摘要, 返回用于--opt-report的说明
+inline std::string compute_modref(koopa_raw_function_t func) {
+  auto &s = modref_summaries[func] = ModRefAnalysis(func).run();
+  if (s.pure()) return "pure";
+  if (s.readonly()) return "readonly";
+  std::string text;
+  auto add = [&](const std::string &what) { text += (text.empty() ? "" : ", ") + what; };
+  if (s.io) add("io");
+  std::vector<std::string> globals;
+  for (auto g : s.global_writes) globals.push_back(g->name);
+  std::sort(globals.begin(), globals.end());
+  for (auto &g : globals) add("writes " + g);
+  auto params = slice_items<koopa_raw_value_t>(func->params);
+  for (size_t i = 0; i < params.size(); ++i) {
+    if (s.param_writes[i]) add("writes through " + std::string(params[i]->name));
+  }
+  if (s.writes_unknown) add("writes unknown memory");
+  return text;
+}
+
+// 实参arg可能指向基对象base
+inline bool arg_may_point_to(koopa_raw_value_t arg, koopa_raw_value_t base) {
+  auto ab = pointer_base(arg);
+  if (!is_identified_object(ab) && ab->kind.tag != KOOPA_RVT_FUNC_ARG_REF) return true;
+  return objects_may_alias(ab, base);
+}
+
+// call可能读 (write为false) 或写 (write为true) 地址addr
+inline bool call_may_access(koopa_raw_value_t call, koopa_raw_value_t addr, bool write) {
+  const auto &s = modref(call->kind.data.call.callee);
+  bool unknown = write ? s.writes_unknown : s.reads_unknown;
+  const auto &globals = write ? s.global_writes : s.global_reads;
+  const auto &params = write ? s.param_writes : s.param_reads;
+  auto base = pointer_base(addr);
+  auto args = slice_items<koopa_raw_value_t>(call->kind.data.call.args);
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (args[i]->ty->tag == KOOPA_RTT_POINTER && (params[i] || unknown) && arg_may_point_to(args[i], base)) return true;
+  }
+  // 被调用的函数只能通过实参访问调用者的alloc
+  if (base->kind.tag == KOOPA_RVT_ALLOC) return false;
+  if (unknown) return true;
+  if (base->kind.tag == KOOPA_RVT_GLOBAL_ALLOC) return globals.count(base) != 0;
+  // 形参只可能指向实参事实中的全局变量, 其他指针可能指向任何全局变量
+  if (base->kind.tag != KOOPA_RVT_FUNC_ARG_REF) return !globals.empty();
+  for (auto g : globals) {
+    if (param_may_point_to(base, g)) return true;
+  }
+  return false;
+}
+
+inline bool call_may_write(koopa_raw_value_t call, koopa_raw_value_t addr) { return call_may_access(call, addr, true); }
+inline bool call_may_read(koopa_raw_value_t call, koopa_raw_value_t addr) { return call_may_access(call, addr, false); }
@@ -0,0 +1,154 @@
+#pragma once
+#include <iostream>
+#include "ir.h"
+#include "modref.h"
+#include "mem2reg.h"
+#include "gvn.h"
+#include "instcombine.h"
+#include "dce.h"
+#include "dse.h"
+#include "sccp.h"
+#include "simplify_cfg.h"
+#include "licm.h"
+#include "lsr.h"
+#include "unroll.h"
+#include "rotate.h"
+#include "unswitch.h"
+#include "loop_deletion.h"
+#include "interchange.h"
+#include "callgraph.h"
+#include "inline.h"
+#include "tre.h"
+#include "specialize.h"
+#include "const_eval.h"
+#include "memo.h"
+#include "global_dce.h"
+#include "globalopt.h"
+#include "sroa.h"
+
+// 优化选项, 由main.cpp根据命令行参数设置
+struct OptOptions {
+  // -O0/-O1/-O2
+  int level = 0;
+  // --opt-report: 把各个优化的统计信息输出到标准错误
+  bool report = false;
+  // --unroll-factor N: 部分展开的最大因子, 0表示按代码量自动选择, 1表示关闭循环展开
+  int unroll_factor = 0;
+  // -fauto-memo: 用全局表缓存纯的自递归函数的结果
+  bool auto_memo = false;
+};
+static OptOptions opt_options;
+
+inline void opt_report(const char *pass, koopa_raw_function_t func, const char *what, int cnt) {
+  if (opt_options.report && cnt > 0) {
+    std::cerr << "[" << pass << "] " << func->name + 1 << ": " << what << ": " << cnt << std::endl;
+  }
+}
+
+// 单条说明, 如内联对每个调用点的决定
+inline void opt_remark(const char *pass, koopa_raw_function_t func, const std::string &what) {
+  if (opt_options.report) {
+    std::cerr << "[" << pass << "] " << func->name + 1 << ": " << what << std::endl;
+  }
+}
+
+// 标量优化, 各个变换之后都会再执行一次来清理
+inline void scalar_cleanup(koopa_raw_function_t func) {
+  opt_report("sccp", func, "constant values", sccp(func));
+  opt_report("simplify-cfg", func, "removed blocks", simplify_cfg(func));
+  opt_report("instcombine", func, "simplified instructions", instcombine(func));
+  opt_report("gvn", func, "eliminated instructions", gvn(func));
+  opt_report("dse", func, "dead stores", dse(func));
+  opt_report("dce", func, "dead instructions", dce(func));
+}
+
+// 循环优化, 只在-O2时执行
+inline void loop_passes(koopa_raw_function_t func) {
+  // 交换只处理紧密嵌套的循环, 要在外提把计算移到内层preheader之前
+  opt_report("interchange", func, "interchanged loop nests", interchange_loops(func));
+  opt_report("licm", func, "hoisted instructions", licm(func));
+  opt_report("loop-deletion", func, "deleted loops", delete_loops(func));
+  opt_report("unswitch", func, "unswitched branches", unswitch_loops(func));
+  opt_report("lsr", func, "strength-reduced instructions", lsr(func));
+  std::unordered_set<koopa_raw_basic_block_t> remainders;
+  opt_report("unroll", func, "unrolled loops", unroll_loops(func, opt_options.unroll_factor, remainders));
+  // 没有展开的循环中, 只用于退出比较的计数器改用其他递推比较; 余数循环不改写
+  opt_report("lsr", func, "rewritten exit tests", rewrite_exit_tests(func, remainders));
+  // 展开要求循环只在header退出, 所以旋转放在展开之后; 旋转后循环体支配出口, 再外提一次
+  opt_report("loop-rotate", func, "rotated loops", rotate_loops(func));
+  opt_report("licm", func, "hoisted instructions", licm(func));
+}
+
+// 拆分只用常量下标访问的局部数组, 拆出的标量由mem2reg提升, 之后再清理一次
+inline void split_arrays(koopa_raw_function_t func) {
+  int cnt = sroa(func);
+  opt_report("sroa", func, "split arrays", cnt);
+  if (cnt == 0) return;
+  opt_report("mem2reg", func, "promoted allocs", mem2reg(func));
+  scalar_cleanup(func);
+}
+
+// 函数体的标量优化和循环优化, 完成后计算函数的mod/ref摘要, 供调用者使用
+inline void optimize_body(koopa_raw_function_t func) {
+  scalar_cleanup(func);
+  split_arrays(func);
+  if (opt_options.level >= 2) {
+    loop_passes(func);
+    scalar_cleanup(func);
+    // 完全展开的循环中的下标变成常量
+    split_arrays(func);
+  }
+  opt_remark("modref", func, compute_modref(func));
+}
+
+// 对raw program进行优化, 之后直接由RISCV.h生成代码
+// 按调用图自底向上处理函数, 优化调用者时被调用者已经化简完毕, 可以按优化后的大小决定是否特化和内联
+inline void optimize(const koopa_raw_program_t &program) {
+  if (opt_options.level == 0) return;
+  CallGraph cg(program);
+  // 先提升所有函数的alloc, 指针形参成为直接使用的值, 过程间的分析才能追踪它们
+  for (auto func : cg.bottom_up()) opt_report("mem2reg", func, "promoted allocs", mem2reg(func));
+  compute_param_targets(cg.funcs);
+  // 优化前的函数的摘要已经是安全的, 全局变量的常量化要用它判断数组是否会被写
+  for (auto func : cg.bottom_up()) compute_modref(func);
+  GlobalOpt globalopt(program, cg);
+  FunctionSpecializer specializer(program, cg, optimize_body);
+  CallEvaluator evaluator(cg);
+  for (auto func : cg.bottom_up()) {
+    opt_report("globalopt", func, "folded constant loads", globalopt.fold_constants(func));
+    // 消除尾递归后函数不再递归, 调用它的函数可以内联它
+    opt_report("tre", func, "eliminated tail calls", eliminate_tail_recursion(func, cg));
+    if (opt_options.level >= 2) {
+      opt_report("const-eval", func, "evaluated calls", evaluator.run(func));
+      for (auto &r : evaluator.remarks) opt_remark("const-eval", func, r);
+      // 特化后的副本更小, 可能变得可以内联
+      opt_report("specialize", func, "specialized call sites", specializer.run(func));
+      for (auto &r : specializer.remarks) opt_remark("specialize", func, r);
+      std::vector<std::string> remarks;
+      opt_report("inline", func, "inlined calls", inline_calls(func, cg, remarks));
+      for (auto &r : remarks) opt_remark("inline", func, r);
+    }
+    // main调用的函数都已经处理完, 内联之后很多全局变量只在main中出现
+    if (strcmp(func->name, "@main") == 0) {
+      auto names = globalopt.localize(func);
+      for (auto &name : names) opt_remark("globalopt", func, "localized " + name);
+      if (!names.empty()) opt_report("mem2reg", func, "promoted allocs", mem2reg(func));
+    }
+    optimize_body(func);
+  }
+  if (opt_options.auto_memo) {
+    AutoMemo memo(program, cg);
+    for (auto func : cg.bottom_up()) {
+      auto wrapper = memo.run(func);
+      if (wrapper != nullptr) opt_remark("auto-memo", func, "calls go through " + std::string(wrapper->name));
+    }
+  }
+  // 内联、特化和编译期求值之后很多函数不再被调用
+  GlobalDCE gdce(program);
+  if (auto main = gdce.run()) {
+    opt_report("global-dce", main, "removed functions", gdce.removed_funcs);
+    opt_report("global-dce", main, "removed globals", gdce.removed_globals);
+    opt_report("global-dce", main, "removed params", gdce.removed_params);
+    opt_report("global-dce", main, "removed return values", gdce.removed_rets);
+  }
+}
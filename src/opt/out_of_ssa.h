@@ -0,0 +1,201 @@
+#pragma once
+#include "ir.h"
+
+// 离开SSA: 代码生成前把基本块参数翻译成栈槽之间的并行复制
+// 1. 拆分关键边, 使所有实参都只出现在jump上
+// 2. 活跃区间不相交的参数与实参合并到同一个栈槽, 合并后的复制不需要任何指令
+
+// 拆分携带实参的br边: 在边上插入一个只含jump的基本块
+// 由mem2reg产生的参数都在汇合点上, 所以这些边都是关键边
+inline int split_critical_edges(koopa_raw_function_t func) {
+  int cnt = 0;
+  std::vector<koopa_raw_basic_block_t> bbs;
+  for (auto bb : func_blocks(func)) {
+    bbs.push_back(bb);
+    auto term = terminator(bb);
+    if (term == nullptr || term->kind.tag != KOOPA_RVT_BRANCH) continue;
+    for (int e = 0; e < 2; ++e) {
+      auto &args = edge_args(term, e);
+      if (args.len == 0) continue;
+      auto &target = edge_target(term, e);
+      auto split = make_block("split");
+      set_bb_insts(split, {make_jump(target, slice_items<koopa_raw_value_t>(args))});
+      target = split;
+      args = empty_slice(KOOPA_RSIK_VALUE);
+      bbs.push_back(split);
+      ++cnt;
+    }
+  }
+  if (cnt) set_func_blocks(func, bbs);
+  return cnt;
+}
+
+// 复制合并: 对每条边上的 (参数, 实参) 对, 若二者活跃区间不相交则放入同一类
+class CopyCoalescer {
+ public:
+  explicit CopyCoalescer(koopa_raw_function_t func) {
+    auto bbs = func_blocks(func);
+    // 需要栈槽的值: 基本块参数和有结果的非alloc指令
+    for (auto bb : bbs) {
+      for (auto p : bb_params(bb)) add_value(p);
+      for (auto inst : bb_insts(bb)) {
+        if (inst->ty->tag != KOOPA_RTT_UNIT && inst->kind.tag != KOOPA_RVT_ALLOC) add_value(inst);
+      }
+    }
+    if (values.empty()) return;
+    // 参与合并的值
+    std::vector<std::pair<int, int>> copies;
+    candidate.assign(values.size(), false);
+    for (auto bb : bbs) {
+      auto term = terminator(bb);
+      if (term == nullptr || term->kind.tag != KOOPA_RVT_JUMP) continue;
+      auto params = bb_params(term->kind.data.jump.target);
+      auto args = slice_items<koopa_raw_value_t>(term->kind.data.jump.args);
+      for (size_t i = 0; i < args.size(); ++i) {
+        auto it = id.find(args[i]);
+        if (it == id.end()) continue;
+        int p = id[params[i]];
+        candidate[p] = candidate[it->second] = true;
+        copies.emplace_back(p, it->second);
+      }
+    }
+    if (copies.empty()) return;
+    build_interference(bbs);
+    parent.resize(values.size());
+    members.resize(values.size());
+    for (size_t i = 0; i < values.size(); ++i) {
+      parent[i] = i;
+      members[i] = {int(i)};
+    }
+    for (auto [p, a] : copies) {
+      int rp = find(p), ra = find(a);
+      if (rp == ra || interfere(rp, ra)) continue;
+      if (members[rp].size() < members[ra].size()) std::swap(rp, ra);
+      parent[ra] = rp;
+      members[rp].insert(members[rp].end(), members[ra].begin(), members[ra].end());
+      members[ra].clear();
+    }
+  }
+
+  // 值所在类的代表元, 同一类的值共用一个栈槽
+  koopa_raw_value_t find(koopa_raw_value_t v) {
+    auto it = id.find(v);
+    if (it == id.end() || parent.empty()) return v;
+    return values[find(it->second)];
+  }
+
+ private:
+  std::vector<koopa_raw_value_t> values;
+  std::unordered_map<koopa_raw_value_t, int> id;
+  std::vector<bool> candidate;
+  std::vector<std::unordered_set<int>> adj;
+  std::vector<int> parent;
+  std::vector<std::vector<int>> members;
+
+  typedef std::vector<uint64_t> bitset_t;
+
+  void add_value(koopa_raw_value_t v) {
+    id[v] = values.size();
+    values.push_back(v);
+  }
+
+  int find(int x) {
+    while (parent[x] != x) {
+      parent[x] = parent[parent[x]];
+      x = parent[x];
+    }
+    return x;
+  }
+
+  bool interfere(int a, int b) {
+    for (int x : members[a]) {
+      for (int y : adj[x]) {
+        if (find(y) == b) return true;
+      }
+    }
+    return false;
+  }
+
+  void add_edge(int a, int b) {
+    if (a == b || !candidate[a] || !candidate[b]) return;
+    adj[a].insert(b);
+    adj[b].insert(a);
+  }
+
+  // 记录def与live中所有值的冲突
+  void def_conflicts(int d, const bitset_t &live) {
+    if (!candidate[d]) return;
+    for (size_t w = 0; w < live.size(); ++w) {
+      uint64_t bits = live[w];
+      while (bits) {
+        int b = __builtin_ctzll(bits);
+        bits &= bits - 1;
+        add_edge(d, w * 64 + b);
+      }
+    }
+  }
+
+  void build_interference(const std::vector<koopa_raw_basic_block_t> &bbs) {
+    size_t words = (values.size() + 63) / 64;
+    auto set = [](bitset_t &s, int i) { s[i / 64] |= 1ull << (i % 64); };
+    auto reset = [](bitset_t &s, int i) { s[i / 64] &= ~(1ull << (i % 64)); };
+    std::unordered_map<koopa_raw_basic_block_t, bitset_t> use, def, live_in, live_out;
+    for (auto bb : bbs) {
+      bitset_t u(words), d(words);
+      for (auto p : bb_params(bb)) set(d, id[p]);
+      for (auto inst : bb_insts(bb)) {
+        for (auto op : operands(inst)) {
+          auto it = id.find(op);
+          if (it != id.end() && !(d[it->second / 64] >> (it->second % 64) & 1)) set(u, it->second);
+        }
+        auto it = id.find(inst);
+        if (it != id.end()) set(d, it->second);
+      }
+      use[bb] = u;
+      def[bb] = d;
+      live_in[bb] = u;
+      live_out[bb] = bitset_t(words);
+    }
+    // 逆序迭代到不动点
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (auto it = bbs.rbegin(); it != bbs.rend(); ++it) {
+        auto bb = *it;
+        bitset_t out(words);
+        for (auto s : successors(bb)) {
+          auto &in = live_in[s];
+          for (size_t w = 0; w < words; ++w) out[w] |= in[w];
+        }
+        bitset_t in(words);
+        auto &u = use[bb], &d = def[bb];
+        for (size_t w = 0; w < words; ++w) in[w] = u[w] | (out[w] & ~d[w]);
+        if (in != live_in[bb] || out != live_out[bb]) {
+          live_in[bb] = in;
+          live_out[bb] = out;
+          changed = true;
+        }
+      }
+    }
+    adj.assign(values.size(), {});
+    for (auto bb : bbs) {
+      bitset_t live = live_out[bb];
+      auto insts = bb_insts(bb);
+      for (auto it = insts.rbegin(); it != insts.rend(); ++it) {
+        auto d = id.find(*it);
+        if (d != id.end()) {
+          def_conflicts(d->second, live);
+          reset(live, d->second);
+        }
+        for (auto op : operands(*it)) {
+          auto o = id.find(op);
+          if (o != id.end()) set(live, o->second);
+        }
+      }
+      // 参数在块入口同时定义
+      for (auto p : bb_params(bb)) {
+        def_conflicts(id[p], live);
+      }
+    }
+  }
+};
@@ -0,0 +1,91 @@
+#pragma once
+#include "ir.h"
+#include "loop.h"
+#include "clone.h"
+#include "mem2reg.h"
+
+// 循环旋转: 把 while 循环改写为 "守卫 + do-while"
+// header中的条件计算复制一份到preheader末尾作为守卫, 原来的header只从回边到达, 成为循环底部的条件判断,
+// header在循环中的后继成为新的header. 这样每次迭代只执行一次条件跳转, 并且循环体支配了底部的出口
+// header中定义、在header之外使用的值现在有两个定义, 先降级为alloc上的load/store, 再由mem2reg重建SSA
+// break/continue只是普通的出口边和回边, 不需要特殊处理
+
+static const int kMaxRotateHeaderSize = 16;
+
+class LoopRotate {
+ public:
+  explicit LoopRotate(koopa_raw_function_t f) : func(f) {}
+
+  // 返回旋转的循环数量
+  int run() {
+    int cnt = 0;
+    while (true) {
+      insert_preheaders(func);
+      LoopInfo li(func);
+      bool changed = false;
+      for (auto loop : li.loops) {
+        if (done.count(loop->header)) continue;
+        done.insert(loop->header);
+        if (rotate(loop)) {
+          ++cnt;
+          changed = true;
+          break;
+        }
+      }
+      if (!changed) break;
+    }
+    return cnt;
+  }
+
+ private:
+  koopa_raw_function_t func;
+  std::unordered_set<koopa_raw_basic_block_t> done;
+
+  bool rotate(const Loop *loop) {
+    auto header = loop->header, pre = loop->preheader;
+    if (pre == nullptr || header->insts.len > size_t(kMaxRotateHeaderSize)) return false;
+    auto br = terminator(header);
+    if (br->kind.tag != KOOPA_RVT_BRANCH) return false;
+    auto true_bb = br->kind.data.branch.true_bb, false_bb = br->kind.data.branch.false_bb;
+    if (loop->contains(true_bb) == loop->contains(false_bb)) return false;
+    auto body = loop->contains(true_bb) ? true_bb : false_bb;
+    if (body == header) return false;
+    // 旋转后的循环以body为header, 不再旋转
+    done.insert(body);
+
+    // 在preheader末尾复制header, 参数替换为preheader传入的实参
+    CloneMap map;
+    auto params = bb_params(header);
+    auto args = slice_items<koopa_raw_value_t>(terminator(pre)->kind.data.jump.args);
+    for (size_t i = 0; i < params.size(); ++i) map.values[params[i]] = args[i];
+    auto pre_insts = bb_insts(pre);
+    pre_insts.pop_back();
+    size_t guard_begin = pre_insts.size();
+    for (auto inst : bb_insts(header)) {
+      auto copy = copy_inst(inst);
+      map.values[inst] = copy;
+      pre_insts.push_back(copy);
+    }
+    for (size_t i = guard_begin; i < pre_insts.size(); ++i) remap_inst(pre_insts[i], map);
+    set_bb_insts(pre, pre_insts);
+
+    // 条件判断移到循环的最后一个基本块之后
+    auto bbs = func_blocks(func);
+    bbs.erase(std::find(bbs.begin(), bbs.end(), header));
+    auto pos = bbs.end();
+    for (auto it = bbs.begin(); it != bbs.end(); ++it) {
+      if (loop->contains(*it)) pos = it + 1;
+    }
+    bbs.insert(pos, header);
+    set_func_blocks(func, bbs);
+
+    // header中定义的值在header和守卫中各有一个定义
+    std::vector<DefPair> defs;
+    for (auto p : params) defs.push_back({p, header, map(p), pre});
+    for (auto inst : bb_insts(header)) defs.push_back({inst, header, map(inst), pre});
+    repair_ssa(func, defs, [&](koopa_raw_basic_block_t bb) { return bb == header || bb == pre; });
+    return true;
+  }
+};
+
+inline int rotate_loops(koopa_raw_function_t func) { return LoopRotate(func).run(); }
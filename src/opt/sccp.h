@@ -0,0 +1,214 @@
+#pragma once
+#include <set>
+#include "ir.h"
+#include "simplify_cfg.h"
+
+// 稀疏条件常量传播 (Wegman-Zadeck)
+// 格: TOP(未定) > 常量 > BOTTOM(非常量), 只有可执行的边才会把实参传给目标块参数
+// 求解后把常量值替换进所有使用处, 条件为常量的br改为jump, 再交给simplify_cfg删除死区域
+
+class SCCP {
+ public:
+  explicit SCCP(koopa_raw_function_t f) : func(f) {}
+
+  // 返回被替换为常量的值的数量
+  int run() {
+    remove_unreachable_blocks(func);
+    build();
+    solve();
+    return rewrite();
+  }
+
+ private:
+  enum State { TOP, CONST, BOTTOM };
+  struct Lattice {
+    State state = TOP;
+    int32_t value = 0;
+  };
+
+  koopa_raw_function_t func;
+  std::unordered_map<koopa_raw_value_t, Lattice> lattice;
+  std::unordered_map<koopa_raw_value_t, koopa_raw_basic_block_t> where;
+  std::unordered_map<koopa_raw_value_t, std::vector<koopa_raw_value_t>> users;
+  std::unordered_set<koopa_raw_basic_block_t> executable;
+  // (源基本块的终结指令, 出边序号)
+  std::set<std::pair<koopa_raw_value_t, int>> exec_edges;
+  std::vector<koopa_raw_basic_block_t> block_worklist;
+  std::vector<koopa_raw_value_t> value_worklist;
+
+  void build() {
+    where = build_inst_blocks(func);
+    users = build_users(func);
+  }
+
+  Lattice get(koopa_raw_value_t v) {
+    Lattice l;
+    switch (v->kind.tag) {
+      case KOOPA_RVT_INTEGER:
+        l.state = CONST;
+        l.value = int_value(v);
+        return l;
+      case KOOPA_RVT_UNDEF:
+        return l;
+      case KOOPA_RVT_BINARY:
+      case KOOPA_RVT_BLOCK_ARG_REF:
+        return lattice[v];
+      default:
+        l.state = BOTTOM;
+        return l;
+    }
+  }
+
+  static Lattice meet(Lattice a, Lattice b) {
+    if (a.state == TOP) return b;
+    if (b.state == TOP) return a;
+    if (a.state == BOTTOM || b.state == BOTTOM || a.value != b.value) {
+      a.state = BOTTOM;
+    }
+    return a;
+  }
+
+  void update(koopa_raw_value_t v, Lattice l) {
+    auto &old = lattice[v];
+    if (old.state == l.state && (l.state != CONST || old.value == l.value)) return;
+    old = l;
+    value_worklist.push_back(v);
+  }
+
+  // 返回这条边是否是新标记的
+  bool mark_edge(koopa_raw_value_t term, int e) {
+    if (!exec_edges.insert({term, e}).second) {
+      return false;
+    }
+    auto target = edge_target(term, e);
+    // 目标块参数与新边上的实参取交
+    auto params = bb_params(target);
+    auto args = slice_items<koopa_raw_value_t>(edge_args(term, e));
+    for (size_t i = 0; i < params.size(); ++i) {
+      update(params[i], meet(lattice[params[i]], get(args[i])));
+    }
+    if (executable.insert(target).second) {
+      block_worklist.push_back(target);
+    }
+    return true;
+  }
+
+  void visit(koopa_raw_value_t inst) {
+    auto bb = where[inst];
+    if (executable.count(bb) == 0) return;
+    const auto &kind = inst->kind;
+    switch (kind.tag) {
+      case KOOPA_RVT_BINARY: {
+        auto lhs = get(kind.data.binary.lhs), rhs = get(kind.data.binary.rhs);
+        Lattice l;
+        if (lhs.state == BOTTOM || rhs.state == BOTTOM) {
+          l.state = BOTTOM;
+        } else if (lhs.state == CONST && rhs.state == CONST) {
+          l.state = fold_binary(kind.data.binary.op, lhs.value, rhs.value, l.value) ? CONST : BOTTOM;
+        }
+        update(inst, l);
+        break;
+      }
+      case KOOPA_RVT_BRANCH: {
+        auto cond = get(kind.data.branch.cond);
+        if (cond.state == CONST) {
+          mark_edge(inst, cond.value != 0 ? 0 : 1);
+        } else if (cond.state == BOTTOM) {
+          mark_edge(inst, 0);
+          mark_edge(inst, 1);
+        }
+        break;
+      }
+      case KOOPA_RVT_JUMP:
+        mark_edge(inst, 0);
+        break;
+      default:
+        break;
+    }
+  }
+
+  // 可执行边上的实参变化时更新目标块参数
+  void visit_edges_using(koopa_raw_value_t term) {
+    for (int e = 0; e < edge_count(term); ++e) {
+      if (exec_edges.count({term, e}) == 0) continue;
+      auto params = bb_params(edge_target(term, e));
+      auto args = slice_items<koopa_raw_value_t>(edge_args(term, e));
+      for (size_t i = 0; i < params.size(); ++i) {
+        update(params[i], meet(lattice[params[i]], get(args[i])));
+      }
+    }
+  }
+
+  void solve() {
+    auto entry = func_blocks(func)[0];
+    executable.insert(entry);
+    block_worklist.push_back(entry);
+    while (true) {
+      while (!block_worklist.empty() || !value_worklist.empty()) {
+        while (!value_worklist.empty()) {
+          auto v = value_worklist.back();
+          value_worklist.pop_back();
+          for (auto user : users[v]) {
+            if (executable.count(where[user]) == 0) continue;
+            visit(user);
+            if (user->kind.tag == KOOPA_RVT_JUMP || user->kind.tag == KOOPA_RVT_BRANCH) {
+              visit_edges_using(user);
+            }
+          }
+        }
+        while (!block_worklist.empty()) {
+          auto bb = block_worklist.back();
+          block_worklist.pop_back();
+          for (auto inst : bb_insts(bb)) visit(inst);
+        }
+      }
+      // 条件始终是TOP的br (来自未初始化的值) 视为两个方向都可能执行
+      bool forced = false;
+      std::vector<koopa_raw_basic_block_t> bbs(executable.begin(), executable.end());
+      for (auto bb : bbs) {
+        auto term = terminator(bb);
+        if (term->kind.tag != KOOPA_RVT_BRANCH || get(term->kind.data.branch.cond).state != TOP) continue;
+        forced |= mark_edge(term, 0);
+        forced |= mark_edge(term, 1);
+      }
+      if (!forced) break;
+    }
+  }
+
+  int rewrite() {
+    int cnt = 0;
+    std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> repl;
+    for (auto &[v, l] : lattice) {
+      if (l.state == CONST) {
+        repl[v] = make_integer(l.value);
+        ++cnt;
+      }
+    }
+    for (auto bb : func_blocks(func)) {
+      if (executable.count(bb) == 0) continue;
+      // 常量binary已经没有用处, 直接删除
+      std::vector<koopa_raw_value_t> kept;
+      for (auto inst : bb_insts(bb)) {
+        if (inst->kind.tag == KOOPA_RVT_BINARY && repl.count(inst)) continue;
+        kept.push_back(inst);
+      }
+      // 只有一条出边可执行的br改为jump
+      auto term = kept.back();
+      if (term->kind.tag == KOOPA_RVT_BRANCH) {
+        bool t = exec_edges.count({term, 0}), f = exec_edges.count({term, 1});
+        if (t != f) {
+          const auto &br = term->kind.data.branch;
+          kept.back() = t ? make_jump(br.true_bb, slice_items<koopa_raw_value_t>(br.true_args))
+                          : make_jump(br.false_bb, slice_items<koopa_raw_value_t>(br.false_args));
+        }
+      }
+      set_bb_insts(bb, kept);
+    }
+    remove_unreachable_blocks(func);
+    replace_uses(func, repl);
+    remove_dead_block_params(func);
+    return cnt;
+  }
+};
+
+inline int sccp(koopa_raw_function_t func) { return SCCP(func).run(); }
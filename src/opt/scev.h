@@ -0,0 +1,221 @@
+#pragma once
+#include "ir.h"
+#include "loop.h"
+#include "iv.h"
+#include "instcombine.h"
+
+// 标量演化: 用二项式基上的递推链 (chain of recurrences) 表示循环中的值
+// header第k次执行时 (k从0开始), v = c[0] + c[1]*C(k,1) + c[2]*C(k,2) + c[3]*C(k,3)
+// 系数都是preheader中可用的值: 常量、循环不变量, 或者新生成在preheader中的指令
+// header参数p在唯一的回边上传入 p + x 时, p(k) = p0 + sum(x(t), t < k), 系数为 [p0, x的系数...]
+// 乘法利用 k*C(k,j) = (j+1)*C(k,j+1) + j*C(k,j), 只支持其中一边次数不超过1
+
+static const int kMaxChrecDegree = 3;
+
+typedef std::vector<koopa_raw_value_t> Chrec;
+
+class ScalarEvolution {
+ public:
+  // 计算系数需要的指令追加到insts中, 由调用者插入preheader
+  ScalarEvolution(const Loop *l, const std::unordered_map<koopa_raw_value_t, koopa_raw_basic_block_t> &w,
+                  std::vector<koopa_raw_value_t> &i)
+      : loop(l), where(w), insts(i) {}
+
+  // 不能表示为递推链时返回false
+  bool get(koopa_raw_value_t v, Chrec &result) {
+    auto it = memo.find(v);
+    if (it != memo.end()) {
+      result = it->second.second;
+      return it->second.first;
+    }
+    // 递推链依赖于自身, 不是多项式
+    if (!in_progress.insert(v).second) {
+      hit_cycle = true;
+      return false;
+    }
+    bool outer = hit_cycle;
+    hit_cycle = false;
+    bool ok = compute(v, result) && result.size() <= size_t(kMaxChrecDegree + 1);
+    in_progress.erase(v);
+    // 因为依赖正在计算的header参数而失败时不记录, 那个参数算出来之后v可能也能算出来
+    if (ok || !hit_cycle) memo[v] = {ok, result};
+    hit_cycle |= outer;
+    return ok;
+  }
+
+  // header中的条件不再满足之前循环体执行的次数 (按无符号数解释), 无法计算时返回nullptr
+  // 要求循环只从header退出, 条件是步长为1或-1的归纳变量与循环不变量比较
+  koopa_raw_value_t trip_count() {
+    auto br = terminator(loop->header);
+    if (br->kind.tag != KOOPA_RVT_BRANCH) return nullptr;
+    bool t_in = loop->contains(br->kind.data.branch.true_bb), f_in = loop->contains(br->kind.data.branch.false_bb);
+    if (t_in == f_in) return nullptr;
+    auto cond = br->kind.data.branch.cond;
+    if (cond->kind.tag != KOOPA_RVT_BINARY) return nullptr;
+    auto op = cond->kind.data.binary.op;
+    auto lhs = cond->kind.data.binary.lhs, rhs = cond->kind.data.binary.rhs;
+    Chrec c;
+    if (is_invariant(lhs)) {
+      std::swap(lhs, rhs);
+      op = swapped_compare(op);
+    }
+    if (!is_invariant(rhs) || !get(lhs, c) || c.size() != 2 || !is_integer(c[1])) return nullptr;
+    if (f_in) op = inverted_compare(op);
+    auto init = c[0];
+    auto step = int_value(c[1]);
+    // 继续的条件为 init + k < n 时, 执行 (init < n) * (n - init) 次, 其他比较类似
+    if (step == 1 && (op == KOOPA_RBO_LT || op == KOOPA_RBO_LE)) {
+      auto dist = emit(KOOPA_RBO_ADD, emit(KOOPA_RBO_SUB, rhs, init), make_integer(op == KOOPA_RBO_LE));
+      return emit(KOOPA_RBO_MUL, emit(op, init, rhs), dist);
+    }
+    if (step == -1 && (op == KOOPA_RBO_GT || op == KOOPA_RBO_GE)) {
+      auto dist = emit(KOOPA_RBO_ADD, emit(KOOPA_RBO_SUB, init, rhs), make_integer(op == KOOPA_RBO_GE));
+      return emit(KOOPA_RBO_MUL, emit(op, init, rhs), dist);
+    }
+    return nullptr;
+  }
+
+  // header第n次执行时的值, n按无符号数解释, 结果按2^32取模
+  koopa_raw_value_t evaluate(const Chrec &c, koopa_raw_value_t n) {
+    koopa_raw_value_t result = c[0];
+    if (c.size() > 1) result = emit(KOOPA_RBO_ADD, result, emit(KOOPA_RBO_MUL, c[1], n));
+    if (c.size() > 2) {
+      // C(n,2) = (n >> 1) * (n - 1 + (n & 1)), 两个因子中总有一个已经除以2, 不会溢出
+      auto half = emit(KOOPA_RBO_SHR, n, make_integer(1));
+      auto other = emit(KOOPA_RBO_ADD, emit(KOOPA_RBO_SUB, n, make_integer(1)), emit(KOOPA_RBO_AND, n, make_integer(1)));
+      auto c2 = emit(KOOPA_RBO_MUL, half, other);
+      result = emit(KOOPA_RBO_ADD, result, emit(KOOPA_RBO_MUL, c[2], c2));
+      if (c.size() > 3) {
+        // C(n,3) = C(n,2) * (n - 2) / 3, 整除时可以乘以3模2^32的逆元
+        auto c3 = emit(KOOPA_RBO_MUL, emit(KOOPA_RBO_MUL, c2, emit(KOOPA_RBO_SUB, n, make_integer(2))),
+                       make_integer(int32_t(0xaaaaaaabu)));
+        result = emit(KOOPA_RBO_ADD, result, emit(KOOPA_RBO_MUL, c[3], c3));
+      }
+    }
+    return result;
+  }
+
+  bool is_invariant(koopa_raw_value_t v) const {
+    if (!is_local_value(v)) return true;
+    auto it = where.find(v);
+    return it != where.end() && !loop->contains(it->second);
+  }
+
+ private:
+  const Loop *loop;
+  const std::unordered_map<koopa_raw_value_t, koopa_raw_basic_block_t> &where;
+  std::vector<koopa_raw_value_t> &insts;
+  std::unordered_map<koopa_raw_value_t, std::pair<bool, Chrec>> memo;
+  std::unordered_set<koopa_raw_value_t> in_progress;
+  bool hit_cycle = false;
+
+  // 生成preheader中的指令, 折叠常量和简单的恒等式
+  koopa_raw_value_t emit(koopa_raw_binary_op_t op, koopa_raw_value_t lhs, koopa_raw_value_t rhs) {
+    int32_t c;
+    if (is_integer(lhs) && is_integer(rhs) && fold_binary(op, int_value(lhs), int_value(rhs), c)) {
+      return make_integer(c);
+    }
+    if (op == KOOPA_RBO_MUL && is_integer(lhs)) std::swap(lhs, rhs);
+    if (is_integer(rhs)) {
+      int32_t r = int_value(rhs);
+      if ((op == KOOPA_RBO_ADD || op == KOOPA_RBO_SUB) && r == 0) return lhs;
+      if (op == KOOPA_RBO_MUL && r == 1) return lhs;
+      if (op == KOOPA_RBO_MUL && r == 0) return rhs;
+    }
+    if (op == KOOPA_RBO_ADD && is_integer(lhs) && int_value(lhs) == 0) return rhs;
+    auto inst = make_binary(op, lhs, rhs);
+    insts.push_back(inst);
+    return inst;
+  }
+
+  Chrec add(const Chrec &a, const Chrec &b, koopa_raw_binary_op_t op) {
+    Chrec r(a.size() > b.size() ? a.size() : b.size(), make_integer(0));
+    for (size_t j = 0; j < r.size(); ++j) {
+      r[j] = emit(op, j < a.size() ? a[j] : make_integer(0), j < b.size() ? b[j] : make_integer(0));
+    }
+    return r;
+  }
+
+  // a * (x + y*k)
+  Chrec mul_linear(const Chrec &a, koopa_raw_value_t x, koopa_raw_value_t y) {
+    Chrec r(a.size() + 1, make_integer(0));
+    for (size_t j = 0; j < a.size(); ++j) {
+      auto jy = emit(KOOPA_RBO_MUL, y, make_integer(int32_t(j)));
+      r[j] = emit(KOOPA_RBO_ADD, r[j], emit(KOOPA_RBO_MUL, a[j], emit(KOOPA_RBO_ADD, x, jy)));
+      r[j + 1] = emit(KOOPA_RBO_MUL, emit(KOOPA_RBO_MUL, a[j], y), make_integer(int32_t(j + 1)));
+    }
+    while (r.size() > 1 && is_integer(r.back()) && int_value(r.back()) == 0) r.pop_back();
+    return r;
+  }
+
+  bool compute(koopa_raw_value_t v, Chrec &r) {
+    if (is_invariant(v)) {
+      if (v->ty->tag != KOOPA_RTT_INT32) return false;
+      r = {v};
+      return true;
+    }
+    auto it = where.find(v);
+    if (v->kind.tag == KOOPA_RVT_BLOCK_ARG_REF && it != where.end() && it->second == loop->header) {
+      return compute_param(v, r);
+    }
+    if (v->kind.tag != KOOPA_RVT_BINARY) return false;
+    const auto &b = v->kind.data.binary;
+    Chrec x, y;
+    if (!get(b.lhs, x) || !get(b.rhs, y)) return false;
+    switch (b.op) {
+      case KOOPA_RBO_ADD:
+      case KOOPA_RBO_SUB:
+        r = add(x, y, b.op);
+        return true;
+      case KOOPA_RBO_MUL:
+        if (x.size() > y.size()) std::swap(x, y);
+        if (x.size() == 1) {
+          r = mul_linear(y, x[0], make_integer(0));
+        } else if (x.size() == 2) {
+          r = mul_linear(y, x[0], x[1]);
+        } else {
+          return false;
+        }
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  bool compute_param(koopa_raw_value_t p, Chrec &r) {
+    auto edges = latch_edges(loop);
+    if (loop->preheader == nullptr || edges.size() != 1) return false;
+    auto params = bb_params(loop->header);
+    size_t index = std::find(params.begin(), params.end(), p) - params.begin();
+    auto init = slice_items<koopa_raw_value_t>(terminator(loop->preheader)->kind.data.jump.args)[index];
+    auto next = slice_items<koopa_raw_value_t>(edge_args(edges[0].term, edges[0].edge))[index];
+    if (!is_integer(init) && init->ty->tag != KOOPA_RTT_INT32) return false;
+    r = {init};
+    // 回边上的实参必须是 p + x, x不依赖于p
+    int cnt;
+    Chrec x;
+    if (!split(next, p, cnt, x) || cnt != 1) return false;
+    r.insert(r.end(), x.begin(), x.end());
+    return true;
+  }
+
+  // 把加减法表达式v拆成 cnt * p + x
+  bool split(koopa_raw_value_t v, koopa_raw_value_t p, int &cnt, Chrec &x) {
+    if (v == p) {
+      cnt = 1;
+      x = {make_integer(0)};
+      return true;
+    }
+    const auto &b = v->kind.data.binary;
+    if (v->kind.tag == KOOPA_RVT_BINARY && (b.op == KOOPA_RBO_ADD || b.op == KOOPA_RBO_SUB) && !is_invariant(v)) {
+      int lc, rc;
+      Chrec lx, rx;
+      if (!split(b.lhs, p, lc, lx) || !split(b.rhs, p, rc, rx)) return false;
+      cnt = b.op == KOOPA_RBO_ADD ? lc + rc : lc - rc;
+      x = add(lx, rx, b.op);
+      return true;
+    }
+    cnt = 0;
+    return get(v, x);
+  }
+};
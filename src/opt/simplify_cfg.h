@@ -0,0 +1,128 @@
+#pragma once
+#include "ir.h"
+
+// CFG化简, 反复执行到不动点:
+// 1. 条件为常量, 或两个出口完全相同的br改为jump
+// 2. 删除不可达的基本块
+// 3. 只含一条jump的空基本块直接被前驱跳过
+// 4. 唯一前驱以jump结尾的基本块合并到前驱中
+
+inline bool same_args(const koopa_raw_slice_t &a, const koopa_raw_slice_t &b) {
+  if (a.len != b.len) return false;
+  for (uint32_t i = 0; i < a.len; ++i) {
+    auto x = reinterpret_cast<koopa_raw_value_t>(a.buffer[i]);
+    auto y = reinterpret_cast<koopa_raw_value_t>(b.buffer[i]);
+    if (x != y && !(is_integer(x) && is_integer(y) && int_value(x) == int_value(y))) return false;
+  }
+  return true;
+}
+
+// 返回被改为jump的br数量
+inline int fold_branches(koopa_raw_function_t func) {
+  int cnt = 0;
+  for (auto bb : func_blocks(func)) {
+    auto term = terminator(bb);
+    if (term == nullptr || term->kind.tag != KOOPA_RVT_BRANCH) continue;
+    const auto &br = term->kind.data.branch;
+    koopa_raw_value_t jump = nullptr;
+    if (is_integer(br.cond)) {
+      if (int_value(br.cond) != 0) {
+        jump = make_jump(br.true_bb, slice_items<koopa_raw_value_t>(br.true_args));
+      } else {
+        jump = make_jump(br.false_bb, slice_items<koopa_raw_value_t>(br.false_args));
+      }
+    } else if (br.true_bb == br.false_bb && same_args(br.true_args, br.false_args)) {
+      jump = make_jump(br.true_bb, slice_items<koopa_raw_value_t>(br.true_args));
+    }
+    if (jump == nullptr) continue;
+    auto insts = bb_insts(bb);
+    insts.back() = jump;
+    set_bb_insts(bb, insts);
+    ++cnt;
+  }
+  return cnt;
+}
+
+// 跳过空基本块, 返回是否有改动
+inline bool skip_empty_blocks(koopa_raw_function_t func) {
+  auto bbs = func_blocks(func);
+  std::unordered_map<koopa_raw_basic_block_t, koopa_raw_value_t> forward;
+  for (size_t i = 1; i < bbs.size(); ++i) {
+    auto bb = bbs[i];
+    if (bb->params.len != 0 || bb->insts.len != 1) continue;
+    auto term = terminator(bb);
+    if (term->kind.tag != KOOPA_RVT_JUMP || term->kind.data.jump.target == bb) continue;
+    forward[bb] = term;
+  }
+  if (forward.empty()) return false;
+  bool changed = false;
+  for (auto bb : bbs) {
+    auto term = terminator(bb);
+    for (int e = 0; e < edge_count(term); ++e) {
+      // 沿空块组成的链找到最终的目标, 链成环时不做处理
+      auto target = edge_target(term, e);
+      koopa_raw_value_t last = nullptr;
+      std::unordered_set<koopa_raw_basic_block_t> seen;
+      while (forward.count(target) && seen.insert(target).second) {
+        last = forward[target];
+        target = last->kind.data.jump.target;
+      }
+      if (last == nullptr || forward.count(target)) continue;
+      const auto &jump = last->kind.data.jump;
+      edge_target(term, e) = jump.target;
+      edge_args(term, e) = make_slice(slice_items<koopa_raw_value_t>(jump.args), KOOPA_RSIK_VALUE);
+      changed = true;
+    }
+  }
+  if (changed) remove_unreachable_blocks(func);
+  return changed;
+}
+
+// 合并基本块, 返回是否有改动
+inline bool merge_blocks(koopa_raw_function_t func) {
+  CFG cfg(func);
+  auto bbs = func_blocks(func);
+  std::unordered_set<koopa_raw_basic_block_t> merged;
+  std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> repl;
+  for (auto bb : bbs) {
+    if (merged.count(bb)) continue;
+    // bb可能连续合并多个后继
+    while (true) {
+      auto term = terminator(bb);
+      if (term->kind.tag != KOOPA_RVT_JUMP) break;
+      auto succ = term->kind.data.jump.target;
+      if (succ == bb || succ == cfg.entry() || cfg.preds.at(succ).size() != 1) break;
+      auto params = bb_params(succ);
+      auto args = slice_items<koopa_raw_value_t>(term->kind.data.jump.args);
+      for (size_t i = 0; i < params.size(); ++i) {
+        repl[params[i]] = args[i];
+      }
+      auto insts = bb_insts(bb);
+      insts.pop_back();
+      for (auto inst : bb_insts(succ)) insts.push_back(inst);
+      set_bb_insts(bb, insts);
+      merged.insert(succ);
+    }
+  }
+  if (merged.empty()) return false;
+  std::vector<koopa_raw_basic_block_t> kept;
+  for (auto bb : bbs) {
+    if (merged.count(bb) == 0) kept.push_back(bb);
+  }
+  set_func_blocks(func, kept);
+  replace_uses(func, repl);
+  return true;
+}
+
+// 返回删除的基本块数量
+inline int simplify_cfg(koopa_raw_function_t func) {
+  int before = func->bbs.len;
+  bool changed = true;
+  while (changed) {
+    changed = fold_branches(func) > 0;
+    changed |= remove_unreachable_blocks(func);
+    changed |= skip_empty_blocks(func);
+    changed |= merge_blocks(func);
+  }
+  return before - int(func->bbs.len);
+}
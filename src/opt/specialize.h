@@ -0,0 +1,151 @@
+#pragma once
+#include <map>
+#include "ir.h"
+#include "clone.h"
+#include "callgraph.h"
+#include "sccp.h"
+#include "simplify_cfg.h"
+#include "instcombine.h"
+
+// 函数特化: 调用点的实参中有常量时, 复制一份去掉这些形参的被调用者, 常量代入函数体
+// 代入后用SCCP和CFG化简估计收益: 变成常量的值、删除的基本块, 以及常量形参直接参与的比较和乘除法
+// (它们决定循环的迭代次数和能否用移位代替), 收益足够时才保留副本
+// 同样的 (被调用者, 常量实参) 组合在整个程序中共用一个副本; 副本的数量和总大小都有上限
+
+static const int kMaxSpecializeSize = 300;
+static const int kMaxSpecializationsPerFunc = 4;
+static const int kSpecializeBudget = 1200;
+static const int kMinSpecializeGain = 2;
+
+class FunctionSpecializer {
+ public:
+  // 每个调用点的决定, 由调用者在--opt-report时输出
+  std::vector<std::string> remarks;
+
+  // optimize_clone对新的副本执行与其他函数相同的优化
+  FunctionSpecializer(const koopa_raw_program_t &p, CallGraph &g,
+                      const std::function<void(koopa_raw_function_t)> &opt)
+      : program(p), cg(g), optimize_clone(opt) {}
+
+  // 特化func中的调用点, 返回改为调用副本的调用点数量
+  int run(koopa_raw_function_t func) {
+    remarks.clear();
+    std::vector<koopa_raw_value_t> calls;
+    for (auto bb : func_blocks(func)) {
+      for (auto inst : bb_insts(bb)) {
+        if (inst->kind.tag == KOOPA_RVT_CALL) calls.push_back(inst);
+      }
+    }
+    int cnt = 0;
+    for (auto call : calls) {
+      auto callee = call->kind.data.call.callee;
+      const auto &node = cg.node(callee);
+      if (node.external || node.scc == cg.node(func).scc) continue;
+      Key key{callee, {}};
+      auto args = slice_items<koopa_raw_value_t>(call->kind.data.call.args);
+      std::vector<koopa_raw_value_t> kept;
+      for (size_t i = 0; i < args.size(); ++i) {
+        if (is_integer(args[i])) {
+          key.second.emplace_back(i, int_value(args[i]));
+        } else {
+          kept.push_back(args[i]);
+        }
+      }
+      if (key.second.empty()) continue;
+      auto it = clones.find(key);
+      if (it == clones.end()) it = clones.emplace(key, specialize(key)).first;
+      if (it->second == nullptr) continue;
+      cg.remove_call(call);
+      mut(call)->kind.data.call.callee = it->second;
+      mut(call)->kind.data.call.args = make_slice(kept, KOOPA_RSIK_VALUE);
+      cg.add_call(call, func);
+      ++cnt;
+    }
+    return cnt;
+  }
+
+ private:
+  // (被调用者, 常量实参的 (位置, 值))
+  typedef std::pair<koopa_raw_function_t, std::vector<std::pair<size_t, int32_t>>> Key;
+
+  const koopa_raw_program_t &program;
+  CallGraph &cg;
+  std::function<void(koopa_raw_function_t)> optimize_clone;
+  // 不值得特化的组合记为nullptr
+  std::map<Key, koopa_raw_function_t> clones;
+  std::unordered_map<koopa_raw_function_t, int> clone_cnt;
+  int budget = kSpecializeBudget;
+
+  static int func_size(koopa_raw_function_t f) {
+    int size = 0;
+    for (auto bb : func_blocks(f)) size += bb->insts.len;
+    return size;
+  }
+
+  static std::string describe(const Key &key) {
+    auto params = slice_items<koopa_raw_value_t>(key.first->params);
+    std::string s;
+    for (auto [i, v] : key.second) {
+      if (!s.empty()) s += ", ";
+      s += std::string(params[i]->name + 1) + " = " + std::to_string(v);
+    }
+    return s;
+  }
+
+  koopa_raw_function_t specialize(const Key &key) {
+    auto callee = key.first;
+    auto name = std::string(callee->name);
+    int size = func_size(callee);
+    if (size > kMaxSpecializeSize || size > budget || clone_cnt[callee] >= kMaxSpecializationsPerFunc) {
+      remarks.push_back("not specialized " + name + " for " + describe(key) + ": over budget");
+      return nullptr;
+    }
+
+    auto params = slice_items<koopa_raw_value_t>(callee->params);
+    std::vector<koopa_raw_value_t> kept;
+    std::unordered_map<koopa_raw_value_t, int32_t> consts;
+    for (auto [i, v] : key.second) consts[params[i]] = v;
+    for (auto p : params) {
+      if (!consts.count(p)) kept.push_back(p);
+    }
+    auto clone = make_function(unique_name(program, name + "_spec"), callee->ty->data.function.ret, kept);
+
+    // 常量形参直接参与的比较和乘除法
+    int gain = 0;
+    auto users = build_users(callee);
+    for (auto [p, v] : consts) {
+      for (auto user : users[p]) {
+        if (user->kind.tag != KOOPA_RVT_BINARY) continue;
+        auto op = user->kind.data.binary.op;
+        if (is_compare(op) || op == KOOPA_RBO_MUL || op == KOOPA_RBO_DIV || op == KOOPA_RBO_MOD) ++gain;
+      }
+    }
+
+    CloneMap map;
+    auto clone_params = slice_items<koopa_raw_value_t>(clone->params);
+    for (size_t i = 0, j = 0; i < params.size(); ++i) {
+      map.values[params[i]] = consts.count(params[i]) ? make_integer(consts[params[i]]) : clone_params[j++];
+    }
+    set_func_blocks(clone, clone_blocks(func_blocks(callee), map));
+    gain += sccp(clone);
+    gain += simplify_cfg(clone);
+    if (gain < kMinSpecializeGain) {
+      remarks.push_back("not specialized " + name + " for " + describe(key) + ": gain " + std::to_string(gain));
+      return nullptr;
+    }
+
+    ++clone_cnt[callee];
+    budget -= size;
+    insert_function(program, clone, callee);
+    cg.add_function(clone, callee);
+    for (auto bb : func_blocks(clone)) {
+      for (auto inst : bb_insts(bb)) {
+        if (inst->kind.tag == KOOPA_RVT_CALL) cg.add_call(inst, clone);
+      }
+    }
+    optimize_clone(clone);
+    remarks.push_back("specialized " + name + " for " + describe(key) + " as " + std::string(clone->name) + " (gain " +
+                      std::to_string(gain) + ")");
+    return clone;
+  }
+};
@@ -0,0 +1,103 @@
+#pragma once
+#include <map>
+#include "ir.h"
+
+// 标量替换 (SROA): 小的局部数组只通过常量下标的getelemptr/getptr访问, 且地址没有逃逸
+// (没有传给call或基本块参数, 没有变量下标的访问, 也没有被store存起来) 时, 每个被访问的元素拆成一个单独的i32 alloc,
+// 随后由mem2reg提升为SSA值, 数组不再占用栈帧, 访存也随之消失
+// 常量下标通常来自完全展开的循环, 所以在循环优化和清理之后执行
+
+// 拆分的数组最多的元素个数
+static const int kMaxSROAElems = 32;
+
+class SROA {
+ public:
+  explicit SROA(koopa_raw_function_t f) : func(f) {}
+
+  // 返回拆分的数组数量
+  int run() {
+    users = build_users(func);
+    int cnt = 0;
+    for (auto bb : func_blocks(func)) {
+      std::vector<koopa_raw_value_t> insts;
+      for (auto inst : bb_insts(bb)) {
+        if (inst->kind.tag != KOOPA_RVT_ALLOC || !is_splittable(inst)) {
+          insts.push_back(inst);
+          continue;
+        }
+        // 元素的alloc放在原来的数组的位置
+        for (auto &[offset, scalar] : scalars) insts.push_back(scalar);
+        ++cnt;
+      }
+      set_bb_insts(bb, insts);
+    }
+    if (cnt == 0) return 0;
+    for (auto bb : func_blocks(func)) {
+      std::vector<koopa_raw_value_t> kept;
+      for (auto inst : bb_insts(bb)) {
+        if (removed.count(inst) == 0) kept.push_back(inst);
+      }
+      set_bb_insts(bb, kept);
+    }
+    replace_uses(func, repl);
+    return cnt;
+  }
+
+ private:
+  koopa_raw_function_t func;
+  std::unordered_map<koopa_raw_value_t, std::vector<koopa_raw_value_t>> users;
+  std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> repl;
+  std::unordered_set<koopa_raw_value_t> removed;
+  // 当前数组中被访问的元素: 字节偏移 -> 元素的alloc
+  std::map<int, koopa_raw_value_t> scalars;
+  // 当前数组的字节数
+  int size = 0;
+
+  // 检查alloc能否拆分, 可以时记录每个getelemptr的替换
+  bool is_splittable(koopa_raw_value_t alloc) {
+    auto ty = alloc->ty->data.pointer.base;
+    if (ty->tag != KOOPA_RTT_ARRAY || type_size(ty) / 4 > kMaxSROAElems) return false;
+    size = type_size(ty);
+    std::vector<std::pair<koopa_raw_value_t, int>> geps;
+    if (!collect(alloc, 0, geps)) return false;
+    scalars.clear();
+    for (auto [gep, offset] : geps) {
+      removed.insert(gep);
+      if (gep->ty->data.pointer.base->tag != KOOPA_RTT_INT32) continue;
+      auto &scalar = scalars[offset];
+      if (scalar == nullptr) scalar = make_alloc(type_i32());
+      repl[gep] = scalar;
+    }
+    return true;
+  }
+
+  // ptr的使用者都是常量下标的getelemptr/getptr, i32地址只用于load和store的目的地址
+  bool collect(koopa_raw_value_t ptr, int offset, std::vector<std::pair<koopa_raw_value_t, int>> &geps) {
+    for (auto user : users[ptr]) {
+      bool scalar = ptr->ty->data.pointer.base->tag == KOOPA_RTT_INT32;
+      if (scalar && user->kind.tag == KOOPA_RVT_LOAD) continue;
+      if (scalar && user->kind.tag == KOOPA_RVT_STORE && user->kind.data.store.value != ptr) continue;
+      int elem;
+      if (!scalar && user->kind.tag == KOOPA_RVT_GET_ELEM_PTR) {
+        auto index = user->kind.data.get_elem_ptr.index;
+        auto len = ptr->ty->data.pointer.base->data.array.len;
+        if (!is_integer(index) || int_value(index) < 0 || size_t(int_value(index)) >= len) return false;
+        elem = offset + int_value(index) * type_size(user->ty->data.pointer.base);
+      } else if (user->kind.tag == KOOPA_RVT_GET_PTR && user->kind.data.get_ptr.src == ptr) {
+        // 强度削弱和展开之后的指针递推, 偏移仍要落在数组之内
+        auto index = user->kind.data.get_ptr.index;
+        if (!is_integer(index)) return false;
+        int64_t pos = offset + int64_t(int_value(index)) * type_size(user->ty->data.pointer.base);
+        if (pos < 0 || pos + type_size(user->ty->data.pointer.base) > size) return false;
+        elem = int(pos);
+      } else {
+        return false;
+      }
+      geps.emplace_back(user, elem);
+      if (!collect(user, elem, geps)) return false;
+    }
+    return true;
+  }
+};
+
+inline int sroa(koopa_raw_function_t func) { return SROA(func).run(); }
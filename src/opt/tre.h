@@ -0,0 +1,86 @@
+#pragma once
+#include "ir.h"
+#include "alias.h"
+#include "callgraph.h"
+
+// 尾递归消除: 函数末尾的自调用 (call之后紧跟着返回它的结果的ret) 改为跳回函数开头的循环
+// 新建一个入口块, 原来的入口块成为循环的header, 以函数的形参为参数;
+// 函数中对形参的使用都改为使用header的参数, 尾调用改为带着实参跳到header
+// 尾调用的实参指向本函数的alloc时不能消除: 递归调用时alloc是新的栈帧, 消除后会与实参重叠
+
+class TailRecursionElimination {
+ public:
+  TailRecursionElimination(koopa_raw_function_t f, CallGraph &g) : func(f), cg(g) {}
+
+  // 返回消除的尾调用数量
+  int run() {
+    std::vector<koopa_raw_basic_block_t> sites;
+    for (auto bb : func_blocks(func)) {
+      if (tail_self_call(bb) != nullptr) sites.push_back(bb);
+    }
+    if (sites.empty()) return 0;
+
+    auto bbs = func_blocks(func);
+    auto header = bbs[0];
+    auto entry = make_block("tre_entry");
+    // alloc留在新的入口, 不随循环重复
+    std::vector<koopa_raw_value_t> allocs, rest;
+    for (auto inst : bb_insts(header)) {
+      (inst->kind.tag == KOOPA_RVT_ALLOC ? allocs : rest).push_back(inst);
+    }
+    set_bb_insts(header, rest);
+
+    auto args = slice_items<koopa_raw_value_t>(func->params);
+    std::vector<koopa_raw_value_t> params;
+    std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> repl;
+    for (auto arg : args) {
+      params.push_back(make_block_arg(arg->ty, params.size()));
+      repl[arg] = params.back();
+    }
+    set_bb_params(header, params);
+    replace_uses(func, repl);
+
+    for (auto bb : sites) {
+      auto insts = bb_insts(bb);
+      auto call = insts[insts.size() - 2];
+      cg.remove_call(call);
+      insts.resize(insts.size() - 2);
+      insts.push_back(make_jump(header, slice_items<koopa_raw_value_t>(call->kind.data.call.args)));
+      set_bb_insts(bb, insts);
+    }
+
+    allocs.push_back(make_jump(header, args));
+    set_bb_insts(entry, allocs);
+    bbs.insert(bbs.begin(), entry);
+    set_func_blocks(func, bbs);
+    return sites.size();
+  }
+
+ private:
+  koopa_raw_function_t func;
+  CallGraph &cg;
+
+  koopa_raw_value_t tail_self_call(koopa_raw_basic_block_t bb) {
+    auto insts = bb_insts(bb);
+    if (insts.size() < 2) return nullptr;
+    auto call = insts[insts.size() - 2], ret = insts.back();
+    if (call->kind.tag != KOOPA_RVT_CALL || call->kind.data.call.callee != func || ret->kind.tag != KOOPA_RVT_RETURN) {
+      return nullptr;
+    }
+    if (ret->kind.data.ret.value != (call->ty->tag == KOOPA_RTT_UNIT ? nullptr : call)) return nullptr;
+    for (auto arg : slice_items<koopa_raw_value_t>(call->kind.data.call.args)) {
+      if (arg->ty->tag == KOOPA_RTT_POINTER && !is_outside_pointer(arg)) return nullptr;
+    }
+    return call;
+  }
+
+  // 指针一定来自全局变量或调用者传入的指针
+  static bool is_outside_pointer(koopa_raw_value_t ptr) {
+    auto tag = pointer_base(ptr)->kind.tag;
+    return tag == KOOPA_RVT_GLOBAL_ALLOC || tag == KOOPA_RVT_FUNC_ARG_REF;
+  }
+};
+
+inline int eliminate_tail_recursion(koopa_raw_function_t func, CallGraph &cg) {
+  return TailRecursionElimination(func, cg).run();
+}
@@ -0,0 +1,323 @@
+#pragma once
+#include "ir.h"
+#include "loop.h"
+#include "iv.h"
+#include "clone.h"
+#include "instcombine.h"
+
+// 循环展开, 只处理最内层的、只在header中用归纳变量与循环不变量比较来退出的循环
+// 1. 初值和边界都是常量且迭代次数少时完全展开: 把循环体复制N份串起来, 之后SCCP会折叠每份中的比较
+// 2. 否则按代码量预算选择展开因子U部分展开: 新循环每次迭代先检查 iv 与 bound - (U-1)*step 的比较,
+//    即接下来的U次迭代都满足条件 (按数学上的值, 中间不会回绕), 然后连续执行U份循环体;
+//    剩下不足U次的迭代交给原来的循环 (余数循环) 执行
+// 3. 部分展开时, 形如 s = s + x 的累加拆分到U个累加器上, 退出时再求和, 打断相邻迭代之间的依赖
+
+static const int kMaxFullUnrollTrips = 64;
+static const int kFullUnrollBudget = 256;
+static const int kPartialUnrollBudget = 64;
+static const int kMaxUnrollFactor = 8;
+
+class LoopUnroller {
+ public:
+  // factor: 部分展开的最大因子, 0表示按代码量自动选择, 1表示不展开
+  // remainders: 收集部分展开留下的余数循环的header
+  LoopUnroller(koopa_raw_function_t f, int factor, std::unordered_set<koopa_raw_basic_block_t> &remainders)
+      : func(f), max_factor(factor), remainders(remainders) {}
+
+  // 返回展开的循环数量
+  int run() {
+    if (max_factor == 1) return 0;
+    insert_preheaders(func);
+    int cnt = 0;
+    while (true) {
+      LoopInfo li(func);
+      where = build_inst_blocks(func);
+      bool changed = false;
+      for (auto loop : li.loops) {
+        if (done.count(loop->header)) continue;
+        done.insert(loop->header);
+        Shape shape;
+        if (!analyze(li, loop, shape)) continue;
+        if (try_full_unroll(shape) || try_partial_unroll(shape)) {
+          ++cnt;
+          changed = true;
+          break;
+        }
+      }
+      if (!changed) break;
+    }
+    return cnt;
+  }
+
+ private:
+  struct Shape {
+    const Loop *loop;
+    koopa_raw_value_t br;
+    // br中留在循环中的出边
+    int stay;
+    InductionVar iv;
+    int32_t step;
+    koopa_raw_binary_op_t stay_op;
+    koopa_raw_value_t bound;
+    std::vector<LatchEdge> edges;
+    int size;
+  };
+
+  koopa_raw_function_t func;
+  int max_factor;
+  std::unordered_map<koopa_raw_value_t, koopa_raw_basic_block_t> where;
+  std::unordered_set<koopa_raw_basic_block_t> done;
+  std::unordered_set<koopa_raw_basic_block_t> &remainders;
+
+  bool analyze(const LoopInfo &li, const Loop *loop, Shape &s) {
+    if (!loop->children.empty() || loop->preheader == nullptr) return false;
+    auto header = loop->header;
+    auto exiting = li.exiting_blocks(loop);
+    if (exiting.size() != 1 || exiting[0] != header) return false;
+    auto br = terminator(header);
+    if (br->kind.tag != KOOPA_RVT_BRANCH) return false;
+    bool t_in = loop->contains(br->kind.data.branch.true_bb), f_in = loop->contains(br->kind.data.branch.false_bb);
+    if (t_in == f_in) return false;
+    s.loop = loop;
+    s.br = br;
+    s.stay = t_in ? 0 : 1;
+    s.edges = latch_edges(loop);
+
+    auto cond = br->kind.data.branch.cond;
+    if (cond->kind.tag != KOOPA_RVT_BINARY || !is_compare(cond->kind.data.binary.op)) return false;
+    auto op = cond->kind.data.binary.op;
+    auto lhs = cond->kind.data.binary.lhs, rhs = cond->kind.data.binary.rhs;
+    auto ivs = find_induction_vars(loop);
+    AffineAnalysis aa(loop, ivs, where);
+    auto find_iv = [&](koopa_raw_value_t v) -> const InductionVar * {
+      for (auto &iv : ivs) {
+        if (iv.param == v) return &iv;
+      }
+      return nullptr;
+    };
+    auto iv = find_iv(lhs);
+    if (iv == nullptr && (iv = find_iv(rhs)) != nullptr) {
+      std::swap(lhs, rhs);
+      op = swapped_compare(op);
+    }
+    if (iv == nullptr || !aa.is_invariant(rhs)) return false;
+    for (auto step : iv->steps) {
+      if (step != iv->steps[0]) return false;
+    }
+    s.iv = *iv;
+    s.step = iv->steps[0];
+    s.stay_op = s.stay == 0 ? op : inverted_compare(op);
+    s.bound = rhs;
+    if (!(((s.stay_op == KOOPA_RBO_LT || s.stay_op == KOOPA_RBO_LE) && s.step > 0) ||
+          ((s.stay_op == KOOPA_RBO_GT || s.stay_op == KOOPA_RBO_GE) && s.step < 0))) {
+      return false;
+    }
+    s.size = 0;
+    for (auto bb : loop->blocks) s.size += bb->insts.len;
+    return true;
+  }
+
+  // 复制count份循环体, 每份中header的br改为直接进入循环体, 回边的目标由调用者设置
+  std::vector<CloneMap> chain_copies(const Shape &s, int count, std::vector<koopa_raw_basic_block_t> &new_blocks) {
+    auto header = s.loop->header;
+    std::vector<koopa_raw_basic_block_t> bbs;
+    bbs.push_back(header);
+    for (auto bb : func_blocks(func)) {
+      if (bb != header && s.loop->contains(bb)) bbs.push_back(bb);
+    }
+    std::vector<CloneMap> maps(count);
+    for (int k = 0; k < count; ++k) {
+      auto copies = clone_blocks(bbs, maps[k]);
+      new_blocks.insert(new_blocks.end(), copies.begin(), copies.end());
+      // header副本不再检查退出条件
+      auto h = maps[k].blocks[header];
+      auto insts = bb_insts(h);
+      const auto &br = s.br->kind.data.branch;
+      insts.back() = s.stay == 0 ? make_jump(maps[k](br.true_bb), slice_items<koopa_raw_value_t>(br.true_args))
+                                 : make_jump(maps[k](br.false_bb), slice_items<koopa_raw_value_t>(br.false_args));
+      remap_inst(insts.back(), maps[k]);
+      set_bb_insts(h, insts);
+    }
+    return maps;
+  }
+
+  // 第k份中回边的副本
+  std::vector<LatchEdge> copied_edges(const Shape &s, const CloneMap &map) {
+    std::vector<LatchEdge> edges;
+    for (auto &le : s.edges) edges.push_back({map(le.term), le.edge});
+    return edges;
+  }
+
+  bool try_full_unroll(const Shape &s) {
+    if (!is_integer(s.iv.init) || !is_integer(s.bound)) return false;
+    int trips = 0;
+    int32_t x = int_value(s.iv.init), result;
+    while (trips <= kMaxFullUnrollTrips && fold_binary(s.stay_op, x, int_value(s.bound), result) && result) {
+      x = int32_t(uint32_t(x) + uint32_t(s.step));
+      ++trips;
+    }
+    if (trips == 0 || trips > kMaxFullUnrollTrips || trips * s.size > kFullUnrollBudget) return false;
+
+    auto header = s.loop->header, pre = s.loop->preheader;
+    std::vector<koopa_raw_basic_block_t> new_blocks;
+    auto maps = chain_copies(s, trips, new_blocks);
+    for (int k = 0; k < trips; ++k) {
+      auto next = k + 1 < trips ? maps[k + 1].blocks[header] : header;
+      for (auto &le : copied_edges(s, maps[k])) edge_target(le.term, le.edge) = next;
+    }
+    // 最后一份跳回原来的header, 它的条件一定不成立, 原来的循环体随后会被删除
+    edge_target(terminator(pre), 0) = maps[0].blocks[header];
+    insert_blocks(new_blocks, header);
+    return true;
+  }
+
+  // 可以拆分到多个累加器的参数下标, 以及每个参数对应的累加指令
+  std::vector<std::pair<size_t, koopa_raw_value_t>> find_reductions(const Shape &s) {
+    std::vector<std::pair<size_t, koopa_raw_value_t>> reductions;
+    if (s.edges.size() != 1) return reductions;
+    std::unordered_map<koopa_raw_value_t, int> uses;
+    for (auto bb : s.loop->blocks) {
+      for (auto inst : bb_insts(bb)) {
+        for (auto op : operands(inst)) ++uses[op];
+      }
+    }
+    auto params = bb_params(s.loop->header);
+    auto args = slice_items<koopa_raw_value_t>(edge_args(s.edges[0].term, s.edges[0].edge));
+    for (size_t i = 0; i < params.size(); ++i) {
+      auto p = params[i], a = args[i];
+      if (i == s.iv.index || a->kind.tag != KOOPA_RVT_BINARY || uses[p] != 1 || uses[a] != 1) continue;
+      const auto &b = a->kind.data.binary;
+      bool ok = (b.op == KOOPA_RBO_ADD && (b.lhs == p) != (b.rhs == p)) ||
+                (b.op == KOOPA_RBO_SUB && b.lhs == p && b.rhs != p);
+      if (ok) reductions.emplace_back(i, a);
+    }
+    return reductions;
+  }
+
+  bool try_partial_unroll(const Shape &s) {
+    int factor = max_factor;
+    if (factor == 0) {
+      factor = 1;
+      while (factor * 2 <= kMaxUnrollFactor && factor * 2 * s.size <= kPartialUnrollBudget) factor *= 2;
+    }
+    // (U-1)*step 溢出时不展开
+    int64_t span = int64_t(s.step) * (factor - 1);
+    if (factor < 2 || span < INT32_MIN || span > INT32_MAX) return false;
+    // bound - (U-1)*step 溢出时没有iv能连续满足U次条件, 常量边界时直接不展开
+    int64_t lo = s.step > 0 ? INT32_MIN + span : INT32_MIN, hi = s.step > 0 ? INT32_MAX : INT32_MAX + span;
+    if (is_integer(s.bound) && (int_value(s.bound) < lo || int_value(s.bound) > hi)) return false;
+    auto header = s.loop->header, pre = s.loop->preheader;
+    auto params = bb_params(header);
+    auto reductions = find_reductions(s);
+    // 展开后的循环的header: 参数为原来的参数, 加上每个累加器额外的U-1个参数
+    auto uh = make_block("unroll_header");
+    std::vector<koopa_raw_value_t> uh_params;
+    for (auto p : params) {
+      uh_params.push_back(make_block_arg(p->ty, uh_params.size()));
+      auto it = derived_pointers.find(p);
+      if (it != derived_pointers.end()) note_derived_pointer(uh_params.back(), it->second);
+    }
+    std::vector<std::vector<koopa_raw_value_t>> accs;
+    for (auto &r : reductions) {
+      std::vector<koopa_raw_value_t> acc{uh_params[r.first]};
+      for (int k = 1; k < factor; ++k) {
+        acc.push_back(make_block_arg(type_i32(), uh_params.size()));
+        uh_params.push_back(acc.back());
+      }
+      accs.push_back(acc);
+    }
+    set_bb_params(uh, uh_params);
+
+    std::vector<koopa_raw_basic_block_t> new_blocks{uh};
+    auto maps = chain_copies(s, factor, new_blocks);
+
+    // uh: 检查接下来的U次迭代是否都满足条件
+    // 比较 iv stay_op bound - (U-1)*step 而不是 iv + (U-1)*step stay_op bound, 后者在iv接近边界时会回绕
+    // iv本身满足这个比较时, iv到iv + (U-1)*step都在iv和bound之间, 中间的递增也不会回绕
+    auto pre_insts = bb_insts(pre);
+    pre_insts.pop_back();
+    koopa_raw_value_t limit;
+    if (is_integer(s.bound)) {
+      limit = make_integer(int32_t(int_value(s.bound) - span));
+    } else {
+      limit = make_binary(KOOPA_RBO_SUB, s.bound, make_integer(int32_t(span)));
+      pre_insts.push_back(limit);
+    }
+    auto cond = make_binary(s.stay_op, uh_params[s.iv.index], limit);
+    auto exit = make_block("unroll_exit");
+    std::vector<koopa_raw_value_t> first_args(uh_params.begin(), uh_params.begin() + params.size());
+    auto uh_br = make_branch(cond, maps[0].blocks[header], exit);
+    mut(uh_br)->kind.data.branch.true_args = make_slice(first_args, KOOPA_RSIK_VALUE);
+    set_bb_insts(uh, {cond, uh_br});
+
+    // 串起各份循环体, 第k份使用第k个累加器
+    for (int k = 0; k < factor; ++k) {
+      for (auto &le : copied_edges(s, maps[k])) {
+        auto args = slice_items<koopa_raw_value_t>(edge_args(le.term, le.edge));
+        if (k + 1 < factor) {
+          for (size_t r = 0; r < reductions.size(); ++r) args[reductions[r].first] = accs[r][k + 1];
+          edge_target(le.term, le.edge) = maps[k + 1].blocks[header];
+        } else {
+          for (size_t r = 0; r < reductions.size(); ++r) {
+            args[reductions[r].first] = maps[0](reductions[r].second);
+            for (int j = 1; j < factor; ++j) args.push_back(maps[j](reductions[r].second));
+          }
+          edge_target(le.term, le.edge) = uh;
+        }
+        edge_args(le.term, le.edge) = make_slice(args, KOOPA_RSIK_VALUE);
+      }
+    }
+
+    // 退出展开的循环时把累加器求和, 再进入余数循环
+    std::vector<koopa_raw_value_t> exit_insts;
+    std::vector<koopa_raw_value_t> rest_args = first_args;
+    for (size_t r = 0; r < reductions.size(); ++r) {
+      koopa_raw_value_t sum = accs[r][0];
+      for (int k = 1; k < factor; ++k) {
+        sum = make_binary(KOOPA_RBO_ADD, sum, accs[r][k]);
+        exit_insts.push_back(sum);
+      }
+      rest_args[reductions[r].first] = sum;
+    }
+    exit_insts.push_back(make_jump(header, rest_args));
+    set_bb_insts(exit, exit_insts);
+    new_blocks.push_back(exit);
+
+    // preheader: bound - (U-1)*step 不会溢出时才进入展开的循环, 初值由uh检查
+    auto entry = terminator(pre);
+    auto init_args = slice_items<koopa_raw_value_t>(entry->kind.data.jump.args);
+    auto uh_args = init_args;
+    for (size_t r = 0; r < reductions.size(); ++r) {
+      for (int k = 1; k < factor; ++k) uh_args.push_back(make_integer(0));
+    }
+    koopa_raw_value_t guard;
+    if (is_integer(s.bound)) {
+      guard = make_integer(1);
+    } else {
+      guard = make_binary(s.step > 0 ? KOOPA_RBO_GE : KOOPA_RBO_LE, s.bound, make_integer(int32_t(s.step > 0 ? lo : hi)));
+      pre_insts.push_back(guard);
+    }
+    auto pre_br = make_branch(guard, uh, header);
+    mut(pre_br)->kind.data.branch.true_args = make_slice(uh_args, KOOPA_RSIK_VALUE);
+    mut(pre_br)->kind.data.branch.false_args = make_slice(init_args, KOOPA_RSIK_VALUE);
+    pre_insts.push_back(pre_br);
+    set_bb_insts(pre, pre_insts);
+
+    insert_blocks(new_blocks, header);
+    done.insert(uh);
+    // 原来的循环成为余数循环, 通常最多执行U-1次
+    remainders.insert(header);
+    return true;
+  }
+
+  void insert_blocks(const std::vector<koopa_raw_basic_block_t> &new_blocks, koopa_raw_basic_block_t pos) {
+    auto bbs = func_blocks(func);
+    bbs.insert(std::find(bbs.begin(), bbs.end(), pos), new_blocks.begin(), new_blocks.end());
+    set_func_blocks(func, bbs);
+  }
+};
+
+inline int unroll_loops(koopa_raw_function_t func, int factor,
+                        std::unordered_set<koopa_raw_basic_block_t> &remainders) {
+  return LoopUnroller(func, factor, remainders).run();
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include "ir.h"
+#include "loop.h"
+#include "clone.h"
+#include "mem2reg.h"
+
+// 循环外提条件 (unswitching): 循环中br的条件是循环不变量时, 把整个循环复制一份,
+// 原来的循环中该br改为跳到真分支, 副本中改为跳到假分支, preheader根据条件选择进入哪个循环
+// 循环中定义、在循环外使用的值有两个定义, 用repair_ssa修复
+// 条件已被循环外支配循环的同一个br判断过时, 只把循环中的br折叠为jump
+// 每个函数复制的指令总数有预算, 防止代码膨胀
+
+static const int kMaxUnswitchLoopSize = 80;
+static const int kUnswitchFuncBudget = 240;
+
+class LoopUnswitch {
+ public:
+  explicit LoopUnswitch(koopa_raw_function_t f) : func(f) {}
+
+  // 返回外提的条件数量
+  int run() {
+    int cnt = 0;
+    while (true) {
+      insert_preheaders(func);
+      LoopInfo li(func);
+      where = build_inst_blocks(func);
+      bool changed = false;
+      // 从外层循环开始, 外层循环外提条件时内层循环也一起复制
+      for (auto it = li.loops.rbegin(); it != li.loops.rend() && !changed; ++it) {
+        auto loop = *it;
+        if (loop->preheader == nullptr) continue;
+        auto br = find_invariant_branch(li, loop);
+        if (br == nullptr) continue;
+        // 进入循环前已经判断过同一个条件时直接折叠, 复制出的循环永远不会执行
+        bool taken;
+        if (decided_by_guard(li, loop, br->kind.data.branch.cond, taken)) {
+          fold(where[br], br, taken);
+          changed = true;
+          continue;
+        }
+        int size = 0;
+        for (auto bb : loop->blocks) size += bb->insts.len;
+        if (size > kMaxUnswitchLoopSize || size > budget) continue;
+        unswitch(li, loop, br);
+        budget -= size;
+        ++cnt;
+        changed = true;
+      }
+      if (!changed) break;
+    }
+    return cnt;
+  }
+
+ private:
+  koopa_raw_function_t func;
+  std::unordered_map<koopa_raw_value_t, koopa_raw_basic_block_t> where;
+  int budget = kUnswitchFuncBudget;
+
+  koopa_raw_value_t find_invariant_branch(const LoopInfo &li, const Loop *loop) {
+    for (auto bb : li.loop_blocks(loop)) {
+      auto term = terminator(bb);
+      if (term->kind.tag != KOOPA_RVT_BRANCH) continue;
+      const auto &br = term->kind.data.branch;
+      // 常量条件交给SCCP
+      if (br.true_bb == br.false_bb || !is_local_value(br.cond)) continue;
+      auto it = where.find(br.cond);
+      if (it != where.end() && !loop->contains(it->second)) return term;
+    }
+    return nullptr;
+  }
+
+  // 支配header的边 X -> S (S只有X一个前驱且支配header) 来自 br cond 时, cond在循环中的值已经确定
+  static bool decided_by_guard(const LoopInfo &li, const Loop *loop, koopa_raw_value_t cond, bool &taken) {
+    for (auto s = loop->header; s != li.cfg.entry(); s = li.dt.idom.at(s)) {
+      std::vector<koopa_raw_basic_block_t> preds;
+      for (auto p : li.cfg.preds.at(s)) {
+        if (li.cfg.reachable(p)) preds.push_back(p);
+      }
+      if (preds.size() != 1) continue;
+      auto term = terminator(preds[0]);
+      if (term->kind.tag != KOOPA_RVT_BRANCH) continue;
+      const auto &b = term->kind.data.branch;
+      if (b.cond != cond || b.true_bb == b.false_bb) continue;
+      taken = s == b.true_bb;
+      return true;
+    }
+    return false;
+  }
+
+  // br改为跳到taken对应的分支
+  static void fold(koopa_raw_basic_block_t bb, koopa_raw_value_t term, bool taken) {
+    const auto &b = term->kind.data.branch;
+    auto insts = bb_insts(bb);
+    insts.back() = taken ? make_jump(b.true_bb, slice_items<koopa_raw_value_t>(b.true_args))
+                         : make_jump(b.false_bb, slice_items<koopa_raw_value_t>(b.false_args));
+    set_bb_insts(bb, insts);
+  }
+
+  void unswitch(const LoopInfo &li, const Loop *loop, koopa_raw_value_t br) {
+    auto header = loop->header, pre = loop->preheader;
+    auto bbs = li.loop_blocks(loop);
+    CloneMap map;
+    auto copies = clone_blocks(bbs, map);
+
+    // 原来的循环走真分支, 副本走假分支
+    auto br_bb = where[br];
+    fold(map(br_bb), map(br), false);
+    fold(br_bb, br, true);
+
+    auto entry = terminator(pre);
+    auto args = slice_items<koopa_raw_value_t>(entry->kind.data.jump.args);
+    auto select = make_branch(br->kind.data.branch.cond, header, map(header));
+    mut(select)->kind.data.branch.true_args = make_slice(args, KOOPA_RSIK_VALUE);
+    mut(select)->kind.data.branch.false_args = make_slice(args, KOOPA_RSIK_VALUE);
+    auto pre_insts = bb_insts(pre);
+    pre_insts.back() = select;
+    set_bb_insts(pre, pre_insts);
+
+    // 副本放在原来的循环之后
+    auto order = func_blocks(func);
+    auto pos = order.end();
+    for (auto it = order.begin(); it != order.end(); ++it) {
+      if (loop->contains(*it)) pos = it + 1;
+    }
+    order.insert(pos, copies.begin(), copies.end());
+    set_func_blocks(func, order);
+
+    std::vector<DefPair> defs;
+    for (auto bb : bbs) {
+      for (auto p : bb_params(bb)) defs.push_back({p, bb, map(p), map(bb)});
+      for (auto inst : bb_insts(bb)) {
+        if (inst->ty->tag != KOOPA_RTT_UNIT) defs.push_back({inst, bb, map(inst), map(bb)});
+      }
+    }
+    std::unordered_set<koopa_raw_basic_block_t> inside(bbs.begin(), bbs.end());
+    inside.insert(copies.begin(), copies.end());
+    repair_ssa(func, defs, [&](koopa_raw_basic_block_t bb) { return inside.count(bb) > 0; });
+  }
+};
+
+inline int unswitch_loops(koopa_raw_function_t func) { return LoopUnswitch(func).run(); }
@@ -0,0 +1,166 @@
+// 常量除法、取余和常量乘法指令序列的穷举测试: make test
+// 捕获div_by_const/mul_by_const输出的汇编, 用一个小解释器按RV32的语义执行, 与C的 / % * 比较
+// 除数覆盖 |d| <= 5000, ±(2^k-1), ±2^k, ±(2^k+1), INT_MIN, INT_MAX 和随机值;
+// 被除数覆盖边界值、随机值以及 d*m 附近的值 (商在这里跳变)
+#include <cstdio>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <sstream>
+// RISCV.h定义了max宏, 要放在标准库头文件之后
+#include "RISCV.h"
+
+typedef std::vector<std::string> inst_t;
+
+// 调用emit, 把输出到std::cout的汇编拆成指令
+template <typename F>
+static std::vector<inst_t> capture(F emit) {
+  std::stringstream out;
+  auto old = std::cout.rdbuf(out.rdbuf());
+  emit();
+  std::cout.rdbuf(old);
+  std::vector<inst_t> prog;
+  std::string line;
+  while (std::getline(out, line)) {
+    for (auto &c : line) {
+      if (c == ',') c = ' ';
+    }
+    std::stringstream ls(line);
+    inst_t inst;
+    std::string word;
+    while (ls >> word) inst.push_back(word);
+    if (!inst.empty()) prog.push_back(inst);
+  }
+  return prog;
+}
+
+// 执行指令序列, 只支持常量乘除法会用到的指令, 遇到其他指令时报错退出
+static std::map<std::string, int32_t> run(const std::vector<inst_t> &prog, std::map<std::string, int32_t> regs) {
+  for (auto &inst : prog) {
+    auto &op = inst[0];
+    auto reg = [&](int k) { return uint32_t(regs[inst[k]]); };
+    auto imm = [&](int k) { return int32_t(std::stoll(inst[k])); };
+    auto &rd = regs[inst[1]];
+    if (op == "li") rd = imm(2);
+    else if (op == "mv") rd = int32_t(reg(2));
+    else if (op == "neg") rd = int32_t(0u - reg(2));
+    else if (op == "add") rd = int32_t(reg(2) + reg(3));
+    else if (op == "sub") rd = int32_t(reg(2) - reg(3));
+    else if (op == "mul") rd = int32_t(reg(2) * reg(3));
+    else if (op == "mulh") rd = int32_t((int64_t(int32_t(reg(2))) * int32_t(reg(3))) >> 32);
+    else if (op == "andi") rd = int32_t(reg(2) & uint32_t(imm(3)));
+    else if (op == "slli") rd = int32_t(reg(2) << (imm(3) & 31));
+    else if (op == "srli") rd = int32_t(reg(2) >> (imm(3) & 31));
+    else if (op == "srai") rd = int32_t(reg(2)) >> (imm(3) & 31);
+    else {
+      fprintf(stderr, "unexpected instruction: %s\n", op.c_str());
+      exit(2);
+    }
+  }
+  return regs;
+}
+
+static void print(const std::vector<inst_t> &prog) {
+  for (auto &inst : prog) {
+    for (auto &word : inst) fprintf(stderr, " %s", word.c_str());
+    fprintf(stderr, "\n");
+  }
+}
+
+static std::mt19937 rng(20240601);
+
+// 边界值和随机值
+static std::vector<int32_t> sample_values() {
+  std::vector<int32_t> xs = {0, 1, -1, 2, -2, 3, -3, 7, -7, 12345, -12345, 1 << 30, -(1 << 30),
+                             INT32_MAX, INT32_MAX - 1, INT32_MIN, INT32_MIN + 1};
+  for (int i = 0; i < 24; ++i) xs.push_back(int32_t(rng()));
+  return xs;
+}
+
+static long test_div() {
+  std::vector<int32_t> ds;
+  for (int d = -5000; d <= 5000; ++d) {
+    if (d != 0) ds.push_back(d);
+  }
+  for (int k = 1; k < 31; ++k) {
+    for (int e = -1; e <= 1; ++e) {
+      ds.push_back((1 << k) + e);
+      ds.push_back(-(1 << k) - e);
+    }
+  }
+  for (int32_t d : {INT32_MIN, INT32_MIN + 1, INT32_MAX, INT32_MAX - 1, 1000000007, -998244353}) ds.push_back(d);
+  for (int i = 0; i < 20000; ++i) {
+    int32_t d = int32_t(rng());
+    if (d != 0) ds.push_back(d);
+  }
+  long checks = 0;
+  for (auto d : ds) {
+    auto xs = sample_values();
+    for (int64_t m = -3; m <= 3; ++m) {
+      for (int64_t e = -1; e <= 1; ++e) xs.push_back(int32_t(uint32_t(int64_t(d) * m + e)));
+    }
+    for (bool rem : {false, true}) {
+      auto prog = capture([&] { div_by_const(d, rem); });
+      for (auto x : xs) {
+        // INT_MIN / -1 在C中溢出, 指令序列按RV32的div取回绕的结果
+        int32_t want = d == -1 ? (rem ? 0 : int32_t(0u - uint32_t(x))) : (rem ? x % d : x / d);
+        int32_t got = run(prog, {{"t0", x}})["t0"];
+        ++checks;
+        if (got != want) {
+          fprintf(stderr, "%d %c %d: got %d, want %d\n", x, rem ? '%' : '/', d, got, want);
+          print(prog);
+          exit(1);
+        }
+      }
+    }
+  }
+  return checks;
+}
+
+static long test_mul() {
+  std::vector<int32_t> cs;
+  for (int c = -3000; c <= 3000; ++c) cs.push_back(c);
+  for (int k = 0; k < 31; ++k) {
+    for (int e = -3; e <= 3; ++e) {
+      cs.push_back((1 << k) + e);
+      cs.push_back(-(1 << k) + e);
+    }
+  }
+  cs.push_back(INT32_MIN);
+  cs.push_back(INT32_MAX);
+  for (int i = 0; i < 5000; ++i) cs.push_back(int32_t(rng()));
+  long checks = 0;
+  for (auto c : cs) {
+    std::string result;
+    auto prog = capture([&] { result = mul_by_const(c, "t0", "t1", "t2"); });
+    // 不用mul时, 序列的长度要少于 li + mul 的代价
+    bool uses_mul = false;
+    for (auto &inst : prog) uses_mul |= inst[0] == "mul";
+    int li_cost = (IN_IMM12(c) || (c & 0xfff) == 0) ? 1 : 2;
+    if (!uses_mul && int(prog.size()) >= li_cost + kMulLatency) {
+      fprintf(stderr, "x * %d: %zu instructions without mul\n", c, prog.size());
+      print(prog);
+      exit(1);
+    }
+    for (auto x : sample_values()) {
+      int32_t want = int32_t(uint32_t(x) * uint32_t(c));
+      // 输入寄存器之外的临时寄存器里放上无关的值
+      int32_t got = run(prog, {{"t0", x}, {"t1", 0x1234}, {"t2", -77}})[result];
+      ++checks;
+      if (got != want) {
+        fprintf(stderr, "%d * %d: got %d, want %d\n", x, c, got, want);
+        print(prog);
+        exit(1);
+      }
+    }
+  }
+  return checks;
+}
+
+int main() {
+  long div_checks = test_div();
+  printf("div_by_const: %ld checks passed\n", div_checks);
+  long mul_checks = test_mul();
+  printf("mul_by_const: %ld checks passed\n", mul_checks);
+  return 0;
+}
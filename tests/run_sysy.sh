@@ -0,0 +1,28 @@
+#!/bin/bash
+# SysY程序的端到端回归测试: 用-O2生成Koopa IR, 经koopac/llc编译运行, 输出和返回值与.out比较
+# 用法: run_sysy.sh <compiler> <测试目录>
+compiler=$1
+dir=$2
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+pass=0
+fail=0
+for src in "$dir"/*.sy; do
+  name=$(basename "$src" .sy)
+  input=/dev/null
+  [ -f "$dir/$name.in" ] && input="$dir/$name.in"
+  if "$compiler" -koopa "$src" -o "$tmp/$name.koopa" -O2 &&
+     koopac "$tmp/$name.koopa" | llc --filetype=obj -o "$tmp/$name.o" &&
+     clang "$tmp/$name.o" -L"$CDE_LIBRARY_PATH/native" -lsysy -o "$tmp/$name"; then
+    "$tmp/$name" < "$input" > "$tmp/$name.txt"
+    echo $? >> "$tmp/$name.txt"
+  fi
+  if cmp -s "$tmp/$name.txt" "$dir/$name.out"; then
+    pass=$((pass + 1))
+  else
+    fail=$((fail + 1))
+    echo "FAIL: $name"
+  fi
+done
+echo "sysy: $pass passed, $fail failed"
+[ $fail -eq 0 ]